@@ -0,0 +1,322 @@
+#include "audio_levels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+namespace {
+
+// floor for windows of digital silence
+constexpr float min_db = -120.0F;
+
+// how far from a cut the audio is searched for evidence
+constexpr double evidence_tolerance = 0.25;
+constexpr double level_span = 0.5;
+constexpr double level_jump_db = 6.0;
+constexpr double silence_db = -50.0;
+
+float to_db(double mean_square) {
+    if (mean_square <= 0.0) {
+        return min_db;
+    }
+    return std::max(min_db, static_cast<float>(10.0 * std::log10(mean_square)));
+}
+
+// Mean level in dB over the windows covering [from, to).
+double mean_db(const AudioLevels& levels, double from, double to) {
+    auto first = static_cast<int64_t>(
+        std::floor((from - levels.start_seconds) / levels.window_seconds));
+    auto last = static_cast<int64_t>(
+        std::ceil((to - levels.start_seconds) / levels.window_seconds));
+    first = std::max<int64_t>(first, 0);
+    last = std::min<int64_t>(last, static_cast<int64_t>(levels.rms_db.size()));
+
+    if (first >= last) {
+        return NAN;
+    }
+    double sum = 0.0;
+    for (int64_t i = first; i < last; i++) {
+        sum += levels.rms_db[i];
+    }
+    return sum / static_cast<double>(last - first);
+}
+
+} // namespace
+
+double sum_squares_f32(const float* samples, size_t n) {
+    size_t i = 0;
+    double sum = 0.0;
+#ifdef __SSE2__
+    // two accumulators to hide the add latency; windows are short enough
+    // for float partial sums
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_loadu_ps(samples + i);
+        __m128 b = _mm_loadu_ps(samples + i + 4);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++) {
+        sum += static_cast<double>(samples[i]) * samples[i];
+    }
+    return sum;
+}
+
+uint64_t sum_squares_s16(const int16_t* samples, size_t n) {
+    size_t i = 0;
+    uint64_t sum = 0;
+#ifdef __SSE2__
+    // pmaddwd sums pairs of squares into 32 bits; at most 2^31, so the
+    // lanes are widened as unsigned
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(samples + i)); // NOLINT
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc); // NOLINT
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) {
+        sum += static_cast<uint64_t>(static_cast<int32_t>(samples[i]) *
+                                     samples[i]);
+    }
+    return sum;
+}
+
+std::vector<SilenceRange> find_silences(const AudioLevels& levels,
+                                        double noise_db,
+                                        double min_duration) {
+    std::vector<SilenceRange> out;
+    size_t begin = 0;
+    bool in_silence = false;
+
+    auto close = [&](size_t end) {
+        double start = levels.time_of(begin);
+        double stop = levels.time_of(end);
+        if (stop - start >= min_duration) {
+            out.push_back(SilenceRange{.start = start, .end = stop});
+        }
+    };
+
+    for (size_t i = 0; i < levels.rms_db.size(); i++) {
+        bool quiet = levels.rms_db[i] < noise_db;
+        if (quiet && !in_silence) {
+            begin = i;
+        } else if (!quiet && in_silence) {
+            close(i);
+        }
+        in_silence = quiet;
+    }
+    if (in_silence) {
+        close(levels.rms_db.size());
+    }
+    return out;
+}
+
+bool audio_confirms_cut(const AudioLevels& levels, double seconds) {
+    double quietest = NAN;
+    for (double t = seconds - evidence_tolerance;
+         t < seconds + evidence_tolerance; t += levels.window_seconds) {
+        double db = mean_db(levels, t, t + levels.window_seconds);
+        if (!std::isnan(db) && (std::isnan(quietest) || db < quietest)) {
+            quietest = db;
+        }
+    }
+    if (!std::isnan(quietest) && quietest < silence_db) {
+        return true;
+    }
+
+    double before = mean_db(levels, seconds - level_span, seconds);
+    double after = mean_db(levels, seconds, seconds + level_span);
+    return !std::isnan(before) && !std::isnan(after) &&
+           std::abs(after - before) >= level_jump_db;
+}
+
+size_t drop_unconfirmed_cuts(CutList& cuts, const AudioLevels& levels) {
+    const double tb = av_q2d(cuts.time_base);
+    size_t kept = 0;
+    for (size_t i = 0; i < cuts.frames.size(); i++) {
+        double seconds = static_cast<double>(cuts.pts[i]) * tb;
+        if (audio_confirms_cut(levels, seconds)) {
+            cuts.frames[kept] = cuts.frames[i];
+            cuts.pts[kept] = cuts.pts[i];
+            kept++;
+        }
+    }
+    size_t dropped = cuts.frames.size() - kept;
+    cuts.frames.resize(kept);
+    cuts.pts.resize(kept);
+    return dropped;
+}
+
+AudioAnalyzer::AudioAnalyzer(const AVStream* stream) : stream(stream) {}
+
+AudioAnalyzer::~AudioAnalyzer() {
+    av_frame_free(&frame);
+    avcodec_free_context(&decoder);
+}
+
+int AudioAnalyzer::open() {
+    const auto* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (codec == nullptr) {
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    decoder = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    if (decoder == nullptr || frame == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    int ret = avcodec_parameters_to_context(decoder, stream->codecpar);
+    if (ret < 0) {
+        return ret;
+    }
+    // audio decoding is cheap next to video, one thread is plenty
+    decoder->thread_count = 1;
+    return avcodec_open2(decoder, codec, nullptr);
+}
+
+int AudioAnalyzer::consume(const AVPacket* pkt) {
+    int ret = avcodec_send_packet(decoder, pkt);
+    // broken audio packets are not worth failing the video for
+    if (ret == AVERROR_INVALIDDATA) {
+        return 0;
+    }
+    if (ret < 0 && ret != AVERROR_EOF) {
+        return ret;
+    }
+    ret = receive_frames();
+    if (pkt == nullptr && acc_samples > 0) {
+        result.rms_db.push_back(
+            to_db(acc_sum_sq / static_cast<double>(acc_samples)));
+        acc_samples = 0;
+    }
+    return ret;
+}
+
+int AudioAnalyzer::receive_frames() {
+    while (true) {
+        int ret = avcodec_receive_frame(decoder, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            return ret == AVERROR_INVALIDDATA ? 0 : ret;
+        }
+        add_frame(frame);
+        av_frame_unref(frame);
+    }
+}
+
+void AudioAnalyzer::add_frame(const AVFrame* f) {
+    const int channels = f->ch_layout.nb_channels;
+    if (channels <= 0 || f->sample_rate <= 0 || f->nb_samples <= 0) {
+        return;
+    }
+
+    if (!started) {
+        started = true;
+        window_samples = std::max<int64_t>(
+            1, static_cast<int64_t>(result.window_seconds * f->sample_rate) *
+                   channels);
+        if (f->best_effort_timestamp != AV_NOPTS_VALUE) {
+            result.start_seconds =
+                static_cast<double>(f->best_effort_timestamp) *
+                av_q2d(stream->time_base);
+        }
+    }
+
+    const auto fmt = static_cast<AVSampleFormat>(f->format);
+    const bool planar = av_sample_fmt_is_planar(fmt) != 0;
+    const int planes = planar ? channels : 1;
+    const int per_plane = planar ? 1 : channels;
+
+    // Walk the frame in steps that end on window boundaries. Interleaved
+    // samples are consumed directly; planar ones plane by plane.
+    int64_t pos = 0;
+    const int64_t frame_samples = f->nb_samples;
+    while (pos < frame_samples) {
+        int64_t room = (window_samples - acc_samples) / channels;
+        int64_t n = std::clamp<int64_t>(room, 1, frame_samples - pos);
+
+        double sum = 0.0;
+        for (int p = 0; p < planes; p++) {
+            const uint8_t* base = f->extended_data[p];
+            const auto off = static_cast<size_t>(pos * per_plane);
+            const auto cnt = static_cast<size_t>(n * per_plane);
+            switch (fmt) {
+            case AV_SAMPLE_FMT_FLT:
+            case AV_SAMPLE_FMT_FLTP:
+                sum += sum_squares_f32(
+                    reinterpret_cast<const float*>(base) + off, cnt); // NOLINT
+                break;
+            case AV_SAMPLE_FMT_S16:
+            case AV_SAMPLE_FMT_S16P:
+                sum += static_cast<double>(sum_squares_s16(
+                           reinterpret_cast<const int16_t*>(base) + // NOLINT
+                               off,
+                           cnt)) /
+                       (32768.0 * 32768.0);
+                break;
+            case AV_SAMPLE_FMT_S32:
+            case AV_SAMPLE_FMT_S32P: {
+                const auto* s = reinterpret_cast<const int32_t*>(base); // NOLINT
+                for (size_t i = off; i < off + cnt; i++) {
+                    double v = s[i] / 2147483648.0;
+                    sum += v * v;
+                }
+                break;
+            }
+            case AV_SAMPLE_FMT_DBL:
+            case AV_SAMPLE_FMT_DBLP: {
+                const auto* s = reinterpret_cast<const double*>(base); // NOLINT
+                for (size_t i = off; i < off + cnt; i++) {
+                    sum += s[i] * s[i];
+                }
+                break;
+            }
+            case AV_SAMPLE_FMT_U8:
+            case AV_SAMPLE_FMT_U8P:
+                for (size_t i = off; i < off + cnt; i++) {
+                    double v = (base[i] - 128) / 128.0;
+                    sum += v * v;
+                }
+                break;
+            default:
+                return;
+            }
+        }
+
+        add_samples(sum, n * channels);
+        pos += n;
+    }
+}
+
+void AudioAnalyzer::add_samples(double sum_sq, int64_t count) {
+    acc_sum_sq += sum_sq;
+    acc_samples += count;
+    if (acc_samples >= window_samples) {
+        result.rms_db.push_back(
+            to_db(acc_sum_sq / static_cast<double>(acc_samples)));
+        acc_samples = 0;
+        acc_sum_sq = 0.0;
+    }
+}
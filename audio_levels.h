@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "detect.h"
+#include "multi_stream.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Sum of squares of `n` samples, vectorized where available.
+double sum_squares_f32(const float* samples, size_t n);
+// Same for 16 bit samples, unscaled.
+uint64_t sum_squares_s16(const int16_t* samples, size_t n);
+
+// RMS level of an audio stream in fixed windows, all channels mixed.
+struct AudioLevels {
+    double window_seconds{0.02};
+    // container time of the first window
+    double start_seconds{0.0};
+    // dBFS per window
+    std::vector<float> rms_db;
+
+    [[nodiscard]] double time_of(size_t window) const {
+        return start_seconds + (static_cast<double>(window) * window_seconds);
+    }
+};
+
+struct SilenceRange {
+    double start;
+    double end;
+};
+
+// Ranges at least `min_duration` seconds long that stay below `noise_db`,
+// like ffmpeg's silencedetect.
+[[nodiscard]] std::vector<SilenceRange>
+find_silences(const AudioLevels& levels, double noise_db = -50.0,
+              double min_duration = 0.2);
+
+// True if the audio around `seconds` supports a cut there: the level drops
+// to silence nearby or jumps by several dB across it.
+[[nodiscard]] bool audio_confirms_cut(const AudioLevels& levels,
+                                      double seconds);
+
+// Removes the cuts the audio does not support. Returns how many were
+// removed.
+size_t drop_unconfirmed_cuts(CutList& cuts, const AudioLevels& levels);
+
+// Decodes an audio stream and measures its level.
+class AudioAnalyzer final : public StreamConsumer {
+  public:
+    explicit AudioAnalyzer(const AVStream* stream);
+    ~AudioAnalyzer() override;
+
+    int open();
+
+    int consume(const AVPacket* pkt) override;
+
+    [[nodiscard]] const AudioLevels& levels() const { return result; }
+
+  private:
+    int receive_frames();
+    void add_frame(const AVFrame* frame);
+    void add_samples(double sum_sq, int64_t count);
+
+    const AVStream* stream;
+    AVCodecContext* decoder{nullptr};
+    AVFrame* frame{nullptr};
+
+    AudioLevels result;
+    bool started{false};
+    // samples (all channels) per window and the window being filled
+    int64_t window_samples{0};
+    int64_t acc_samples{0};
+    double acc_sum_sq{0.0};
+};
@@ -0,0 +1,239 @@
+#include "cluster.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+// scenes per block of the distance matrix: the block's features (145 rows
+// of 1 KiB) stay in L2 while every other scene is measured against them
+constexpr int block_scenes = 256;
+// columns are padded to this, so every vector load of a row is full
+constexpr int column_align = 16;
+
+struct Merge {
+    int a;
+    int b;
+    float distance;
+};
+
+// Nearest-neighbour chain clustering with average linkage, in O(n^2) time
+// on the full matrix `dist`, which it overwrites. Returns the n - 1 merges
+// in the order they happen.
+std::vector<Merge> average_linkage(std::vector<float>& dist, int n) {
+    std::vector<Merge> merges;
+    std::vector<int> size(n, 1);
+    std::vector<char> active(n, 1);
+    std::vector<int> chain;
+    int remaining = n;
+    int next_start = 0;
+    const auto at = [&](int i, int j) -> float& {
+        return dist[(static_cast<size_t>(i) * n) + j];
+    };
+
+    while (remaining > 1) {
+        if (chain.empty()) {
+            while (active[next_start] == 0) {
+                next_start++;
+            }
+            chain.push_back(next_start);
+        }
+        const int a = chain.back();
+        const int prev = chain.size() > 1 ? chain[chain.size() - 2] : -1;
+        // ties go to the previous link so the chain always ends
+        int b = prev;
+        float best = prev >= 0 ? at(a, prev) : INFINITY;
+        for (int k = 0; k < n; k++) {
+            if (k != a && active[k] != 0 && at(a, k) < best) {
+                best = at(a, k);
+                b = k;
+            }
+        }
+
+        if (b != prev) {
+            chain.push_back(b);
+            continue;
+        }
+
+        // a and b are each other's nearest: merge b into a
+        chain.pop_back();
+        chain.pop_back();
+        merges.push_back(Merge{.a = a, .b = b, .distance = best});
+        const auto sa = static_cast<float>(size[a]);
+        const auto sb = static_cast<float>(size[b]);
+        for (int k = 0; k < n; k++) {
+            if (active[k] != 0 && k != a && k != b) {
+                const float d =
+                    ((sa * at(a, k)) + (sb * at(b, k))) / (sa + sb);
+                at(a, k) = d;
+                at(k, a) = d;
+            }
+        }
+        size[a] += size[b];
+        active[b] = 0;
+        remaining--;
+    }
+    return merges;
+}
+
+int find_root(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+} // namespace
+
+int SceneFeatures::push(const TilePool& pool) {
+    if (n == stride) {
+        // double the columns, re-laying out the rows
+        const ptrdiff_t grown = std::max<ptrdiff_t>(2 * stride, column_align);
+        std::vector<float> moved(static_cast<size_t>(dims) * grown, 0.0F);
+        for (int d = 0; d < dims; d++) {
+            std::copy_n(values.data() + (d * stride), n,
+                        moved.data() + (d * grown));
+        }
+        values = std::move(moved);
+        stride = grown;
+    }
+
+    const auto mean = pool.mean();
+    const double brightness =
+        std::accumulate(mean.begin(), mean.end(), 0.0) /
+        static_cast<double>(mean.size());
+    for (size_t d = 0; d < mean.size(); d++) {
+        values[(d * stride) + n] = static_cast<float>(mean[d] - brightness);
+    }
+    values[((dims - 1) * stride) + n] = static_cast<float>(brightness);
+    return n++;
+}
+
+std::vector<float> SceneFeatures::distances() const {
+    const auto sq_distances = kernels().sq_distances;
+    std::vector<float> dist(static_cast<size_t>(n) * n);
+
+    // Block i0 is measured against every scene from i0 on, which fills
+    // dist[j][i] for j >= i0; the rest is the mirror image.
+    for (int i0 = 0; i0 < n; i0 += block_scenes) {
+        const int count = std::min(block_scenes, n - i0);
+        for (int j = i0; j < n; j += distance_rows) {
+            const int rows = std::min(distance_rows, n - j);
+            sq_distances(values.data() + i0, values.data() + j, stride, dims,
+                         rows, count, dist.data() + (j * n) + i0, n);
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < j; i++) {
+            float& d = dist[(static_cast<size_t>(j) * n) + i];
+            d = std::sqrt(d / static_cast<float>(dims));
+            dist[(static_cast<size_t>(i) * n) + j] = d;
+        }
+        dist[(static_cast<size_t>(j) * n) + j] = 0.0F;
+    }
+    return dist;
+}
+
+void ShotClusterer::push(const FrameScore& score, const TileGrid& grid,
+                         bool scene_start) {
+    if (scene_start) {
+        close_scene();
+    }
+    if (frames == 0) {
+        first_frame = score.frame;
+    }
+    frames++;
+    pool.add(grid);
+}
+
+void ShotClusterer::finish() { close_scene(); }
+
+void ShotClusterer::close_scene() {
+    if (frames == 0) {
+        return;
+    }
+    scenes.push_back(Scene{
+        .first_frame = first_frame,
+        .frames = frames,
+        .feature = pool.frames > 0 ? features.push(pool) : -1,
+    });
+    pool = TilePool{};
+    frames = 0;
+}
+
+std::vector<int> ShotClusterer::cluster(double distance) const {
+    const int n = features.count();
+    std::vector<int> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    if (n > 1) {
+        std::vector<float> dist = features.distances();
+        // average linkage never merges below an earlier merge, so the
+        // merges under the cut are exactly the clusters
+        for (const auto& m : average_linkage(dist, n)) {
+            if (m.distance <= distance) {
+                parent[find_root(parent, m.b)] = find_root(parent, m.a);
+            }
+        }
+    }
+
+    std::vector<int> number(n, -1);
+    std::vector<int> labels;
+    labels.reserve(scenes.size());
+    int clusters = 0;
+    for (const auto& s : scenes) {
+        if (s.feature < 0) {
+            labels.push_back(-1);
+            continue;
+        }
+        int& id = number[find_root(parent, s.feature)];
+        if (id < 0) {
+            id = clusters++;
+        }
+        labels.push_back(id);
+    }
+    return labels;
+}
+
+int ShotClusterer::write(const char* path) const {
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+        return AVERROR(errno);
+    }
+
+    const std::vector<int> labels = cluster();
+    std::vector<int> members(scenes.size(), 0);
+    for (int id : labels) {
+        if (id >= 0) {
+            members[id]++;
+        }
+    }
+
+    (void)fputs("scene,first_frame,frames,cluster\n", out);
+    for (size_t i = 0; i < scenes.size(); i++) {
+        (void)fprintf(out, "%zu,%lld,%lld,%d\n", i,
+                      static_cast<long long>(scenes[i].first_frame),
+                      static_cast<long long>(scenes[i].frames), labels[i]);
+    }
+
+    const auto recurring =
+        std::count_if(members.begin(), members.end(),
+                      [](int count) { return count > 1; });
+    int clustered = 0;
+    for (int id : labels) {
+        clustered += id >= 0 && members[id] > 1 ? 1 : 0;
+    }
+    printf("Clusters: %lld recurring setups cover %d of %zu scenes\n",
+           static_cast<long long>(recurring), clustered, scenes.size());
+
+    return fclose(out) == 0 ? 0 : AVERROR(EIO);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "detect.h"
+#include "flash.h"
+
+// Feature vectors of scenes stored one dimension per row, so the distance
+// kernel reads a dimension of consecutive scenes as one vector. A vector
+// is the scene's average tile grid minus its mean brightness, followed by
+// that brightness: the layout of the picture dominates, a grade or an
+// exposure change moves it little.
+class SceneFeatures {
+  public:
+    static constexpr int dims = (TileGrid::cols * TileGrid::rows) + 1;
+
+    // Appends a scene; returns its column.
+    int push(const TilePool& pool);
+
+    [[nodiscard]] int count() const { return n; }
+
+    // Root mean square difference per dimension between all pairs of
+    // scenes, count() x count().
+    [[nodiscard]] std::vector<float> distances() const;
+
+  private:
+    std::vector<float> values;
+    // floats per row; columns past n are zero
+    ptrdiff_t stride{0};
+    int n{0};
+};
+
+// Groups the scenes of a stream that show the same setup: both sides of a
+// shot/reverse-shot, a location the story keeps returning to. Average
+// linkage agglomerative clustering over the distances of SceneFeatures,
+// cut where merging would join scenes further apart than `distance` on
+// average. Memory is count()^2 floats at the end; nothing grows per frame.
+class ShotClusterer {
+  public:
+    // mean tile difference, in [0, 255], at which scenes stop clustering
+    static constexpr double default_distance = 10.0;
+
+    // Takes every frame in order with the cut decision on it.
+    void push(const FrameScore& score, const TileGrid& grid,
+              bool scene_start);
+
+    // Closes the last scene.
+    void finish();
+
+    // Cluster number of every scene, numbered in order of first
+    // appearance; -1 for scenes without a valid tile grid.
+    [[nodiscard]] std::vector<int>
+    cluster(double distance = default_distance) const;
+
+    // Writes scene,first_frame,frames,cluster rows. Returns 0 or a
+    // negative AVERROR.
+    int write(const char* path) const;
+
+  private:
+    void close_scene();
+
+    struct Scene {
+        int64_t first_frame;
+        int64_t frames;
+        // column in `features`, or -1
+        int feature;
+    };
+
+    TilePool pool;
+    int64_t first_frame{0};
+    int64_t frames{0};
+    std::vector<Scene> scenes;
+    SceneFeatures features;
+};
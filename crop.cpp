@@ -0,0 +1,100 @@
+#include "crop.h"
+
+#include "kernels.h"
+
+namespace {
+
+// Mean luma at or below this counts as black. Limited range black is 16;
+// the margin covers compression noise in the bars.
+constexpr uint64_t black_level = 24;
+
+bool dark_row(PlaneView luma, int y, int x0, int x1) {
+    uint64_t sum =
+        kernels().sum(luma.data + (y * luma.stride) + x0, luma.stride,
+                      x1 - x0, 1);
+    return sum <= black_level * static_cast<uint64_t>(x1 - x0);
+}
+
+bool dark_column(PlaneView luma, int x, int y0, int y1) {
+    uint64_t sum = kernels().sum(luma.data + (y0 * luma.stride) + x,
+                                 luma.stride, 1, y1 - y0);
+    return sum <= black_level * static_cast<uint64_t>(y1 - y0);
+}
+
+} // namespace
+
+Rect find_active_area(PlaneView luma) {
+    int top = 0;
+    int bottom = luma.height;
+    while (top < bottom && dark_row(luma, top, 0, luma.width)) {
+        top++;
+    }
+    while (bottom > top && dark_row(luma, bottom - 1, 0, luma.width)) {
+        bottom--;
+    }
+
+    // columns only over the rows left, so letterbox corners do not count
+    int left = 0;
+    int right = luma.width;
+    if (top < bottom) {
+        while (left < right && dark_column(luma, left, top, bottom)) {
+            left++;
+        }
+        while (right > left && dark_column(luma, right - 1, top, bottom)) {
+            right--;
+        }
+    }
+
+    // shrink to even edges
+    top = (top + 1) & ~1;
+    left = (left + 1) & ~1;
+    bottom &= ~1;
+    right &= ~1;
+    if (2 * (bottom - top) < luma.height || 2 * (right - left) < luma.width) {
+        return Rect{};
+    }
+    return Rect{.x = left, .y = top, .width = right - left,
+                .height = bottom - top};
+}
+
+Rect CropTracker::check(const AVFrame* frame) const {
+    return find_active_area(PlaneView{.data = frame->data[0],
+                                      .stride = frame->linesize[0],
+                                      .width = frame->width,
+                                      .height = frame->height});
+}
+
+Rect CropTracker::update(const AVFrame* frame) {
+    if (frame->width != width || frame->height != height) {
+        width = frame->width;
+        height = frame->height;
+        known = false;
+        area = Rect{.x = 0, .y = 0, .width = width, .height = height};
+        pending = Rect{};
+        until_check = 0;
+    }
+    if (until_check > 0) {
+        until_check--;
+        return area;
+    }
+
+    Rect found = check(frame);
+    if (found.width == 0) {
+        // a dark frame says nothing; before the first content keep looking
+        until_check = known ? recheck_interval : 0;
+        return area;
+    }
+
+    if (!known || found.contains(area)) {
+        area = found;
+        pending = Rect{};
+        known = true;
+    } else if (found == pending) {
+        area = found;
+        pending = Rect{};
+    } else {
+        pending = found;
+    }
+    until_check = recheck_interval;
+    return area;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+#include "thumbnail.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Rectangle in luma pixels.
+struct Rect {
+    int x{0};
+    int y{0};
+    int width{0};
+    int height{0};
+
+    bool operator==(const Rect&) const = default;
+
+    [[nodiscard]] bool contains(const Rect& r) const {
+        return r.x >= x && r.y >= y && r.x + r.width <= x + width &&
+               r.y + r.height <= y + height;
+    }
+};
+
+// The picture inside black bars at the edges of `luma`: letterbox,
+// pillarbox or both. Edges are kept even so 4:2:0 chroma lines up. Returns
+// an empty rectangle if less than half the frame in either direction is
+// left, which means the frame is mostly dark rather than boxed.
+[[nodiscard]] Rect find_active_area(PlaneView luma);
+
+// Tracks the active area of one stream. It is detected on the first frame
+// with content and re-checked every `recheck_interval` frames. A larger
+// area (picture in the bars) is taken at once; a smaller one only after two
+// checks in a row agree, so dark scenes do not crop real picture.
+class CropTracker {
+  public:
+    static constexpr int64_t recheck_interval = 120;
+
+    // Area of `frame` to analyze; the whole frame until bars are found.
+    Rect update(const AVFrame* frame);
+
+  private:
+    Rect check(const AVFrame* frame) const;
+
+    int width{0};
+    int height{0};
+    bool known{false};
+    Rect area;
+    Rect pending;
+    int64_t until_check{0};
+};
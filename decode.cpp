@@ -0,0 +1,108 @@
+#include "decode.h"
+
+#include <cassert>
+#include <memory>
+
+#include "decoder_tuning.h"
+#include "machine_profile.h"
+
+std::variant<DecodeContext, DecoderCreationError>
+DecodeContext::open(const char* url, AVIOContext* pb) {
+    auto pkt = make_managed<AVPacket, av_packet_alloc, av_packet_free>();
+    auto frame1 = make_managed<AVFrame, av_frame_alloc, av_frame_free>();
+    auto frame2 = make_managed<AVFrame, av_frame_alloc, av_frame_free>();
+
+    // this should work with the way smart pointers work right?
+    if ((pkt == nullptr) || (frame1 == nullptr) || (frame2 == nullptr)) {
+        return DecoderCreationError{
+            .type = DecoderCreationError::AllocationFailure};
+    }
+
+    AVFormatContext* raw_demuxer = nullptr;
+    if (pb != nullptr) {
+        raw_demuxer = avformat_alloc_context();
+        if (raw_demuxer == nullptr) {
+            return DecoderCreationError{
+                .type = DecoderCreationError::AllocationFailure};
+        }
+        raw_demuxer->pb = pb;
+        raw_demuxer->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    // avformat_open_input automatically frees on failure so we construct
+    // the smart pointer AFTER this expression.
+    {
+        int ret = avformat_open_input(&raw_demuxer, url, nullptr, nullptr);
+        if (ret < 0) {
+            return {DecoderCreationError{
+                .type = DecoderCreationError::AVError, .averror = ret}};
+        }
+    }
+
+    assert(raw_demuxer != nullptr);
+    auto demuxer =
+        std::unique_ptr<AVFormatContext, decltype([](AVFormatContext* ctx) {
+                            avformat_close_input(&ctx);
+                        })>(raw_demuxer);
+
+    avformat_find_stream_info(demuxer.get(), nullptr);
+
+    // find stream idx of video stream
+    int stream_idx = [](AVFormatContext* demuxer) {
+        for (unsigned int stream_idx = 0; stream_idx < demuxer->nb_streams;
+             stream_idx++) {
+            if (demuxer->streams[stream_idx]->codecpar->codec_type ==
+                AVMEDIA_TYPE_VIDEO) {
+                return static_cast<int>(stream_idx);
+            }
+        }
+        return -1;
+    }(demuxer.get());
+
+    if (stream_idx < 0) {
+        return {DecoderCreationError{
+            .type = DecoderCreationError::NoVideoStream,
+        }};
+    }
+
+    // index is stored in AVStream->index
+    auto* stream = demuxer->streams[stream_idx];
+
+    const auto* codec = find_video_decoder(stream->codecpar);
+    if (codec == nullptr) {
+        return {DecoderCreationError{
+            .type = DecoderCreationError::NoDecoderAvailable,
+        }};
+    }
+
+    auto decoder =
+        std::unique_ptr<AVCodecContext, decltype([](AVCodecContext* ctx) {
+                            avcodec_free_context(&ctx);
+                        })>(avcodec_alloc_context3(codec));
+
+    {
+        int ret =
+            avcodec_parameters_to_context(decoder.get(), stream->codecpar);
+        if (ret < 0) {
+            return {DecoderCreationError{
+                .type = DecoderCreationError::AVError, .averror = ret}};
+        }
+    }
+
+    // automatic threading unless the machine was calibrated
+    decoder->thread_count = machine_profile().decoder_threads;
+    if (machine_profile().thread_type != 0) {
+        decoder->thread_type = machine_profile().thread_type;
+    }
+
+    FrameBuf framebuf{frame1.release(), frame2.release()};
+
+    return std::variant<DecodeContext, DecoderCreationError>{
+        std::in_place_type<DecodeContext>,
+        demuxer.release(),
+        stream,
+        decoder.release(),
+        pkt.release(),
+        framebuf,
+        pb};
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <variant>
+
+#include "util.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+}
+
+struct DecoderCreationError {
+    enum DCErrorType : uint8_t {
+        AllocationFailure,
+        NoVideoStream,
+        NoDecoderAvailable,
+        AVError
+    } type;
+    int averror = 0;
+
+    [[nodiscard]] constexpr std::string_view errmsg() const {
+        static constexpr std::string_view errmsg_sv[] = {
+            [AllocationFailure] = "Allocation Failure in decoder construction",
+            [NoVideoStream] = "No video stream exists in input file",
+            [NoDecoderAvailable] = "No decoder available for codec",
+            [AVError] = "Unspecified AVError occurred",
+        };
+
+        return errmsg_sv[this->type];
+    }
+};
+
+using FrameBuf = std::array<AVFrame*, 2>;
+
+struct DecodeContext {
+    // these fields can be null
+    AVFormatContext* demuxer{nullptr};
+    AVStream* stream{nullptr};
+    AVCodecContext* decoder{nullptr};
+
+    AVPacket* pkt{nullptr};
+    FrameBuf framebuf{};
+
+    // custom IO passed to open(), if any; freed with the demuxer
+    AVIOContext* custom_io{nullptr};
+
+    constexpr DecodeContext() = default;
+
+    // move constructor
+    DecodeContext(DecodeContext&& source) = delete;
+
+    // copy constructor
+    DecodeContext(DecodeContext&) = delete;
+
+    // copy assignment operator
+    DecodeContext& operator=(const DecodeContext&) = delete;
+    // move assignment operator
+    DecodeContext& operator=(const DecodeContext&&) = delete;
+
+    constexpr ~DecodeContext() {
+        // Since we deleted all the copy/move constructors,
+        // we can do this without handling a "moved from" case.
+
+        for (auto* f : framebuf) {
+            av_frame_free(&f);
+        }
+
+        av_packet_free(&pkt);
+        avcodec_free_context(&decoder);
+        avformat_close_input(&demuxer);
+
+        if (custom_io != nullptr) {
+            av_freep(&custom_io->buffer);
+            avio_context_free(&custom_io);
+        }
+    }
+
+    DecodeContext(AVFormatContext* demuxer_, AVStream* stream_,
+                  AVCodecContext* decoder_, AVPacket* pkt_, FrameBuf frame_,
+                  AVIOContext* custom_io_ = nullptr)
+        : demuxer(demuxer_), stream(stream_), decoder(decoder_), pkt(pkt_),
+          framebuf(frame_), custom_io(custom_io_) {}
+
+    // `pb` is an optional custom IO context. It stays owned by the caller
+    // unless opening succeeds, in which case it is freed together with the
+    // demuxer.
+    [[nodiscard]] static std::variant<DecodeContext, DecoderCreationError>
+    open(const char* url, AVIOContext* pb = nullptr);
+};
+
+// how do you make a static allocation?
+
+// Move cursor up and erase line
+#define ERASE_LINE_ANSI "\x1B[1A\x1B[2K"
+
+// Decodes every frame of the stream and hands adjacent pairs to
+// `sink.push_frame(cur, prev, frame_idx)`.
+// assume DecodeContext is not in a moved-from state.
+template <typename Sink>
+int run_decoder(DecodeContext& dc, Sink& sink, bool show_progress = true) {
+    // AVCodecContext allocated with alloc context
+    // previously was allocated with non-NULL codec,
+    // so we can pass NULL here.
+    int ret = avcodec_open2(dc.decoder, nullptr, nullptr);
+    if (ret < 0) [[unlikely]] {
+        return ret;
+    }
+
+    // start off with first conceptual frame = 0 index
+    int accessor_offset = 0;
+
+    int last_frame = 0;
+
+    auto receive_frames = [&dc, &sink, accessor_offset]() mutable {
+        // receive last frames
+        while (true) {
+            // ret = avcodec_receive_frame(dc.decoder, dc.framebuf[0]);
+
+            int ret = avcodec_receive_frame(dc.decoder,
+                                            dc.framebuf[1 ^ accessor_offset]);
+
+            if (ret < 0) [[unlikely]] {
+                return ret;
+            }
+
+            AVFrame* cur = dc.framebuf[1 ^ accessor_offset];
+            int64_t frame_idx = dc.decoder->frame_num - 1;
+
+            if (dc.decoder->frame_num > 1) [[likely]] {
+                // use adjacent pair of frames
+                AVFrame* prev = dc.framebuf[0 ^ accessor_offset];
+
+                sink.push_frame(cur, prev, frame_idx);
+
+                av_frame_unref(prev);
+            } else {
+                // no unref needed, second frame is already unref
+                // and first frame is needed next iteration
+                sink.push_frame(cur, nullptr, frame_idx);
+            }
+
+            accessor_offset ^= 1;
+        }
+    };
+
+    if (show_progress) {
+        printf("Received 0 frames so far\n");
+    }
+
+    while (true) {
+        // Get packet (compressed data) from demuxer
+        int ret = av_read_frame(dc.demuxer, dc.pkt);
+        // EOF in compressed data
+        if (ret < 0) [[unlikely]] {
+            break;
+        }
+
+        // skip packets other than the ones we're interested in
+        if (dc.pkt->stream_index != dc.stream->index) [[unlikely]] {
+            av_packet_unref(dc.pkt);
+            continue;
+        }
+
+        // Send the compressed data to the decoder
+        ret = avcodec_send_packet(dc.decoder, dc.pkt);
+        if (ret < 0) {
+            // Error decoding frame
+            av_packet_unref(dc.pkt);
+
+            w_stdout("Error decoding frame!\nError was not EAGAIN\n");
+
+            return ret;
+        } else {
+            av_packet_unref(dc.pkt);
+        }
+
+        receive_frames();
+
+        if (show_progress && dc.decoder->frame_num - last_frame > 40) {
+            last_frame = (int)dc.decoder->frame_num;
+
+            printf(ERASE_LINE_ANSI "Received %d frames so far\n", last_frame);
+        }
+    }
+
+    // send flush packet
+    avcodec_send_packet(dc.decoder, nullptr);
+    receive_frames();
+
+    if (show_progress) {
+        printf(ERASE_LINE_ANSI "Received %d frames so far\n",
+               (int)dc.decoder->frame_num);
+    }
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include "decoder_tuning.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "machine_profile.h"
+#include "util.h"
+
+namespace {
+
+// enough to get past frame-threading warm-up, short enough to be cheap
+constexpr int bench_packets = 240;
+
+struct Preference {
+    AVCodecID id;
+    int size_class;
+    const AVCodec* codec;
+};
+
+// written by tune_decoder() before decoding starts, read-only afterwards
+std::vector<Preference> preferences;
+
+int size_class(int width, int height) {
+    const int64_t pixels = static_cast<int64_t>(width) * height;
+    if (pixels <= 720 * 576) {
+        return 0;
+    }
+    if (pixels <= 1280 * 720) {
+        return 1;
+    }
+    if (pixels <= 1920 * 1088) {
+        return 2;
+    }
+    if (pixels <= 3840 * 2160) {
+        return 3;
+    }
+    return 4;
+}
+
+constexpr const char* size_class_names[] = {"sd", "hd", "fhd", "uhd",
+                                            "above-uhd"};
+
+// Software decoders for `id`. Hardware wrappers are left out: they need a
+// device the rest of the pipeline does not set up.
+std::vector<const AVCodec*> candidate_decoders(AVCodecID id) {
+    std::vector<const AVCodec*> out;
+    void* opaque = nullptr;
+    while (const AVCodec* c = av_codec_iterate(&opaque)) {
+        if (c->id != id || av_codec_is_decoder(c) == 0 ||
+            (c->capabilities &
+             (AV_CODEC_CAP_EXPERIMENTAL | AV_CODEC_CAP_HARDWARE)) != 0) {
+            continue;
+        }
+        out.push_back(c);
+    }
+    return out;
+}
+
+// profile lines: "decoder <codec> <size class> <machine> <decoder name>"
+std::string profile_key(AVCodecID id, int cls, const std::string& machine) {
+    return std::string("decoder ") + avcodec_get_name(id) + " " +
+           size_class_names[cls] + " " + machine + " ";
+}
+
+} // namespace
+
+std::unique_ptr<TrialInput> TrialInput::open(const char* url) {
+    std::unique_ptr<TrialInput> input(new TrialInput());
+    if (avformat_open_input(&input->demuxer, url, nullptr, nullptr) < 0) {
+        return nullptr;
+    }
+    avformat_find_stream_info(input->demuxer, nullptr);
+
+    input->stream = av_find_best_stream(input->demuxer, AVMEDIA_TYPE_VIDEO,
+                                        -1, -1, nullptr, 0);
+    if (input->stream < 0) {
+        return nullptr;
+    }
+    return input;
+}
+
+TrialInput::~TrialInput() {
+    for (auto*& p : pkts) {
+        av_packet_free(&p);
+    }
+    avformat_close_input(&demuxer);
+}
+
+int TrialInput::read_packet(AVPacket* pkt) {
+    while (true) {
+        int ret = av_read_frame(demuxer, pkt);
+        if (ret < 0 || pkt->stream_index == stream) {
+            return ret;
+        }
+        av_packet_unref(pkt);
+    }
+}
+
+int TrialInput::read_packets(int count) {
+    for (int n = 0; n < count; n++) {
+        AVPacket* pkt = av_packet_alloc();
+        if (pkt == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        int ret = read_packet(pkt);
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            return ret == AVERROR_EOF ? 0 : ret;
+        }
+        pkts.push_back(pkt);
+    }
+    return 0;
+}
+
+double time_decoder(const TrialInput& input, const AVCodec* codec,
+                    int threads, int thread_type, std::vector<AVFrame*>* keep,
+                    size_t keep_count) {
+    AVCodecContext* dec = avcodec_alloc_context3(codec);
+    AVFrame* frame = av_frame_alloc();
+    auto cleanup = [&] {
+        av_frame_free(&frame);
+        avcodec_free_context(&dec);
+    };
+    if (dec == nullptr || frame == nullptr ||
+        avcodec_parameters_to_context(dec, input.codecpar()) < 0) {
+        cleanup();
+        return -1.0;
+    }
+    dec->thread_count = threads;
+    if (thread_type != 0) {
+        dec->thread_type = thread_type;
+    }
+    if (avcodec_open2(dec, codec, nullptr) < 0) {
+        cleanup();
+        return -1.0;
+    }
+
+    int64_t frames = 0;
+    bool failed = false;
+    auto drain = [&] {
+        while (true) {
+            int ret = avcodec_receive_frame(dec, frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                return;
+            }
+            if (ret < 0) {
+                failed = true;
+                return;
+            }
+            frames++;
+            if (keep != nullptr && keep->size() < keep_count) {
+                if (AVFrame* copy = av_frame_clone(frame)) {
+                    keep->push_back(copy);
+                }
+            }
+            av_frame_unref(frame);
+        }
+    };
+
+    auto start = now();
+    for (auto* pkt : input.packets()) {
+        if (avcodec_send_packet(dec, pkt) < 0) {
+            failed = true;
+            break;
+        }
+        drain();
+    }
+    avcodec_send_packet(dec, nullptr);
+    drain();
+    auto elapsed_us = since<std::chrono::microseconds>(start).count();
+
+    cleanup();
+    if (failed || frames == 0) {
+        return -1.0;
+    }
+    return static_cast<double>(frames) * 1e6 /
+           static_cast<double>(std::max<int64_t>(elapsed_us, 1));
+}
+
+const AVCodec* find_video_decoder(const AVCodecParameters* par) {
+    const int cls = size_class(par->width, par->height);
+    for (const auto& p : preferences) {
+        if (p.id == par->codec_id && p.size_class == cls) {
+            return p.codec;
+        }
+    }
+    return avcodec_find_decoder(par->codec_id);
+}
+
+int tune_decoder(const char* url, const char* profile_path) {
+    auto input = TrialInput::open(url);
+    if (!input) {
+        return 0;
+    }
+    const AVCodecParameters* par = input->codecpar();
+    const int cls = size_class(par->width, par->height);
+    const std::string key = profile_key(par->codec_id, cls, machine_id());
+
+    auto remember = [&](const AVCodec* codec) {
+        preferences.push_back(Preference{
+            .id = par->codec_id, .size_class = cls, .codec = codec});
+    };
+
+    std::vector<std::string> lines = read_profile(profile_path);
+    for (const auto& line : lines) {
+        if (line.starts_with(key)) {
+            // a decoder that went away with an FFmpeg upgrade is re-tuned
+            const AVCodec* codec =
+                avcodec_find_decoder_by_name(line.c_str() + key.size());
+            if (codec != nullptr && codec->id == par->codec_id) {
+                remember(codec);
+                return 0;
+            }
+        }
+    }
+
+    auto candidates = candidate_decoders(par->codec_id);
+    if (candidates.empty()) {
+        return 0;
+    }
+
+    int ret = input->read_packets(bench_packets);
+    if (ret < 0) {
+        return ret;
+    }
+
+    const AVCodec* best = nullptr;
+    double best_fps = 0.0;
+    for (const auto* codec : candidates) {
+        double fps = time_decoder(*input, codec);
+        if (fps < 0.0) {
+            printf("Decoder %s: unusable\n", codec->name);
+            continue;
+        }
+        printf("Decoder %s: %.1f fps\n", codec->name, fps);
+        if (fps > best_fps) {
+            best_fps = fps;
+            best = codec;
+        }
+    }
+    if (best == nullptr) {
+        return 0;
+    }
+    remember(best);
+
+    std::erase_if(lines,
+                  [&](const std::string& l) { return l.starts_with(key); });
+    lines.push_back(key + best->name);
+    return write_profile(profile_path, lines);
+}
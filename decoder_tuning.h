@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// Decoder for a video stream: the one picked by tune_decoder() for its codec
+// and size class if there is one, otherwise FFmpeg's default.
+[[nodiscard]] const AVCodec* find_video_decoder(const AVCodecParameters* par);
+
+// Picks the fastest decoder for the first video stream of `url`. The choice
+// is cached in the machine profile at `profile_path`, keyed by codec, size
+// class and machine; on a miss every available decoder for the codec is
+// timed on the start of the input and the winner is stored. Later
+// find_video_decoder() calls return it. Call before decoding starts.
+// Returns 0 or a negative AVERROR if the profile cannot be written. Inputs
+// the demuxer cannot open or without a video stream are left alone.
+int tune_decoder(const char* url, const char* profile_path);
+
+// The main video stream of an input plus its first packets, held in memory
+// so trials time the decoder alone.
+class TrialInput {
+  public:
+    // nullptr if the input cannot be opened or has no video stream
+    [[nodiscard]] static std::unique_ptr<TrialInput> open(const char* url);
+
+    TrialInput(const TrialInput&) = delete;
+    TrialInput& operator=(const TrialInput&) = delete;
+    ~TrialInput();
+
+    // Reads up to `count` more packets of the stream. Returns 0 or a
+    // negative AVERROR.
+    int read_packets(int count);
+
+    // Next packet of the stream, not kept. Returns 0 or a negative AVERROR,
+    // AVERROR_EOF at the end.
+    int read_packet(AVPacket* pkt);
+
+    [[nodiscard]] const AVCodecParameters* codecpar() const {
+        return demuxer->streams[stream]->codecpar;
+    }
+    [[nodiscard]] const std::vector<AVPacket*>& packets() const {
+        return pkts;
+    }
+
+  private:
+    TrialInput() = default;
+
+    AVFormatContext* demuxer{nullptr};
+    int stream{-1};
+    std::vector<AVPacket*> pkts;
+};
+
+// Frames per second decoding the trial packets with `codec`, `threads`
+// threads (0 = automatic) and `thread_type` (FF_THREAD_*, 0 = FFmpeg's
+// default), or a negative value if the decoder cannot handle them. Up to
+// `keep_count` decoded frames are appended to `keep` if it is not null; the
+// caller frees them.
+double time_decoder(const TrialInput& input, const AVCodec* codec,
+                    int threads = 0, int thread_type = 0,
+                    std::vector<AVFrame*>* keep = nullptr,
+                    size_t keep_count = 0);
@@ -0,0 +1,258 @@
+#include "detect.h"
+
+#include <utility>
+
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+uint32_t calc_frame_sad(const uint8_t* __restrict ptr1,
+                        const uint8_t* __restrict ptr2, size_t xsize,
+                        size_t ysize, size_t stride) {
+    return static_cast<uint32_t>(kernels().sad(
+        ptr1, static_cast<ptrdiff_t>(stride), ptr2,
+        static_cast<ptrdiff_t>(stride), static_cast<int>(xsize),
+        static_cast<int>(ysize)));
+}
+
+double plane_score(PlaneView a, PlaneView b) {
+    uint64_t sad = kernels().sad(a.data, a.stride, b.data, b.stride, b.width,
+                                 b.height);
+    return static_cast<double>(sad) /
+           (static_cast<double>(b.width) * static_cast<double>(b.height));
+}
+
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2) {
+    if (f1->width != f2->width || f1->height != f2->height) {
+        return 0.0;
+    }
+    return frame_luma_score(
+        f1, f2, Rect{.x = 0, .y = 0, .width = f1->width, .height = f1->height});
+}
+
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2, Rect area) {
+    // frames from different decoder instances may be padded differently
+    const uint8_t* a =
+        f1->data[0] + (area.y * static_cast<ptrdiff_t>(f1->linesize[0])) +
+        area.x;
+    const uint8_t* b =
+        f2->data[0] + (area.y * static_cast<ptrdiff_t>(f2->linesize[0])) +
+        area.x;
+    uint64_t sad = kernels().sad(a, f1->linesize[0], b, f2->linesize[0],
+                                 area.width, area.height);
+    return static_cast<double>(sad) / (static_cast<double>(area.width) *
+                                       static_cast<double>(area.height));
+}
+
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2,
+                        const SpanMask& mask) {
+    if (mask.pixels == 0) {
+        return 0.0;
+    }
+    const uint8_t* a =
+        f1->data[0] + (mask.y * static_cast<ptrdiff_t>(f1->linesize[0]));
+    const uint8_t* b =
+        f2->data[0] + (mask.y * static_cast<ptrdiff_t>(f2->linesize[0]));
+    uint64_t sad =
+        kernels().span_sad(a, f1->linesize[0], b, f2->linesize[0],
+                           mask.spans.data(), mask.row_first.data(),
+                           mask.rows());
+    return static_cast<double>(sad) / static_cast<double>(mask.pixels);
+}
+
+bool has_fused_chroma(int format) {
+    const bool semi_planar =
+        format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_NV21;
+    if (!semi_planar && !is_native_format(format)) {
+        return false;
+    }
+    const auto* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    return desc->nb_components >= 3 && desc->log2_chroma_w == 1 &&
+           desc->log2_chroma_h <= 1;
+}
+
+double frame_yuv_score(const AVFrame* f1, const AVFrame* f2, Rect area,
+                       const PlaneWeights& weights) {
+    const auto* desc =
+        av_pix_fmt_desc_get(static_cast<AVPixelFormat>(f1->format));
+    const int shift = desc->log2_chroma_h;
+    const bool interleaved = desc->comp[1].plane == desc->comp[2].plane;
+    const int chroma_w = AV_CEIL_RSHIFT(area.width, 1);
+    const int chroma_h = AV_CEIL_RSHIFT(area.height, shift);
+    // crop edges are even, so they fall on chroma samples
+    const int chroma_x = interleaved ? area.x : area.x >> 1;
+
+    auto planes = [&](const AVFrame* f) {
+        YuvPlanes p{};
+        for (int i = 0; i < 3; i++) {
+            p.stride[i] = f->linesize[i];
+        }
+        p.data[0] = f->data[0] + (area.y * p.stride[0]) + area.x;
+        for (int i = 1; i < (interleaved ? 2 : 3); i++) {
+            p.data[i] = f->data[i] + ((area.y >> shift) * p.stride[i]) +
+                        chroma_x;
+        }
+        return p;
+    };
+
+    uint64_t sad[3];
+    kernels().yuv_sad(planes(f1), planes(f2), area.width, area.height,
+                      interleaved ? 2 * chroma_w : chroma_w, shift, sad);
+
+    const double luma_px =
+        static_cast<double>(area.width) * static_cast<double>(area.height);
+    const double chroma_px =
+        static_cast<double>(chroma_w) * static_cast<double>(chroma_h);
+    double mean[3] = {static_cast<double>(sad[0]) / luma_px,
+                      static_cast<double>(sad[1]) / chroma_px,
+                      static_cast<double>(sad[2]) / chroma_px};
+    if (interleaved) {
+        mean[1] = mean[2] = static_cast<double>(sad[1]) / (2.0 * chroma_px);
+    }
+    return ((weights[0] * mean[0]) + (weights[1] * mean[1]) +
+            (weights[2] * mean[2])) /
+           (weights[0] + weights[1] + weights[2]);
+}
+
+bool has_luma_plane(int format) {
+    return is_native_format(format) || format == AV_PIX_FMT_NV12 ||
+           format == AV_PIX_FMT_NV21;
+}
+
+double FrameScorer::score(const AVFrame* prev, const AVFrame* cur) {
+    const bool direct = prev->width == cur->width &&
+                        prev->height == cur->height &&
+                        has_luma_plane(prev->format) &&
+                        has_luma_plane(cur->format);
+    const bool prev_searched = std::exchange(have_prev_search, false);
+    if (direct) [[likely]] {
+        const double plain = direct_score(prev, cur);
+        if (motion_above <= 0.0 || plain < motion_above) [[likely]] {
+            have_prev_thumb = false;
+            return plain;
+        }
+        if (block_motion) {
+            have_prev_thumb = false;
+            return block_compensate(prev, cur, plain, prev_searched);
+        }
+        if (!make_thumbs(prev, cur)) {
+            return plain;
+        }
+        // the full-resolution score scaled by what compensation saves on
+        // the thumbnails
+        PlaneView a = prev_thumb.plane(0);
+        PlaneView b = cur_thumb.plane(0);
+        const double thumb_plain = plane_score(a, b);
+        const double compensated =
+            motion.compensated_score(a, b, thumb_plain);
+        std::swap(prev_thumb, cur_thumb);
+        return thumb_plain > 0.0 ? plain * compensated / thumb_plain : plain;
+    }
+
+    if (!make_thumbs(prev, cur)) {
+        return 0.0;
+    }
+    PlaneView a = prev_thumb.plane(0);
+    PlaneView b = cur_thumb.plane(0);
+    double plain = plane_score(a, b);
+    if (motion_above > 0.0 && plain >= motion_above) {
+        plain = block_motion
+                    ? block_compensate(prev, cur, plain, prev_searched)
+                    : motion.compensated_score(a, b, plain);
+    }
+    std::swap(prev_thumb, cur_thumb);
+    return plain;
+}
+
+double FrameScorer::block_compensate(const AVFrame* prev, const AVFrame* cur,
+                                     double plain, bool prev_searched) {
+    if (!prev_searched && !search_thumbnailer.make(prev, prev_search)) {
+        return plain;
+    }
+    if (!search_thumbnailer.make(cur, cur_search)) {
+        return plain;
+    }
+    have_prev_search = true;
+    PlaneView a = prev_search.plane(0);
+    PlaneView b = cur_search.plane(0);
+    const Shift global = motion.estimate(a, b).value_or(Shift{});
+    const BlockResidual r = blocks.residual(a, b, global);
+    std::swap(prev_search, cur_search);
+    return r.compensate(plain);
+}
+
+bool FrameScorer::make_thumbs(const AVFrame* prev, const AVFrame* cur) {
+    if (!have_prev_thumb && !thumbnailer.make(prev, prev_thumb)) {
+        return false;
+    }
+    have_prev_thumb = thumbnailer.make(cur, cur_thumb);
+    return have_prev_thumb;
+}
+
+double FrameScorer::direct_score(const AVFrame* prev, const AVFrame* cur) {
+    const Rect area = autocrop ? crop.update(cur)
+                               : Rect{.x = 0,
+                                      .y = 0,
+                                      .width = cur->width,
+                                      .height = cur->height};
+    if (const SpanMask* mask = mask_for(cur, area)) {
+        return frame_luma_score(prev, cur, *mask);
+    }
+    if (use_chroma && prev->format == cur->format &&
+        has_fused_chroma(cur->format)) {
+        return frame_yuv_score(prev, cur, area, weights);
+    }
+    return frame_luma_score(prev, cur, area);
+}
+
+const SpanMask* FrameScorer::mask_for(const AVFrame* cur, Rect area) {
+    const bool resized = frame_mask && (frame_mask->width != cur->width ||
+                                        frame_mask->height != cur->height);
+    switch (mask_source) {
+    case MaskSource::None:
+        return nullptr;
+    case MaskSource::Image:
+        if (!frame_mask || resized) {
+            frame_mask = mask_for_size(cur->width, cur->height);
+            clipped.reset();
+        }
+        break;
+    case MaskSource::Learned:
+        if (resized) {
+            frame_mask.reset();
+            clipped.reset();
+        }
+        if (!frame_mask) {
+            learner.push(cur);
+            frame_mask = learner.mask();
+        }
+        break;
+    }
+    if (!frame_mask) {
+        return nullptr;
+    }
+
+    // re-clipped only when the crop changes
+    if (!clipped || area != clipped_area) {
+        clipped = frame_mask->clip(area);
+        clipped_area = area;
+    }
+    return &*clipped;
+}
+
+bool SceneDetector::push(const FrameScore& score) {
+    return score.sad >= threshold && push_cut(score);
+}
+
+bool SceneDetector::push_cut(const FrameScore& score) {
+    if (score.frame - scene_start < static_cast<int64_t>(min_scene_len)) {
+        return false;
+    }
+
+    scene_start = score.frame;
+    cut_list.push_back(score.frame);
+    cut_pts_list.push_back(score.pts);
+    return true;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "crop.h"
+#include "mask.h"
+#include "motion.h"
+#include "thumbnail.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+// Assumes same dimensions between frames
+uint32_t calc_frame_sad(const uint8_t* __restrict ptr1,
+                        const uint8_t* __restrict ptr2, size_t xsize,
+                        size_t ysize, size_t stride);
+
+// Per-frame result of comparing a decoded frame against its predecessor.
+struct FrameScore {
+    // index of the frame in presentation order
+    int64_t frame;
+    int64_t pts;
+    // mean absolute luma difference per pixel, in [0, 255]
+    double sad;
+    // probability that the frame starts a new shot, negative when no
+    // learned detector ran
+    float boundary{-1.0F};
+    // mean Y, U and V, measured only for per-scene statistics
+    std::array<float, 3> means{};
+};
+
+struct CutList {
+    std::vector<int64_t> frames;
+    std::vector<int64_t> pts;
+    int64_t start_pts{0};
+    AVRational time_base{1, 1};
+};
+
+// Everything a finished run reports, independent of how it was obtained.
+struct DetectionResult {
+    int64_t frames{0};
+    CutList cuts;
+};
+
+// Mean absolute difference of two planes of the same size.
+double plane_score(PlaneView a, PlaneView b);
+
+// Mean absolute difference of the luma planes of two frames. Frames of
+// different dimensions are not compared and score 0.
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2);
+
+// The same restricted to `area`, which must lie inside both frames.
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2, Rect area);
+
+// The same over the scored pixels of `mask`, which must match the frames.
+double frame_luma_score(const AVFrame* f1, const AVFrame* f2,
+                        const SpanMask& mask);
+
+// 8-bit luma in plane 0: what frame_luma_score() reads.
+[[nodiscard]] bool has_luma_plane(int format);
+
+// Luma and chroma weights of a score; {1, 0, 0} is luma only.
+using PlaneWeights = std::array<double, 3>;
+
+// 8-bit 4:2:0 or 4:2:2, planar or NV12/NV21: what frame_yuv_score() reads.
+[[nodiscard]] bool has_fused_chroma(int format);
+
+// Weighted mean of the per-plane mean absolute differences inside `area`,
+// read in one pass over luma and chroma. Both frames must have the same
+// has_fused_chroma() format. Interleaved chroma gives U and V one shared
+// mean.
+double frame_yuv_score(const AVFrame* f1, const AVFrame* f2, Rect area,
+                       const PlaneWeights& weights);
+
+// How FrameScorer compares frames.
+struct ScoreConfig {
+    // size of the thumbnails compared when frames cannot be read directly
+    int thumb_width{default_thumb_width};
+    // leave out black bars (letterbox, pillarbox)
+    bool autocrop{true};
+    MaskSource mask{MaskSource::None};
+    // chroma catches cuts between shots of similar brightness
+    PlaneWeights weights{1.0, 0.0, 0.0};
+    // scores at least this high are checked for motion; 0 = never
+    double motion_above{0.0};
+    // search motion per block instead of one global shift
+    bool block_motion{false};
+};
+
+// Scores adjacent frames of one stream. Frames with an 8-bit luma plane are
+// compared at full resolution with frame_luma_score(), inside the active
+// area if autocrop is on and outside the mask if there is one. With chroma
+// weights, 4:2:0 and 4:2:2 frames are scored with frame_yuv_score(); the
+// mask only covers luma, so masked scores stay luma only. Frames in other
+// pixel formats, and pairs across a resolution change, are compared as
+// whole-frame luma thumbnails instead, so those scores are close to but not
+// the same as full-resolution ones.
+//
+// With motion_above set, a score that high is scaled by how much undoing
+// the global translation between the two thumbnails lowers their score, so
+// pans and tilts fall below the threshold while cuts keep their score.
+// With block_motion, a block motion search on BlockMotion::search_width
+// frames does the same for local motion, seeded with the global shift.
+// The downscaled frames are only made for those frames.
+class FrameScorer {
+  public:
+    explicit FrameScorer(const ScoreConfig& config = {})
+        : autocrop(config.autocrop), mask_source(config.mask),
+          weights(config.weights),
+          use_chroma(config.weights[1] + config.weights[2] > 0.0),
+          motion_above(config.motion_above),
+          block_motion(config.block_motion),
+          thumbnailer(config.thumb_width),
+          search_thumbnailer(BlockMotion::search_width) {}
+
+    // `prev` must be the `cur` of the previous call, if there was one.
+    double score(const AVFrame* prev, const AVFrame* cur);
+
+  private:
+    double direct_score(const AVFrame* prev, const AVFrame* cur);
+    // thumbnails of `prev` and `cur` into prev_thumb and cur_thumb
+    bool make_thumbs(const AVFrame* prev, const AVFrame* cur);
+    // `plain` with the change block motion explains taken out;
+    // `prev_searched` if the last call searched `prev` as its `cur`
+    double block_compensate(const AVFrame* prev, const AVFrame* cur,
+                            double plain, bool prev_searched);
+    // the mask for `cur` clipped to `area`, if any
+    const SpanMask* mask_for(const AVFrame* cur, Rect area);
+
+    bool autocrop;
+    CropTracker crop;
+    MaskSource mask_source;
+    PlaneWeights weights;
+    bool use_chroma;
+    StaticPixelLearner learner;
+    // mask at the current frame size, and its part inside clipped_area
+    std::optional<SpanMask> frame_mask;
+    std::optional<SpanMask> clipped;
+    Rect clipped_area;
+    double motion_above;
+    bool block_motion;
+    GlobalMotion motion;
+    BlockMotion blocks;
+    Thumbnailer thumbnailer;
+    Thumbnail prev_thumb;
+    Thumbnail cur_thumb;
+    // prev_thumb holds the thumbnail of the next call's `prev`
+    bool have_prev_thumb{false};
+    Thumbnailer search_thumbnailer;
+    Thumbnail prev_search;
+    Thumbnail cur_search;
+    bool have_prev_search{false};
+};
+
+// Threshold detector over adjacent-frame scores. A cut is placed on the frame
+// whose score exceeds the threshold, unless the current scene is still
+// shorter than min_scene_len frames.
+class SceneDetector {
+  public:
+    SceneDetector(double threshold, int min_scene_len)
+        : threshold(threshold), min_scene_len(min_scene_len) {}
+
+    // Returns true if `score.frame` starts a new scene.
+    bool push(const FrameScore& score);
+
+    // A cut another detector found at `score.frame`, whatever its score.
+    // min_scene_len still applies. Returns true if it was taken.
+    bool push_cut(const FrameScore& score);
+
+    // Frame indices at which a new scene starts. Frame 0 is implied and is
+    // not stored.
+    [[nodiscard]] const std::vector<int64_t>& cuts() const { return cut_list; }
+    // timestamps of the frames in cuts(), in stream time base
+    [[nodiscard]] const std::vector<int64_t>& cut_pts() const {
+        return cut_pts_list;
+    }
+
+  private:
+    double threshold;
+    int min_scene_len;
+    int64_t scene_start{0};
+    std::vector<int64_t> cut_list;
+    std::vector<int64_t> cut_pts_list;
+};
@@ -0,0 +1,171 @@
+"""Quantizes a float shot-boundary model into the file read by --model.
+
+The input is an .npz archive with
+    layers: JSON list of {"type": "conv3d" | "pool" | "dense" | "output"},
+        conv3d entries also carry "dilation" (time only)
+    w<i>, b<i>: weights and bias of layer i, pool layers have none
+        conv3d: [out][kernel_t][kernel_h][kernel_w][in]
+        dense and output: [out][in], in flattened as height, width, channel
+    width, height, window, context: model size, see learned.h
+
+The float network sees frames as Y, U, V per pixel scaled to (v - 128) / 128,
+pads convolutions with zeros, applies a ReLU after every conv3d and dense
+layer, averages 2x2 in pool layers and ends in one logit per frame.
+
+Activation ranges come from a float pass over calibration windows, an array
+of [count][window][height][width][3] uint8 frames in a .npy file.
+
+Usage: python export_model.py model.npz calibration.npy out.bin
+"""
+
+import json
+import struct
+import sys
+
+import numpy
+
+MAGIC = b"SDSHOTN1"
+VERSION = 1
+LAYER_TYPES = {"conv3d": 1, "pool": 2, "dense": 3, "output": 4}
+INPUT_SCALE = 1.0 / 64.0
+
+
+def conv3d(x: numpy.ndarray, w: numpy.ndarray, b: numpy.ndarray,
+           dilation: int) -> numpy.ndarray:
+    """Same-padded 3D convolution of [n][t][h][w][c] activations.
+
+    Arguments:
+        x: Activations of whole windows.
+        w: Weights as [out][kernel_t][kernel_h][kernel_w][in].
+        b: Bias per output channel.
+        dilation: Spacing of the kernel taps in time.
+
+    Returns:
+        Activations with `w.shape[0]` channels, before the ReLU.
+    """
+    _, kt, kh, kw, _ = w.shape
+    pt, ph, pw = (kt // 2) * dilation, kh // 2, kw // 2
+    padded = numpy.pad(x, ((0, 0), (pt, pt), (ph, ph), (pw, pw), (0, 0)))
+    n, t, h, wd, _ = x.shape
+    out = numpy.broadcast_to(b, (n, t, h, wd, w.shape[0])).copy()
+    for dt in range(kt):
+        for dy in range(kh):
+            for dx in range(kw):
+                tap = padded[:, dt * dilation:dt * dilation + t,
+                             dy:dy + h, dx:dx + wd, :]
+                out += tap @ w[:, dt, dy, dx, :].T
+    return out
+
+
+def pool(x: numpy.ndarray) -> numpy.ndarray:
+    """2x2 average of [n][t][h][w][c] activations, odd edges dropped."""
+    h, w = x.shape[2] // 2 * 2, x.shape[3] // 2 * 2
+    x = x[:, :, :h, :w, :]
+    return (x[:, :, 0::2, 0::2] + x[:, :, 1::2, 0::2] +
+            x[:, :, 0::2, 1::2] + x[:, :, 1::2, 1::2]) / 4.0
+
+
+def forward(layers: list, params: dict, frames: numpy.ndarray) -> list:
+    """Float forward pass.
+
+    Arguments:
+        layers: Layer descriptions from the archive.
+        params: The archive's arrays.
+        frames: uint8 windows as [n][t][h][w][3].
+
+    Returns:
+        The largest activation seen after every layer.
+    """
+    x = (frames.astype(numpy.float32) - 128.0) / 128.0
+    peaks = []
+    for i, layer in enumerate(layers):
+        kind = layer["type"]
+        if kind == "pool":
+            x = pool(x)
+        elif kind == "conv3d":
+            x = numpy.maximum(conv3d(x, params[f"w{i}"], params[f"b{i}"],
+                                     layer.get("dilation", 1)), 0.0)
+        else:
+            flat = x.reshape(x.shape[0], x.shape[1], 1, 1, -1)
+            x = flat @ params[f"w{i}"].T + params[f"b{i}"]
+            if kind == "dense":
+                x = numpy.maximum(x, 0.0)
+        peaks.append(float(numpy.max(x)))
+    return peaks
+
+
+def quantize_layer(w: numpy.ndarray, b: numpy.ndarray, in_scale: float,
+                   out_scale: float) -> tuple:
+    """Symmetric per-output-channel int8 weights and their requantization.
+
+    Arguments:
+        w: Float weights, output channel first.
+        b: Float bias.
+        in_scale: Real value of one input step.
+        out_scale: Real value of one output step, or 1 for the logit.
+
+    Returns:
+        int8 weights, int32 bias and float32 scale per output channel.
+    """
+    rows = w.reshape(w.shape[0], -1)
+    peak = numpy.maximum(numpy.max(numpy.abs(rows), axis=1), 1e-8)
+    weight_scale = peak / 127.0
+    q = numpy.clip(numpy.round(rows / weight_scale[:, None]), -127, 127)
+    acc_scale = in_scale * weight_scale
+    bias = numpy.round(b / acc_scale)
+    return (q.astype(numpy.int8), bias.astype("<i4"),
+            (acc_scale / out_scale).astype("<f4"))
+
+
+def export(model_path: str, calibration_path: str, out_path: str) -> None:
+    """Writes the quantized model.
+
+    Arguments:
+        model_path: Float model archive.
+        calibration_path: Calibration windows.
+        out_path: Model file to write.
+    """
+    params = numpy.load(model_path)
+    layers = json.loads(str(params["layers"]))
+    width, height = int(params["width"]), int(params["height"])
+    window, context = int(params["window"]), int(params["context"])
+    peaks = forward(layers, params, numpy.load(calibration_path))
+
+    with open(out_path, "wb") as out:
+        out.write(MAGIC + struct.pack("<IHHIII4x", VERSION, width, height,
+                                      window, context, len(layers)))
+        scale = INPUT_SCALE
+        channels, h, w = 3, height, width
+        for i, layer in enumerate(layers):
+            kind = layer["type"]
+            if kind == "pool":
+                out.write(struct.pack("<III4B4x", LAYER_TYPES[kind],
+                                      channels, channels, 0, 0, 0, 0))
+                h, w = h // 2, w // 2
+                continue
+            weights = params[f"w{i}"]
+            out_scale = 1.0 if kind == "output" else max(peaks[i], 1e-6) / 127
+            q, bias, requant = quantize_layer(weights, params[f"b{i}"],
+                                              scale, out_scale)
+            if kind == "conv3d":
+                _, kt, kh, kw, cin = weights.shape
+                header = struct.pack("<III4B4x", LAYER_TYPES[kind], cin,
+                                     weights.shape[0], kt, kh, kw,
+                                     layer.get("dilation", 1))
+                channels = weights.shape[0]
+            else:
+                header = struct.pack("<III4B4x", LAYER_TYPES[kind],
+                                     channels * h * w, weights.shape[0],
+                                     1, 1, 1, 1)
+                channels, h, w = weights.shape[0], 1, 1
+            out.write(header)
+            out.write(q.tobytes())
+            out.write(bias.tobytes())
+            out.write(requant.tobytes())
+            scale = out_scale
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    export(sys.argv[1], sys.argv[2], sys.argv[3])
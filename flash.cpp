@@ -0,0 +1,100 @@
+#include "flash.h"
+
+#include <cstdlib>
+
+#include "kernels.h"
+
+TileGrid TileGrid::of(PlaneView luma) {
+    TileGrid g;
+    if (luma.width < cols || luma.height < 2 * rows) {
+        return g;
+    }
+
+    const auto sum = kernels().sum;
+    for (int ty = 0; ty < rows; ty++) {
+        const int y0 = ty * luma.height / rows;
+        const int y1 = (ty + 1) * luma.height / rows;
+        const int lines = (y1 - y0 + 1) / 2;
+        for (int tx = 0; tx < cols; tx++) {
+            const int x0 = tx * luma.width / cols;
+            const int x1 = (tx + 1) * luma.width / cols;
+            uint64_t s = sum(luma.data + (y0 * luma.stride) + x0,
+                             2 * luma.stride, x1 - x0, lines);
+            const auto area = static_cast<uint64_t>(x1 - x0) * lines;
+            g.mean[(ty * cols) + tx] =
+                static_cast<uint8_t>((s + (area / 2)) / area);
+        }
+    }
+    g.valid = true;
+    return g;
+}
+
+double TileGrid::distance(const TileGrid& other) const {
+    int sum = 0;
+    for (size_t i = 0; i < mean.size(); i++) {
+        sum += std::abs(mean[i] - other.mean[i]);
+    }
+    return static_cast<double>(sum) / static_cast<double>(mean.size());
+}
+
+void TilePool::add(const TileGrid& grid) {
+    if (!grid.valid) {
+        return;
+    }
+    for (size_t i = 0; i < sum.size(); i++) {
+        sum[i] += grid.mean[i];
+    }
+    frames++;
+}
+
+std::array<double, TileGrid::cols * TileGrid::rows> TilePool::mean() const {
+    std::array<double, TileGrid::cols * TileGrid::rows> m{};
+    if (frames > 0) {
+        for (size_t i = 0; i < sum.size(); i++) {
+            m[i] = static_cast<double>(sum[i]) / static_cast<double>(frames);
+        }
+    }
+    return m;
+}
+
+FlashFilter::FlashFilter(int window, double threshold)
+    : window(window), threshold(threshold), match_level(threshold / 3),
+      // the newest frame, `window` held ones and the one before those
+      ring(static_cast<size_t>(window) + 2) {}
+
+void FlashFilter::push(const FrameScore& score, const TileGrid& grid) {
+    const int64_t i = pushed++;
+    at(i) = Frame{.score = score, .grid = grid};
+    if (!grid.valid) {
+        return;
+    }
+
+    // the earliest held jump whose previous frame this one matches again
+    for (int64_t c = std::max<int64_t>(released, 1); c < i; c++) {
+        if (at(c).score.sad < threshold || !at(c - 1).grid.valid) {
+            continue;
+        }
+        const double d = grid.distance(at(c - 1).grid);
+        if (d >= match_level) {
+            continue;
+        }
+        for (int64_t q = c; q <= i; q++) {
+            if (at(q).score.sad >= threshold) {
+                at(q).score.sad = d;
+            }
+            // and so do learned boundaries inside the flash
+            if (at(q).score.boundary > 0.0F) {
+                at(q).score.boundary = 0.0F;
+            }
+        }
+        break;
+    }
+}
+
+std::optional<FlashFilter::Frame> FlashFilter::pop() {
+    if (released >= pushed ||
+        (!flushing && pushed - 1 - released < window)) {
+        return std::nullopt;
+    }
+    return at(released++);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "detect.h"
+#include "thumbnail.h"
+
+// Mean luma of a grid of tiles: a fingerprint of a frame small enough to
+// keep one per frame of a lookback window.
+struct TileGrid {
+    static constexpr int cols = 16;
+    static constexpr int rows = 9;
+
+    std::array<uint8_t, cols * rows> mean{};
+    bool valid{false};
+
+    // Reads every other row; that is plenty for tile means.
+    [[nodiscard]] static TileGrid of(PlaneView luma);
+
+    // mean absolute difference of the tile means, in [0, 255]
+    [[nodiscard]] double distance(const TileGrid& other) const;
+};
+
+// Running sum of tile grids, for the average picture of a scene.
+struct TilePool {
+    std::array<uint32_t, TileGrid::cols * TileGrid::rows> sum{};
+    // valid grids added
+    int64_t frames{0};
+
+    void add(const TileGrid& grid);
+    // average tile means; all 0 before any grid is added
+    [[nodiscard]] std::array<double, TileGrid::cols * TileGrid::rows>
+    mean() const;
+};
+
+// Tells flashes and strobes from cuts. A score above the threshold is held
+// back for `window` frames. If a frame in that time looks like the frame
+// before the jump again, the jump and everything up to the return were a
+// flash: their scores are replaced by the distance across the flash, which
+// is below the threshold. Memory is fixed at window + 2 grids and scores.
+class FlashFilter {
+  public:
+    FlashFilter(int window, double threshold);
+
+    struct Frame {
+        FrameScore score;
+        TileGrid grid;
+    };
+
+    // Takes the next frame. Frames without a valid grid are never matched.
+    // Call pop() until it returns nothing after every push.
+    void push(const FrameScore& score, const TileGrid& grid);
+
+    // The oldest frame whose window has passed.
+    [[nodiscard]] std::optional<Frame> pop();
+
+    // End of stream: every held score becomes ready.
+    void flush() { flushing = true; }
+
+  private:
+    Frame& at(int64_t pos) { return ring[pos % ring.size()]; }
+
+    int window;
+    double threshold;
+    // grids closer than this show the same shot
+    double match_level;
+    std::vector<Frame> ring;
+    // frames pushed so far, and the next one to hand out
+    int64_t pushed{0};
+    int64_t released{0};
+    bool flushing{false};
+};
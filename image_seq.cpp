@@ -0,0 +1,372 @@
+#include "image_seq.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <dirent.h>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+
+#include "thumbnail.h"
+#include "util.h"
+#include "work_queue.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+namespace {
+
+// highest number probed when looking for the start of a pattern
+constexpr int max_start_number = 10000;
+
+AVCodecID codec_for(std::string_view name) {
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string_view::npos) {
+        return AV_CODEC_ID_NONE;
+    }
+
+    std::string ext(name.substr(dot + 1));
+    for (auto& c : ext) {
+        c = static_cast<char>(tolower(c));
+    }
+
+    if (ext == "dpx") {
+        return AV_CODEC_ID_DPX;
+    }
+    if (ext == "exr") {
+        return AV_CODEC_ID_EXR;
+    }
+    if (ext == "png") {
+        return AV_CODEC_ID_PNG;
+    }
+    if (ext == "jpg" || ext == "jpeg") {
+        return AV_CODEC_ID_MJPEG;
+    }
+    if (ext == "tif" || ext == "tiff") {
+        return AV_CODEC_ID_TIFF;
+    }
+    if (ext == "bmp") {
+        return AV_CODEC_ID_BMP;
+    }
+    return AV_CODEC_ID_NONE;
+}
+
+bool file_exists(const char* path) {
+    struct stat st {};
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// "%d" or "%0Nd", and nothing else that printf would interpret
+bool is_frame_pattern(std::string_view sv) {
+    size_t pct = sv.find('%');
+    if (pct == std::string_view::npos) {
+        return false;
+    }
+    size_t i = pct + 1;
+    while (i < sv.size() && isdigit(sv[i]) != 0) {
+        i++;
+    }
+    return i < sv.size() && sv[i] == 'd' &&
+           sv.find('%', i) == std::string_view::npos;
+}
+
+std::optional<ImageSequence> sequence_from_pattern(const char* pattern) {
+    ImageSequence seq;
+    seq.codec = codec_for(pattern);
+    if (seq.codec == AV_CODEC_ID_NONE) {
+        return std::nullopt;
+    }
+
+    std::array<char, 4096> path{};
+    int number = 0;
+    for (; number < max_start_number; number++) {
+        (void)snprintf(path.data(), path.size(), pattern, number);
+        if (file_exists(path.data())) {
+            break;
+        }
+    }
+
+    for (;; number++) {
+        (void)snprintf(path.data(), path.size(), pattern, number);
+        if (!file_exists(path.data())) {
+            break;
+        }
+        seq.files.emplace_back(path.data());
+    }
+
+    if (seq.files.empty()) {
+        return std::nullopt;
+    }
+    return seq;
+}
+
+std::optional<ImageSequence> sequence_from_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        return std::nullopt;
+    }
+
+    // bucket by codec and keep the largest group, so a stray preview or
+    // contact sheet does not end up in the middle of the plate
+    constexpr std::array<AVCodecID, 6> codecs = {
+        AV_CODEC_ID_DPX,   AV_CODEC_ID_EXR,  AV_CODEC_ID_PNG,
+        AV_CODEC_ID_MJPEG, AV_CODEC_ID_TIFF, AV_CODEC_ID_BMP};
+    std::array<std::vector<std::string>, codecs.size()> groups;
+
+    while (dirent* entry = readdir(dir)) {
+        AVCodecID id = codec_for(entry->d_name);
+        for (size_t i = 0; i < codecs.size(); i++) {
+            if (codecs[i] == id) {
+                groups[i].emplace_back(entry->d_name);
+            }
+        }
+    }
+    closedir(dir);
+
+    size_t best = 0;
+    for (size_t i = 1; i < groups.size(); i++) {
+        if (groups[i].size() > groups[best].size()) {
+            best = i;
+        }
+    }
+    if (groups[best].empty()) {
+        return std::nullopt;
+    }
+
+    ImageSequence seq;
+    seq.codec = codecs[best];
+    std::sort(groups[best].begin(), groups[best].end(), natural_less);
+    for (const auto& name : groups[best]) {
+        std::string full = path;
+        full += '/';
+        full += name;
+        seq.files.push_back(std::move(full));
+    }
+    return seq;
+}
+
+using FramePtr = std::unique_ptr<AVFrame, decltype([](AVFrame* f) {
+                                     av_frame_free(&f);
+                                 })>;
+
+struct DecodedImage {
+    FramePtr frame;
+    int error{0};
+};
+
+// Per-worker decoder plus the conversion for formats the kernels do not
+// read natively (RGB PNGs, 10/12-bit DPX, float EXR).
+class ImageDecoder {
+  public:
+    ImageDecoder() = default;
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+    ~ImageDecoder() {
+        avcodec_free_context(&dec);
+        av_packet_free(&pkt);
+        sws_freeContext(sws);
+    }
+
+    int open(AVCodecID id) {
+        const auto* codec = avcodec_find_decoder(id);
+        if (codec == nullptr) {
+            return AVERROR_DECODER_NOT_FOUND;
+        }
+        dec = avcodec_alloc_context3(codec);
+        pkt = av_packet_alloc();
+        if (dec == nullptr || pkt == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        // the parallelism is across files
+        dec->thread_count = 1;
+        return avcodec_open2(dec, codec, nullptr);
+    }
+
+    DecodedImage decode(const char* path) {
+        DecodedImage out;
+        out.error = read_file(path);
+        if (out.error < 0) {
+            return out;
+        }
+
+        FramePtr frame(av_frame_alloc());
+        if (frame == nullptr) {
+            out.error = AVERROR(ENOMEM);
+            return out;
+        }
+
+        // every file is a complete picture, so drain right away
+        out.error = avcodec_send_packet(dec, pkt);
+        av_packet_unref(pkt);
+        if (out.error >= 0) {
+            avcodec_send_packet(dec, nullptr);
+            out.error = avcodec_receive_frame(dec, frame.get());
+        }
+        avcodec_flush_buffers(dec);
+        if (out.error < 0) {
+            return out;
+        }
+
+        if (!is_native_format(frame->format)) {
+            out.error = convert(frame);
+            if (out.error < 0) {
+                return out;
+            }
+        }
+
+        out.frame = std::move(frame);
+        return out;
+    }
+
+  private:
+    int read_file(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) {
+            return AVERROR(errno);
+        }
+
+        int ret = 0;
+        if (fseeko(file, 0, SEEK_END) != 0) {
+            ret = AVERROR(EIO);
+        }
+        off_t size = ret == 0 ? ftello(file) : -1;
+        if (size <= 0 || size > INT32_MAX - AV_INPUT_BUFFER_PADDING_SIZE) {
+            ret = AVERROR_INVALIDDATA;
+        }
+        if (ret == 0) {
+            ret = av_new_packet(pkt, static_cast<int>(size));
+        }
+        if (ret == 0) {
+            rewind(file);
+            if (fread(pkt->data, 1, pkt->size, file) !=
+                static_cast<size_t>(pkt->size)) {
+                av_packet_unref(pkt);
+                ret = AVERROR(EIO);
+            }
+        }
+
+        (void)fclose(file);
+        return ret;
+    }
+
+    int convert(FramePtr& frame) {
+        FramePtr conv(av_frame_alloc());
+        if (conv == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        conv->format = AV_PIX_FMT_YUV420P;
+        conv->width = frame->width;
+        conv->height = frame->height;
+        int ret = av_frame_get_buffer(conv.get(), 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        sws = sws_getCachedContext(
+            sws, frame->width, frame->height,
+            static_cast<AVPixelFormat>(frame->format), conv->width,
+            conv->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr,
+            nullptr);
+        if (sws == nullptr) {
+            return AVERROR(EINVAL);
+        }
+        sws_scale(sws, frame->data, frame->linesize, 0, frame->height,
+                  conv->data, conv->linesize);
+        av_frame_copy_props(conv.get(), frame.get());
+
+        frame = std::move(conv);
+        return 0;
+    }
+
+    AVCodecContext* dec{nullptr};
+    AVPacket* pkt{nullptr};
+    SwsContext* sws{nullptr};
+};
+
+} // namespace
+
+std::optional<ImageSequence> find_image_sequence(const char* url) {
+    std::string_view sv = url;
+    if (sv.find("://") != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    struct stat st {};
+    if (stat(url, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return sequence_from_dir(url);
+    }
+    if (is_frame_pattern(sv)) {
+        return sequence_from_pattern(url);
+    }
+    return std::nullopt;
+}
+
+int64_t run_image_sequence(const ImageSequence& seq, Pipeline& pipeline,
+                           int threads) {
+    const size_t count = seq.files.size();
+    if (threads <= 0) {
+        threads = static_cast<int>(
+            std::max(1U, std::thread::hardware_concurrency()));
+    }
+    threads = std::min(threads, static_cast<int>(count));
+
+    ReorderBuffer<DecodedImage> results(static_cast<size_t>(2 * threads) + 2);
+    results.finish(count);
+    std::atomic<size_t> next{0};
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&] {
+            ImageDecoder decoder;
+            int open_error = decoder.open(seq.codec);
+
+            size_t idx = 0;
+            while ((idx = next++) < count) {
+                if (!results.wait_for_slot(idx)) {
+                    break;
+                }
+                DecodedImage img;
+                if (open_error < 0) {
+                    img.error = open_error;
+                } else {
+                    img = decoder.decode(seq.files[idx].c_str());
+                }
+                results.put(idx, std::move(img));
+            }
+        });
+    }
+
+    int64_t frames = 0;
+    int error = 0;
+    FramePtr prev;
+    while (auto img = results.pop()) {
+        if (img->error < 0) {
+            print_averror("Failed to decode", seq.files[frames].c_str(),
+                          img->error);
+            error = img->error;
+            results.close();
+            break;
+        }
+
+        AVFrame* cur = img->frame.get();
+        cur->pts = frames;
+        cur->best_effort_timestamp = frames;
+
+        pipeline.push_frame(cur, prev.get(), frames);
+        frames++;
+        prev = std::move(img->frame);
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    return error < 0 ? error : frames;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+extern "C" {
+#include <libavcodec/codec_id.h>
+#include <libavutil/rational.h>
+}
+
+struct ImageSequence {
+    std::vector<std::string> files;
+    AVCodecID codec{AV_CODEC_ID_NONE};
+};
+
+// Frame rate assumed for image sequences, same as the image2 demuxer.
+inline constexpr AVRational image_sequence_time_base{1, 25};
+
+// Recognizes a directory of DPX/EXR/PNG/JPEG/TIFF/BMP images or a printf
+// style pattern such as "plate.%04d.exr". Directory entries are ordered by
+// their embedded frame numbers; a pattern is followed from its first
+// existing number until the first gap.
+[[nodiscard]] std::optional<ImageSequence>
+find_image_sequence(const char* url);
+
+// Decodes the images on `threads` workers (0 = one per core), each with its
+// own decoder, and delivers them to `pipeline` in sequence order. Formats
+// the analysis kernels cannot read directly are converted on the workers.
+// Returns the number of frames or a negative AVERROR.
+int64_t run_image_sequence(const ImageSequence& seq, Pipeline& pipeline,
+                           int threads);
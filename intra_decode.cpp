@@ -0,0 +1,219 @@
+#include "intra_decode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "work_queue.h"
+
+extern "C" {
+#include <libavcodec/codec_desc.h>
+}
+
+namespace {
+
+struct GopJob {
+    uint64_t seq;
+    std::vector<AVPacket*> packets;
+};
+
+void free_packets(std::vector<AVPacket*>& packets) {
+    for (auto*& pkt : packets) {
+        av_packet_free(&pkt);
+    }
+    packets.clear();
+}
+
+// Owns its frames, so whatever is left in the reorder buffer after an abort
+// is released with it.
+struct GopFrames {
+    std::vector<AVFrame*> frames;
+    int error{0};
+
+    GopFrames() = default;
+    GopFrames(GopFrames&&) = default;
+    GopFrames& operator=(GopFrames&&) = default;
+    ~GopFrames() {
+        for (auto*& f : frames) {
+            av_frame_free(&f);
+        }
+    }
+};
+
+// Decodes one GOP to completion, then resets the decoder for the next job.
+int decode_gop(AVCodecContext* dec, GopJob& job, GopFrames& out) {
+    auto drain = [&]() {
+        while (true) {
+            AVFrame* frame = av_frame_alloc();
+            if (frame == nullptr) {
+                return AVERROR(ENOMEM);
+            }
+            int ret = avcodec_receive_frame(dec, frame);
+            if (ret < 0) {
+                av_frame_free(&frame);
+                return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+            }
+            out.frames.push_back(frame);
+        }
+    };
+
+    int ret = 0;
+    for (auto* pkt : job.packets) {
+        ret = avcodec_send_packet(dec, pkt);
+        if (ret < 0 || (ret = drain()) < 0) {
+            break;
+        }
+    }
+    if (ret >= 0) {
+        avcodec_send_packet(dec, nullptr);
+        ret = drain();
+    }
+    avcodec_flush_buffers(dec);
+
+    free_packets(job.packets);
+    return ret;
+}
+
+} // namespace
+
+bool supports_packet_parallel(const AVStream* stream) {
+    const auto id = stream->codecpar->codec_id;
+    const auto* desc = avcodec_descriptor_get(id);
+    return id == AV_CODEC_ID_FFV1 ||
+           (desc != nullptr && (desc->props & AV_CODEC_PROP_INTRA_ONLY) != 0);
+}
+
+int64_t run_packet_parallel(DecodeContext& dc, Pipeline& pipeline,
+                            int threads) {
+    if (threads <= 0) {
+        threads = static_cast<int>(
+            std::max(1U, std::thread::hardware_concurrency()));
+    }
+
+    // one context per worker, single threaded: the parallelism is across
+    // packets
+    std::vector<AVCodecContext*> decoders(threads, nullptr);
+    auto free_decoders = [&] {
+        for (auto*& d : decoders) {
+            avcodec_free_context(&d);
+        }
+    };
+    for (auto*& d : decoders) {
+        d = avcodec_alloc_context3(dc.decoder->codec);
+        if (d == nullptr) {
+            free_decoders();
+            return AVERROR(ENOMEM);
+        }
+        int ret = avcodec_parameters_to_context(d, dc.stream->codecpar);
+        d->thread_count = 1;
+        if (ret >= 0) {
+            ret = avcodec_open2(d, dc.decoder->codec, nullptr);
+        }
+        if (ret < 0) {
+            free_decoders();
+            return ret;
+        }
+    }
+
+    const auto window = static_cast<size_t>(2 * threads) + 2;
+    WorkQueue<GopJob> jobs(window);
+    ReorderBuffer<GopFrames> results(window);
+    std::atomic<bool> abort{false};
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, dec = decoders[i]] {
+            while (auto job = jobs.pop()) {
+                GopFrames out;
+                if (abort) {
+                    free_packets(job->packets);
+                } else {
+                    out.error = decode_gop(dec, *job, out);
+                }
+                results.put(job->seq, std::move(out));
+            }
+        });
+    }
+
+    int demux_error = 0;
+    std::thread demuxer([&] {
+        uint64_t seq = 0;
+        GopJob gop{.seq = 0, .packets = {}};
+
+        auto dispatch = [&] {
+            if (gop.packets.empty()) {
+                return true;
+            }
+            if (!results.wait_for_slot(seq)) {
+                free_packets(gop.packets);
+                return false;
+            }
+            gop.seq = seq++;
+            jobs.push(std::move(gop));
+            gop = GopJob{.seq = 0, .packets = {}};
+            return true;
+        };
+
+        while (!abort) {
+            AVPacket* pkt = av_packet_alloc();
+            if (pkt == nullptr) {
+                demux_error = AVERROR(ENOMEM);
+                break;
+            }
+            int ret = av_read_frame(dc.demuxer, pkt);
+            if (ret < 0) {
+                av_packet_free(&pkt);
+                break;
+            }
+            if (pkt->stream_index != dc.stream->index) {
+                av_packet_free(&pkt);
+                continue;
+            }
+
+            if ((pkt->flags & AV_PKT_FLAG_KEY) != 0 && !dispatch()) {
+                av_packet_free(&pkt);
+                break;
+            }
+            gop.packets.push_back(pkt);
+        }
+
+        dispatch();
+        free_packets(gop.packets);
+        jobs.close();
+        results.finish(seq);
+    });
+
+    // analysis stays on this thread, in presentation order
+    int64_t frames = 0;
+    int error = 0;
+    AVFrame* prev = nullptr;
+    while (auto gop = results.pop()) {
+        if (gop->error < 0 && error == 0) {
+            error = gop->error;
+            abort = true;
+            results.close();
+        }
+        for (auto*& frame : gop->frames) {
+            if (error == 0) {
+                pipeline.push_frame(frame, prev, frames++);
+            }
+            av_frame_free(&prev);
+            prev = std::exchange(frame, nullptr);
+        }
+    }
+    av_frame_free(&prev);
+
+    demuxer.join();
+    for (auto& t : workers) {
+        t.join();
+    }
+    free_decoders();
+
+    if (error == 0) {
+        error = demux_error;
+    }
+    return error < 0 ? error : frames;
+}
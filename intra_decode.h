@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+#include "decode.h"
+#include "pipeline.h"
+
+// True for streams whose packets decode independently of each other:
+// intra-only codecs (ProRes, DNxHD, MJPEG, ...) and FFV1, whose GOPs are
+// always closed.
+[[nodiscard]] bool supports_packet_parallel(const AVStream* stream);
+
+// Demuxes `dc` on one thread and fans packets out to `threads` decoder
+// instances (0 = one per core). Each job is one GOP, which for intra-only
+// codecs is a single packet. Decoded frames are put back in order before
+// they reach `pipeline`. Returns the number of frames or a negative AVERROR.
+int64_t run_packet_parallel(DecodeContext& dc, Pipeline& pipeline,
+                            int threads);
@@ -0,0 +1,1428 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "util.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define SCENEDETECT_X86 1
+#define X86_ONLY(fn) fn
+#else
+#define X86_ONLY(fn) nullptr
+#endif
+
+namespace {
+
+using SadFn = decltype(Kernels::sad);
+using SumFn = decltype(Kernels::sum);
+using HistogramFn = decltype(Kernels::histogram);
+using SumRowsFn = decltype(Kernels::sum_rows);
+using DeinterleaveFn = decltype(Kernels::deinterleave);
+using SpanSadFn = decltype(Kernels::span_sad);
+using YuvSadFn = decltype(Kernels::yuv_sad);
+using BlockSadFn = decltype(Kernels::block_sad);
+using GemmFn = decltype(Kernels::gemm_u8s8);
+using DistancesFn = decltype(Kernels::sq_distances);
+
+// one slot per SimdLevel; nullptr where a level has no variant of its own
+template <typename Fn> using Variants = std::array<Fn, 4>;
+
+// ---- scalar ----
+
+uint64_t sad_scalar(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+                    ptrdiff_t b_stride, int width, int height) {
+    uint64_t sum = 0;
+    for (int y = 0; y < height; y++) {
+        uint32_t row = 0;
+        for (int x = 0; x < width; x++) {
+            row += std::abs(static_cast<int32_t>(a[x]) -
+                            static_cast<int32_t>(b[x]));
+        }
+        sum += row;
+        a += a_stride;
+        b += b_stride;
+    }
+    return sum;
+}
+
+uint64_t sum_scalar(const uint8_t* src, ptrdiff_t stride, int width,
+                    int height) {
+    uint64_t sum = 0;
+    for (int y = 0; y < height; y++) {
+        uint32_t row = 0;
+        for (int x = 0; x < width; x++) {
+            row += src[x];
+        }
+        sum += row;
+        src += stride;
+    }
+    return sum;
+}
+
+void histogram_scalar(const uint8_t* src, ptrdiff_t stride, int width,
+                      int height, uint32_t* hist) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            hist[src[x]]++;
+        }
+        src += stride;
+    }
+}
+
+// There is no useful vector histogram on these ISAs. Four tables break the
+// store-to-load dependency on runs of equal pixels, which is what limits
+// the single-table loop on flat content.
+void histogram_split(const uint8_t* src, ptrdiff_t stride, int width,
+                     int height, uint32_t* hist) {
+    std::array<std::array<uint32_t, 256>, 4> tables{};
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            tables[0][src[x]]++;
+            tables[1][src[x + 1]]++;
+            tables[2][src[x + 2]]++;
+            tables[3][src[x + 3]]++;
+        }
+        for (; x < width; x++) {
+            tables[0][src[x]]++;
+        }
+        src += stride;
+    }
+    for (int i = 0; i < 256; i++) {
+        hist[i] += tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+    }
+}
+
+void sum_rows_scalar(const uint8_t* src, ptrdiff_t stride, int rows,
+                     int width, uint32_t* col_sum) {
+    std::fill(col_sum, col_sum + width, 0);
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < width; x++) {
+            col_sum[x] += src[x];
+        }
+        src += stride;
+    }
+}
+
+uint64_t span_sad_scalar(const uint8_t* a, ptrdiff_t a_stride,
+                         const uint8_t* b, ptrdiff_t b_stride,
+                         const Span* spans, const uint32_t* row_first,
+                         int height) {
+    uint64_t sum = 0;
+    for (int y = 0; y < height; y++) {
+        for (uint32_t i = row_first[y]; i < row_first[y + 1]; i++) {
+            sum += sad_scalar(a + spans[i].x, 0, b + spans[i].x, 0,
+                              spans[i].width, 1);
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return sum;
+}
+
+void block_sad_scalar(const uint8_t* cur, ptrdiff_t cur_stride,
+                      const uint8_t* ref, ptrdiff_t ref_stride,
+                      const ptrdiff_t* offsets, int n, uint32_t* sad) {
+    for (int i = 0; i < n; i++) {
+        sad[i] = static_cast<uint32_t>(sad_scalar(cur, cur_stride,
+                                                  ref + offsets[i],
+                                                  ref_stride, sad_block,
+                                                  sad_block));
+    }
+}
+
+// Runs tile(a_rows, b_cols, c, m, depth, rows, cols) over the product in
+// blocks of b columns and a rows small enough to stay in L1 and L2 while
+// they are reused. Tiles at the edges get fewer rows or columns; the
+// missing ones repeat the last real one and are not stored.
+template <typename Tile>
+inline void gemm_blocked(const int8_t* a, const uint8_t* b, int32_t* c,
+                         int m, int n, int depth, Tile& tile) {
+    constexpr int block_n = 64;
+    constexpr int block_m = 64;
+    const int8_t* rows[Tile::rows];
+    const uint8_t* cols[Tile::cols];
+    for (int n0 = 0; n0 < n; n0 += block_n) {
+        const int n1 = std::min(n, n0 + block_n);
+        for (int m0 = 0; m0 < m; m0 += block_m) {
+            const int m1 = std::min(m, m0 + block_m);
+            for (int j = n0; j < n1; j += Tile::cols) {
+                const int nc = std::min(Tile::cols, n1 - j);
+                for (int q = 0; q < Tile::cols; q++) {
+                    cols[q] = b + (static_cast<ptrdiff_t>(
+                                       j + std::min(q, nc - 1)) *
+                                   depth);
+                }
+                for (int i = m0; i < m1; i += Tile::rows) {
+                    const int nr = std::min(Tile::rows, m1 - i);
+                    for (int r = 0; r < Tile::rows; r++) {
+                        rows[r] = a + (static_cast<ptrdiff_t>(
+                                           i + std::min(r, nr - 1)) *
+                                       depth);
+                    }
+                    tile(rows, cols, c + (static_cast<ptrdiff_t>(j) * m) + i,
+                         m, depth, nr, nc);
+                }
+            }
+        }
+    }
+}
+
+struct GemmTileScalar {
+    static constexpr int rows = 1;
+    static constexpr int cols = 1;
+
+    void operator()(const int8_t* const* a, const uint8_t* const* b,
+                    int32_t* c, int /*m*/, int depth, int /*nr*/,
+                    int /*nc*/) {
+        int32_t sum = 0;
+        for (int k = 0; k < depth; k++) {
+            sum += static_cast<int32_t>(a[0][k]) *
+                   static_cast<int32_t>(b[0][k]);
+        }
+        c[0] = sum;
+    }
+};
+
+void gemm_u8s8_scalar(const int8_t* a, const uint8_t* b, int32_t* c, int m,
+                      int n, int depth) {
+    GemmTileScalar tile;
+    gemm_blocked(a, b, c, m, n, depth, tile);
+}
+
+// Dimensions are summed in order and kernels.cpp is built without FP
+// contraction, so no variant fuses into FMA and all return the same bits.
+// benchmark_kernels() checks this before it picks one.
+void sq_distances_scalar(const float* a, const float* b, ptrdiff_t stride,
+                         int dims, int rows, int n, float* out,
+                         ptrdiff_t out_stride) {
+    for (int r = 0; r < rows; r++) {
+        for (int i = 0; i < n; i++) {
+            float acc = 0.0F;
+            for (int d = 0; d < dims; d++) {
+                const float diff = a[(d * stride) + i] - b[(d * stride) + r];
+                acc += diff * diff;
+            }
+            out[(r * out_stride) + i] = acc;
+        }
+    }
+}
+
+// Calls row(plane, row_a, row_b, bytes) in fused order: the luma rows of one
+// chroma row, then that chroma row of each chroma plane. Every variant runs
+// the same walk with its own row accumulator.
+template <typename Row>
+inline void walk_yuv(const YuvPlanes& a, const YuvPlanes& b, int width,
+                     int height, int chroma_width, int chroma_shift,
+                     Row& row) {
+    const int per_chroma = 1 << chroma_shift;
+    const int chroma_height = (height + per_chroma - 1) >> chroma_shift;
+    const int chroma_planes = a.data[2] != nullptr ? 3 : 2;
+    int y = 0;
+    for (int cy = 0; cy < chroma_height; cy++) {
+        for (int k = 0; k < per_chroma && y < height; k++, y++) {
+            row(0, a.data[0] + (y * a.stride[0]), b.data[0] + (y * b.stride[0]),
+                width);
+        }
+        for (int p = 1; p < chroma_planes; p++) {
+            row(p, a.data[p] + (cy * a.stride[p]),
+                b.data[p] + (cy * b.stride[p]), chroma_width);
+        }
+    }
+}
+
+void yuv_sad_scalar(const YuvPlanes& a, const YuvPlanes& b, int width,
+                    int height, int chroma_width, int chroma_shift,
+                    uint64_t* sad) {
+    sad[0] = sad[1] = sad[2] = 0;
+    auto row = [&](int p, const uint8_t* ra, const uint8_t* rb, int n) {
+        sad[p] += sad_scalar(ra, 0, rb, 0, n, 1);
+    };
+    walk_yuv(a, b, width, height, chroma_width, chroma_shift, row);
+}
+
+void deinterleave_scalar(const uint8_t* src, uint8_t* a, uint8_t* b, int n) {
+    for (int i = 0; i < n; i++) {
+        a[i] = src[2 * i];
+        b[i] = src[(2 * i) + 1];
+    }
+}
+
+#ifdef SCENEDETECT_X86
+
+// ---- SSE2 ----
+
+__attribute__((target("sse2"))) uint64_t hsum128(__m128i v) {
+    __m128i hi = _mm_unpackhi_epi64(v, v);
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(v)) +
+           static_cast<uint64_t>(_mm_cvtsi128_si64(hi));
+}
+
+// psadbw sums 8 absolute differences into each 64-bit lane
+__attribute__((target("sse2"))) uint64_t
+sad_sse2(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+         ptrdiff_t b_stride, int width, int height) {
+    __m128i acc = _mm_setzero_si128();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i va = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(a + x)); // NOLINT
+            __m128i vb = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(b + x)); // NOLINT
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+        }
+        tail += sad_scalar(a + x, 0, b + x, 0, width - x, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+    return hsum128(acc) + tail;
+}
+
+__attribute__((target("sse2"))) uint64_t
+span_sad_sse2(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+              ptrdiff_t b_stride, const Span* spans, const uint32_t* row_first,
+              int height) {
+    __m128i acc = _mm_setzero_si128();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        for (uint32_t i = row_first[y]; i < row_first[y + 1]; i++) {
+            const uint8_t* sa = a + spans[i].x;
+            const uint8_t* sb = b + spans[i].x;
+            const int width = spans[i].width;
+            int x = 0;
+            for (; x + 16 <= width; x += 16) {
+                __m128i va = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(sa + x)); // NOLINT
+                __m128i vb = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(sb + x)); // NOLINT
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+            }
+            tail += sad_scalar(sa + x, 0, sb + x, 0, width - x, 1);
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return hsum128(acc) + tail;
+}
+
+// two 8-pixel rows of a block in one register
+__attribute__((target("sse2"))) __m128i load_rows2(const uint8_t* p,
+                                                   ptrdiff_t stride) {
+    return _mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), // NOLINT
+        _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(p + stride))); // NOLINT
+}
+
+// the current block stays in registers for all candidates
+__attribute__((target("sse2"))) void
+block_sad_sse2(const uint8_t* cur, ptrdiff_t cur_stride, const uint8_t* ref,
+               ptrdiff_t ref_stride, const ptrdiff_t* offsets, int n,
+               uint32_t* sad) {
+    __m128i c[4]; // NOLINT
+    for (int r = 0; r < 4; r++) {
+        c[r] = load_rows2(cur + (2 * r * cur_stride), cur_stride);
+    }
+    for (int i = 0; i < n; i++) {
+        const uint8_t* p = ref + offsets[i];
+        __m128i acc = _mm_sad_epu8(c[0], load_rows2(p, ref_stride));
+        for (int r = 1; r < 4; r++) {
+            acc = _mm_add_epi64(
+                acc, _mm_sad_epu8(c[r], load_rows2(p + (2 * r * ref_stride),
+                                                   ref_stride)));
+        }
+        sad[i] = static_cast<uint32_t>(hsum128(acc));
+    }
+}
+
+__attribute__((target("sse2"))) int32_t hsum128_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+// no byte multiply in SSE2: both sides are widened to 16 bits for pmaddwd
+struct GemmTileSse2 {
+    static constexpr int rows = 2;
+    static constexpr int cols = 2;
+
+    __attribute__((target("sse2"))) void
+    operator()(const int8_t* const* a, const uint8_t* const* b, int32_t* c,
+               int m, int depth, int nr, int nc) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc[rows][cols]; // NOLINT
+        for (auto& row : acc) {
+            for (auto& v : row) {
+                v = zero;
+            }
+        }
+        for (int k = 0; k < depth; k += 16) {
+            __m128i wa[rows][2]; // NOLINT
+            for (int r = 0; r < rows; r++) {
+                __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(a[r] + k)); // NOLINT
+                __m128i sign = _mm_cmpgt_epi8(zero, v);
+                wa[r][0] = _mm_unpacklo_epi8(v, sign);
+                wa[r][1] = _mm_unpackhi_epi8(v, sign);
+            }
+            for (int q = 0; q < cols; q++) {
+                __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(b[q] + k)); // NOLINT
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                for (int r = 0; r < rows; r++) {
+                    acc[r][q] = _mm_add_epi32(
+                        acc[r][q],
+                        _mm_add_epi32(_mm_madd_epi16(wa[r][0], lo),
+                                      _mm_madd_epi16(wa[r][1], hi)));
+                }
+            }
+        }
+        for (int q = 0; q < nc; q++) {
+            for (int r = 0; r < nr; r++) {
+                c[(q * m) + r] = hsum128_epi32(acc[r][q]);
+            }
+        }
+    }
+};
+
+__attribute__((target("sse2"))) void
+gemm_u8s8_sse2(const int8_t* a, const uint8_t* b, int32_t* c, int m, int n,
+               int depth) {
+    GemmTileSse2 tile;
+    gemm_blocked(a, b, c, m, n, depth, tile);
+}
+
+template <int Rows>
+__attribute__((target("sse2"))) void
+sq_distances_rows_sse2(const float* a, const float* b, ptrdiff_t stride,
+                       int dims, int n, float* out, ptrdiff_t out_stride) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 acc[Rows];
+        for (int r = 0; r < Rows; r++) {
+            acc[r] = _mm_setzero_ps();
+        }
+        for (int d = 0; d < dims; d++) {
+            const __m128 x = _mm_loadu_ps(a + (d * stride) + i);
+            for (int r = 0; r < Rows; r++) {
+                const __m128 diff =
+                    _mm_sub_ps(x, _mm_set1_ps(b[(d * stride) + r]));
+                acc[r] = _mm_add_ps(acc[r], _mm_mul_ps(diff, diff));
+            }
+        }
+        for (int r = 0; r < Rows; r++) {
+            _mm_storeu_ps(out + (r * out_stride) + i, acc[r]);
+        }
+    }
+    sq_distances_scalar(a + i, b, stride, dims, Rows, n - i, out + i,
+                        out_stride);
+}
+
+__attribute__((target("sse2"))) void
+sq_distances_sse2(const float* a, const float* b, ptrdiff_t stride, int dims,
+                  int rows, int n, float* out, ptrdiff_t out_stride) {
+    switch (rows) {
+    case 1:
+        sq_distances_rows_sse2<1>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 2:
+        sq_distances_rows_sse2<2>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 3:
+        sq_distances_rows_sse2<3>(a, b, stride, dims, n, out, out_stride);
+        break;
+    default:
+        sq_distances_rows_sse2<4>(a, b, stride, dims, n, out, out_stride);
+        break;
+    }
+}
+
+// per-plane accumulators for walk_yuv
+struct YuvRowsSse2 {
+    __m128i acc[3];
+    uint64_t tail[3];
+
+    __attribute__((target("sse2"))) void
+    operator()(int p, const uint8_t* a, const uint8_t* b, int n) {
+        int x = 0;
+        for (; x + 16 <= n; x += 16) {
+            __m128i va = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(a + x)); // NOLINT
+            __m128i vb = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(b + x)); // NOLINT
+            acc[p] = _mm_add_epi64(acc[p], _mm_sad_epu8(va, vb));
+        }
+        tail[p] += sad_scalar(a + x, 0, b + x, 0, n - x, 1);
+    }
+};
+
+__attribute__((target("sse2"))) void
+yuv_sad_sse2(const YuvPlanes& a, const YuvPlanes& b, int width, int height,
+             int chroma_width, int chroma_shift, uint64_t* sad) {
+    YuvRowsSse2 rows{};
+    walk_yuv(a, b, width, height, chroma_width, chroma_shift, rows);
+    for (int p = 0; p < 3; p++) {
+        sad[p] = hsum128(rows.acc[p]) + rows.tail[p];
+    }
+}
+
+__attribute__((target("sse2"))) uint64_t
+sum_sse2(const uint8_t* src, ptrdiff_t stride, int width, int height) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(src + x)); // NOLINT
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+        }
+        tail += sum_scalar(src + x, 0, width - x, 1);
+        src += stride;
+    }
+    return hsum128(acc) + tail;
+}
+
+__attribute__((target("sse2"))) void sum_rows_sse2(const uint8_t* src,
+                                                   ptrdiff_t stride, int rows,
+                                                   int width,
+                                                   uint32_t* col_sum) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i acc0 = zero;
+        __m128i acc1 = zero;
+        __m128i acc2 = zero;
+        __m128i acc3 = zero;
+        const uint8_t* p = src + x;
+        for (int y = 0; y < rows; y++, p += stride) {
+            __m128i v =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); // NOLINT
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(lo, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(lo, zero));
+            acc2 = _mm_add_epi32(acc2, _mm_unpacklo_epi16(hi, zero));
+            acc3 = _mm_add_epi32(acc3, _mm_unpackhi_epi16(hi, zero));
+        }
+        auto* out = reinterpret_cast<__m128i*>(col_sum + x); // NOLINT
+        _mm_storeu_si128(out, acc0);
+        _mm_storeu_si128(out + 1, acc1);
+        _mm_storeu_si128(out + 2, acc2);
+        _mm_storeu_si128(out + 3, acc3);
+    }
+    if (x < width) {
+        sum_rows_scalar(src + x, stride, rows, width - x, col_sum + x);
+    }
+}
+
+__attribute__((target("sse2"))) void
+deinterleave_sse2(const uint8_t* src, uint8_t* a, uint8_t* b, int n) {
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v0 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + (2 * i))); // NOLINT
+        __m128i v1 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + (2 * i) + 16)); // NOLINT
+        __m128i va = _mm_packus_epi16(_mm_and_si128(v0, mask),
+                                      _mm_and_si128(v1, mask));
+        __m128i vb = _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+                                      _mm_srli_epi16(v1, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), va); // NOLINT
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), vb); // NOLINT
+    }
+    deinterleave_scalar(src + (2 * i), a + i, b + i, n - i);
+}
+
+// ---- AVX2 ----
+
+__attribute__((target("avx2"))) uint64_t hsum256(__m256i v) {
+    return hsum128(_mm_add_epi64(_mm256_castsi256_si128(v),
+                                 _mm256_extracti128_si256(v, 1)));
+}
+
+__attribute__((target("avx2"))) uint64_t
+sad_avx2(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+         ptrdiff_t b_stride, int width, int height) {
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            __m256i va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a + x)); // NOLINT
+            __m256i vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b + x)); // NOLINT
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+        }
+        tail += sad_sse2(a + x, 0, b + x, 0, width - x, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+    return hsum256(acc) + tail;
+}
+
+__attribute__((target("avx2"))) uint64_t
+span_sad_avx2(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+              ptrdiff_t b_stride, const Span* spans, const uint32_t* row_first,
+              int height) {
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        for (uint32_t i = row_first[y]; i < row_first[y + 1]; i++) {
+            const uint8_t* sa = a + spans[i].x;
+            const uint8_t* sb = b + spans[i].x;
+            const int width = spans[i].width;
+            int x = 0;
+            for (; x + 32 <= width; x += 32) {
+                __m256i va = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(sa + x)); // NOLINT
+                __m256i vb = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(sb + x)); // NOLINT
+                acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+            }
+            tail += sad_sse2(sa + x, 0, sb + x, 0, width - x, 1);
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return hsum256(acc) + tail;
+}
+
+__attribute__((target("avx2"))) __m256i load_rows4(const uint8_t* p,
+                                                   ptrdiff_t stride) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(load_rows2(p, stride)),
+        load_rows2(p + (2 * stride), stride), 1);
+}
+
+__attribute__((target("avx2"))) void
+block_sad_avx2(const uint8_t* cur, ptrdiff_t cur_stride, const uint8_t* ref,
+               ptrdiff_t ref_stride, const ptrdiff_t* offsets, int n,
+               uint32_t* sad) {
+    const __m256i c0 = load_rows4(cur, cur_stride);
+    const __m256i c1 = load_rows4(cur + (4 * cur_stride), cur_stride);
+    for (int i = 0; i < n; i++) {
+        const uint8_t* p = ref + offsets[i];
+        __m256i acc = _mm256_add_epi64(
+            _mm256_sad_epu8(c0, load_rows4(p, ref_stride)),
+            _mm256_sad_epu8(c1, load_rows4(p + (4 * ref_stride), ref_stride)));
+        sad[i] = static_cast<uint32_t>(hsum256(acc));
+    }
+}
+
+// pmaddubsw multiplies unsigned by signed bytes and adds pairs into 16
+// bits; activations below 128 keep those sums from saturating
+struct GemmTileAvx2 {
+    static constexpr int rows = 2;
+    static constexpr int cols = 4;
+
+    __attribute__((target("avx2"))) void
+    operator()(const int8_t* const* a, const uint8_t* const* b, int32_t* c,
+               int m, int depth, int nr, int nc) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i acc[rows][cols]; // NOLINT
+        for (auto& row : acc) {
+            for (auto& v : row) {
+                v = _mm256_setzero_si256();
+            }
+        }
+        for (int k = 0; k < depth; k += 32) {
+            __m256i wa[rows]; // NOLINT
+            for (int r = 0; r < rows; r++) {
+                wa[r] = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(a[r] + k)); // NOLINT
+            }
+            for (int q = 0; q < cols; q++) {
+                __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(b[q] + k)); // NOLINT
+                for (int r = 0; r < rows; r++) {
+                    acc[r][q] = _mm256_add_epi32(
+                        acc[r][q],
+                        _mm256_madd_epi16(_mm256_maddubs_epi16(v, wa[r]),
+                                          ones));
+                }
+            }
+        }
+        for (int q = 0; q < nc; q++) {
+            for (int r = 0; r < nr; r++) {
+                __m256i v = acc[r][q];
+                c[(q * m) + r] = hsum128_epi32(
+                    _mm_add_epi32(_mm256_castsi256_si128(v),
+                                  _mm256_extracti128_si256(v, 1)));
+            }
+        }
+    }
+};
+
+__attribute__((target("avx2"))) void
+gemm_u8s8_avx2(const int8_t* a, const uint8_t* b, int32_t* c, int m, int n,
+               int depth) {
+    GemmTileAvx2 tile;
+    gemm_blocked(a, b, c, m, n, depth, tile);
+}
+
+template <int Rows>
+__attribute__((target("avx2"))) void
+sq_distances_rows_avx2(const float* a, const float* b, ptrdiff_t stride,
+                       int dims, int n, float* out, ptrdiff_t out_stride) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 acc[Rows];
+        for (int r = 0; r < Rows; r++) {
+            acc[r] = _mm256_setzero_ps();
+        }
+        for (int d = 0; d < dims; d++) {
+            const __m256 x = _mm256_loadu_ps(a + (d * stride) + i);
+            for (int r = 0; r < Rows; r++) {
+                const __m256 diff =
+                    _mm256_sub_ps(x, _mm256_set1_ps(b[(d * stride) + r]));
+                acc[r] = _mm256_add_ps(acc[r], _mm256_mul_ps(diff, diff));
+            }
+        }
+        for (int r = 0; r < Rows; r++) {
+            _mm256_storeu_ps(out + (r * out_stride) + i, acc[r]);
+        }
+    }
+    sq_distances_rows_sse2<Rows>(a + i, b, stride, dims, n - i, out + i,
+                                 out_stride);
+}
+
+__attribute__((target("avx2"))) void
+sq_distances_avx2(const float* a, const float* b, ptrdiff_t stride, int dims,
+                  int rows, int n, float* out, ptrdiff_t out_stride) {
+    switch (rows) {
+    case 1:
+        sq_distances_rows_avx2<1>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 2:
+        sq_distances_rows_avx2<2>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 3:
+        sq_distances_rows_avx2<3>(a, b, stride, dims, n, out, out_stride);
+        break;
+    default:
+        sq_distances_rows_avx2<4>(a, b, stride, dims, n, out, out_stride);
+        break;
+    }
+}
+
+struct YuvRowsAvx2 {
+    __m256i acc[3];
+    uint64_t tail[3];
+
+    __attribute__((target("avx2"))) void
+    operator()(int p, const uint8_t* a, const uint8_t* b, int n) {
+        int x = 0;
+        for (; x + 32 <= n; x += 32) {
+            __m256i va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a + x)); // NOLINT
+            __m256i vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b + x)); // NOLINT
+            acc[p] = _mm256_add_epi64(acc[p], _mm256_sad_epu8(va, vb));
+        }
+        tail[p] += sad_sse2(a + x, 0, b + x, 0, n - x, 1);
+    }
+};
+
+__attribute__((target("avx2"))) void
+yuv_sad_avx2(const YuvPlanes& a, const YuvPlanes& b, int width, int height,
+             int chroma_width, int chroma_shift, uint64_t* sad) {
+    YuvRowsAvx2 rows{};
+    walk_yuv(a, b, width, height, chroma_width, chroma_shift, rows);
+    for (int p = 0; p < 3; p++) {
+        sad[p] = hsum256(rows.acc[p]) + rows.tail[p];
+    }
+}
+
+__attribute__((target("avx2"))) uint64_t
+sum_avx2(const uint8_t* src, ptrdiff_t stride, int width, int height) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(src + x)); // NOLINT
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+        }
+        tail += sum_sse2(src + x, 0, width - x, 1);
+        src += stride;
+    }
+    return hsum256(acc) + tail;
+}
+
+__attribute__((target("avx2"))) void sum_rows_avx2(const uint8_t* src,
+                                                   ptrdiff_t stride, int rows,
+                                                   int width,
+                                                   uint32_t* col_sum) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i acc[4] = {}; // NOLINT
+        const uint8_t* p = src + x;
+        for (int y = 0; y < rows; y++, p += stride) {
+            for (int k = 0; k < 4; k++) {
+                __m128i v = _mm_loadl_epi64(
+                    reinterpret_cast<const __m128i*>(p + (8 * k))); // NOLINT
+                acc[k] = _mm256_add_epi32(acc[k], _mm256_cvtepu8_epi32(v));
+            }
+        }
+        for (int k = 0; k < 4; k++) {
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i*>(col_sum + x + (8 * k)), // NOLINT
+                acc[k]);
+        }
+    }
+    if (x < width) {
+        sum_rows_sse2(src + x, stride, rows, width - x, col_sum + x);
+    }
+}
+
+__attribute__((target("avx2"))) void
+deinterleave_avx2(const uint8_t* src, uint8_t* a, uint8_t* b, int n) {
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v0 = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(src + (2 * i))); // NOLINT
+        __m256i v1 = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(src + (2 * i) + 32)); // NOLINT
+        // packus works per 128-bit lane; the permute restores the order
+        __m256i va = _mm256_packus_epi16(_mm256_and_si256(v0, mask),
+                                         _mm256_and_si256(v1, mask));
+        __m256i vb = _mm256_packus_epi16(_mm256_srli_epi16(v0, 8),
+                                         _mm256_srli_epi16(v1, 8));
+        va = _mm256_permute4x64_epi64(va, 0xd8);
+        vb = _mm256_permute4x64_epi64(vb, 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), va); // NOLINT
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), vb); // NOLINT
+    }
+    deinterleave_sse2(src + (2 * i), a + i, b + i, n - i);
+}
+
+// ---- AVX-512 (BW) ----
+
+__attribute__((target("avx512f,avx512bw"))) uint64_t
+sad_avx512(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+           ptrdiff_t b_stride, int width, int height) {
+    __m512i acc = _mm512_setzero_si512();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 64 <= width; x += 64) {
+            __m512i va = _mm512_loadu_si512(a + x);
+            __m512i vb = _mm512_loadu_si512(b + x);
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+        }
+        tail += sad_avx2(a + x, 0, b + x, 0, width - x, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+    return static_cast<uint64_t>(_mm512_reduce_add_epi64(acc)) + tail;
+}
+
+// span ends are handled with a masked load instead of a narrower tail
+__attribute__((target("avx512f,avx512bw"))) uint64_t
+span_sad_avx512(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+                ptrdiff_t b_stride, const Span* spans,
+                const uint32_t* row_first, int height) {
+    __m512i acc = _mm512_setzero_si512();
+    for (int y = 0; y < height; y++) {
+        for (uint32_t i = row_first[y]; i < row_first[y + 1]; i++) {
+            const uint8_t* sa = a + spans[i].x;
+            const uint8_t* sb = b + spans[i].x;
+            const int width = spans[i].width;
+            int x = 0;
+            for (; x + 64 <= width; x += 64) {
+                __m512i va = _mm512_loadu_si512(sa + x);
+                __m512i vb = _mm512_loadu_si512(sb + x);
+                acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+            }
+            if (x < width) {
+                const __mmask64 m = (1ULL << (width - x)) - 1;
+                __m512i va = _mm512_maskz_loadu_epi8(m, sa + x);
+                __m512i vb = _mm512_maskz_loadu_epi8(m, sb + x);
+                acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+            }
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return static_cast<uint64_t>(_mm512_reduce_add_epi64(acc));
+}
+
+// the whole 8x8 block in one register
+__attribute__((target("avx512f,avx512bw"))) __m512i
+load_rows8(const uint8_t* p, ptrdiff_t stride) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(load_rows4(p, stride)),
+                              load_rows4(p + (4 * stride), stride), 1);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void
+block_sad_avx512(const uint8_t* cur, ptrdiff_t cur_stride, const uint8_t* ref,
+                 ptrdiff_t ref_stride, const ptrdiff_t* offsets, int n,
+                 uint32_t* sad) {
+    const __m512i c = load_rows8(cur, cur_stride);
+    for (int i = 0; i < n; i++) {
+        __m512i d = _mm512_sad_epu8(c, load_rows8(ref + offsets[i],
+                                                  ref_stride));
+        sad[i] = static_cast<uint32_t>(_mm512_reduce_add_epi64(d));
+    }
+}
+
+// vpdpbusd does the multiply and both adds in one instruction; 32
+// registers leave room for a 4 x 4 tile
+struct GemmTileVnni {
+    static constexpr int rows = 4;
+    static constexpr int cols = 4;
+
+    __attribute__((target("avx512f,avx512bw,avx512vnni"))) void
+    operator()(const int8_t* const* a, const uint8_t* const* b, int32_t* c,
+               int m, int depth, int nr, int nc) {
+        __m512i acc[rows][cols]; // NOLINT
+        for (auto& row : acc) {
+            for (auto& v : row) {
+                v = _mm512_setzero_si512();
+            }
+        }
+        for (int k = 0; k < depth; k += 64) {
+            __m512i wa[rows]; // NOLINT
+            for (int r = 0; r < rows; r++) {
+                wa[r] = _mm512_loadu_si512(a[r] + k);
+            }
+            for (int q = 0; q < cols; q++) {
+                __m512i v = _mm512_loadu_si512(b[q] + k);
+                for (int r = 0; r < rows; r++) {
+                    acc[r][q] = _mm512_dpbusd_epi32(acc[r][q], v, wa[r]);
+                }
+            }
+        }
+        for (int q = 0; q < nc; q++) {
+            for (int r = 0; r < nr; r++) {
+                c[(q * m) + r] = _mm512_reduce_add_epi32(acc[r][q]);
+            }
+        }
+    }
+};
+
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void
+gemm_u8s8_vnni(const int8_t* a, const uint8_t* b, int32_t* c, int m, int n,
+               int depth) {
+    GemmTileVnni tile;
+    gemm_blocked(a, b, c, m, n, depth, tile);
+}
+
+template <int Rows>
+__attribute__((target("avx512f,avx512bw"))) void
+sq_distances_rows_avx512(const float* a, const float* b, ptrdiff_t stride,
+                         int dims, int n, float* out, ptrdiff_t out_stride) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 acc[Rows];
+        for (int r = 0; r < Rows; r++) {
+            acc[r] = _mm512_setzero_ps();
+        }
+        for (int d = 0; d < dims; d++) {
+            const __m512 x = _mm512_loadu_ps(a + (d * stride) + i);
+            for (int r = 0; r < Rows; r++) {
+                const __m512 diff =
+                    _mm512_sub_ps(x, _mm512_set1_ps(b[(d * stride) + r]));
+                acc[r] = _mm512_add_ps(acc[r], _mm512_mul_ps(diff, diff));
+            }
+        }
+        for (int r = 0; r < Rows; r++) {
+            _mm512_storeu_ps(out + (r * out_stride) + i, acc[r]);
+        }
+    }
+    sq_distances_rows_avx2<Rows>(a + i, b, stride, dims, n - i, out + i,
+                                 out_stride);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void
+sq_distances_avx512(const float* a, const float* b, ptrdiff_t stride,
+                    int dims, int rows, int n, float* out,
+                    ptrdiff_t out_stride) {
+    switch (rows) {
+    case 1:
+        sq_distances_rows_avx512<1>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 2:
+        sq_distances_rows_avx512<2>(a, b, stride, dims, n, out, out_stride);
+        break;
+    case 3:
+        sq_distances_rows_avx512<3>(a, b, stride, dims, n, out, out_stride);
+        break;
+    default:
+        sq_distances_rows_avx512<4>(a, b, stride, dims, n, out, out_stride);
+        break;
+    }
+}
+
+struct YuvRowsAvx512 {
+    __m512i acc[3];
+
+    __attribute__((target("avx512f,avx512bw"))) void
+    operator()(int p, const uint8_t* a, const uint8_t* b, int n) {
+        int x = 0;
+        for (; x + 64 <= n; x += 64) {
+            __m512i va = _mm512_loadu_si512(a + x);
+            __m512i vb = _mm512_loadu_si512(b + x);
+            acc[p] = _mm512_add_epi64(acc[p], _mm512_sad_epu8(va, vb));
+        }
+        if (x < n) {
+            const __mmask64 m = (1ULL << (n - x)) - 1;
+            __m512i va = _mm512_maskz_loadu_epi8(m, a + x);
+            __m512i vb = _mm512_maskz_loadu_epi8(m, b + x);
+            acc[p] = _mm512_add_epi64(acc[p], _mm512_sad_epu8(va, vb));
+        }
+    }
+};
+
+__attribute__((target("avx512f,avx512bw"))) void
+yuv_sad_avx512(const YuvPlanes& a, const YuvPlanes& b, int width, int height,
+               int chroma_width, int chroma_shift, uint64_t* sad) {
+    YuvRowsAvx512 rows{};
+    walk_yuv(a, b, width, height, chroma_width, chroma_shift, rows);
+    for (int p = 0; p < 3; p++) {
+        sad[p] = static_cast<uint64_t>(_mm512_reduce_add_epi64(rows.acc[p]));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"))) uint64_t
+sum_avx512(const uint8_t* src, ptrdiff_t stride, int width, int height) {
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i acc = _mm512_setzero_si512();
+    uint64_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        for (; x + 64 <= width; x += 64) {
+            __m512i v = _mm512_loadu_si512(src + x);
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(v, zero));
+        }
+        tail += sum_avx2(src + x, 0, width - x, 1);
+        src += stride;
+    }
+    return static_cast<uint64_t>(_mm512_reduce_add_epi64(acc)) + tail;
+}
+
+__attribute__((target("avx512f,avx512bw"))) void
+sum_rows_avx512(const uint8_t* src, ptrdiff_t stride, int rows, int width,
+                uint32_t* col_sum) {
+    int x = 0;
+    for (; x + 64 <= width; x += 64) {
+        __m512i acc[4] = {}; // NOLINT
+        const uint8_t* p = src + x;
+        for (int y = 0; y < rows; y++, p += stride) {
+            for (int k = 0; k < 4; k++) {
+                __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(p + (16 * k))); // NOLINT
+                acc[k] = _mm512_add_epi32(acc[k], _mm512_cvtepu8_epi32(v));
+            }
+        }
+        for (int k = 0; k < 4; k++) {
+            _mm512_storeu_si512(col_sum + x + (16 * k), acc[k]);
+        }
+    }
+    if (x < width) {
+        sum_rows_avx2(src + x, stride, rows, width - x, col_sum + x);
+    }
+}
+
+__attribute__((target("avx512f,avx512bw"))) void
+deinterleave_avx512(const uint8_t* src, uint8_t* a, uint8_t* b, int n) {
+    const __m512i mask = _mm512_set1_epi16(0x00ff);
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    int i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v0 = _mm512_loadu_si512(src + (2 * i));
+        __m512i v1 = _mm512_loadu_si512(src + (2 * i) + 64);
+        __m512i va = _mm512_packus_epi16(_mm512_and_si512(v0, mask),
+                                         _mm512_and_si512(v1, mask));
+        __m512i vb = _mm512_packus_epi16(_mm512_srli_epi16(v0, 8),
+                                         _mm512_srli_epi16(v1, 8));
+        _mm512_storeu_si512(a + i, _mm512_permutexvar_epi64(order, va));
+        _mm512_storeu_si512(b + i, _mm512_permutexvar_epi64(order, vb));
+    }
+    deinterleave_avx2(src + (2 * i), a + i, b + i, n - i);
+}
+
+#endif
+
+constexpr Variants<SadFn> sad_variants = {
+    sad_scalar, X86_ONLY(sad_sse2), X86_ONLY(sad_avx2), X86_ONLY(sad_avx512)};
+constexpr Variants<SumFn> sum_variants = {
+    sum_scalar, X86_ONLY(sum_sse2), X86_ONLY(sum_avx2), X86_ONLY(sum_avx512)};
+constexpr Variants<HistogramFn> histogram_variants = {
+    histogram_scalar, histogram_split, nullptr, nullptr};
+constexpr Variants<SumRowsFn> sum_rows_variants = {
+    sum_rows_scalar, X86_ONLY(sum_rows_sse2), X86_ONLY(sum_rows_avx2),
+    X86_ONLY(sum_rows_avx512)};
+constexpr Variants<DeinterleaveFn> deinterleave_variants = {
+    deinterleave_scalar, X86_ONLY(deinterleave_sse2),
+    X86_ONLY(deinterleave_avx2), X86_ONLY(deinterleave_avx512)};
+constexpr Variants<SpanSadFn> span_sad_variants = {
+    span_sad_scalar, X86_ONLY(span_sad_sse2), X86_ONLY(span_sad_avx2),
+    X86_ONLY(span_sad_avx512)};
+constexpr Variants<YuvSadFn> yuv_sad_variants = {
+    yuv_sad_scalar, X86_ONLY(yuv_sad_sse2), X86_ONLY(yuv_sad_avx2),
+    X86_ONLY(yuv_sad_avx512)};
+constexpr Variants<BlockSadFn> block_sad_variants = {
+    block_sad_scalar, X86_ONLY(block_sad_sse2), X86_ONLY(block_sad_avx2),
+    X86_ONLY(block_sad_avx512)};
+constexpr Variants<DistancesFn> distances_variants = {
+    sq_distances_scalar, X86_ONLY(sq_distances_sse2),
+    X86_ONLY(sq_distances_avx2), X86_ONLY(sq_distances_avx512)};
+
+// VNNI is not part of AVX-512BW, so the AVX-512 slot is only filled on CPUs
+// that have it; others use the AVX2 variant
+const Variants<GemmFn>& gemm_variants() {
+    static const Variants<GemmFn> variants = [] {
+        Variants<GemmFn> v = {gemm_u8s8_scalar, X86_ONLY(gemm_u8s8_sse2),
+                              X86_ONLY(gemm_u8s8_avx2), nullptr};
+#ifdef SCENEDETECT_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vnni")) {
+            v[3] = gemm_u8s8_vnni;
+        }
+#endif
+        return v;
+    }();
+    return variants;
+}
+
+// Highest level at or below `level` with a variant of its own.
+template <typename Fn>
+int pick(const Variants<Fn>& variants, SimdLevel level) {
+    int i = static_cast<int>(std::min(level, cpu_simd_level()));
+    while (i > 0 && variants[i] == nullptr) {
+        i--;
+    }
+    return i;
+}
+
+Kernels& table() {
+    static Kernels k = [] {
+        const SimdLevel top = cpu_simd_level();
+        return Kernels{
+            .sad = sad_variants[pick(sad_variants, top)],
+            .sum = sum_variants[pick(sum_variants, top)],
+            .histogram = histogram_variants[pick(histogram_variants, top)],
+            .sum_rows = sum_rows_variants[pick(sum_rows_variants, top)],
+            .deinterleave =
+                deinterleave_variants[pick(deinterleave_variants, top)],
+            .span_sad = span_sad_variants[pick(span_sad_variants, top)],
+            .yuv_sad = yuv_sad_variants[pick(yuv_sad_variants, top)],
+            .block_sad = block_sad_variants[pick(block_sad_variants, top)],
+            .gemm_u8s8 = gemm_variants()[pick(gemm_variants(), top)],
+            .sq_distances =
+                distances_variants[pick(distances_variants, top)],
+        };
+    }();
+    return k;
+}
+
+// A variant runs untimed for settle_ns before it is timed for slice_ns.
+// Wide vectors can lower the clock only after a few hundred microseconds
+// of use, so a short timing would miss the slowdown.
+constexpr int64_t settle_ns = 1'000'000;
+constexpr int64_t slice_ns = 1'000'000;
+// rounds in which every variant is timed once
+constexpr int benchmark_rounds = 3;
+
+// Nanoseconds per call once the clock has settled.
+template <typename Call> double time_steady(Call&& call) {
+    auto start = now();
+    while (since<std::chrono::nanoseconds>(start).count() < settle_ns) {
+        call();
+    }
+    int64_t calls = 0;
+    int64_t elapsed = 0;
+    start = now();
+    do {
+        call();
+        calls++;
+        elapsed = since<std::chrono::nanoseconds>(start).count();
+    } while (elapsed < slice_ns);
+    return static_cast<double>(elapsed) / static_cast<double>(calls);
+}
+
+// Times each distinct variant of one kernel and returns the fastest level.
+// The variants take turns in a rotating order and each is judged by its
+// median round, so none is only ever timed right after a variant that
+// lowered the clock.
+template <typename Fn, typename Call>
+SimdLevel fastest(const Variants<Fn>& variants, Call&& call) {
+    const int top = static_cast<int>(cpu_simd_level());
+    std::vector<int> levels;
+    for (int level = 0; level <= top; level++) {
+        if (variants[level] != nullptr) {
+            levels.push_back(level);
+        }
+    }
+    if (levels.size() == 1) {
+        return static_cast<SimdLevel>(levels[0]);
+    }
+
+    using Rounds = std::array<double, benchmark_rounds>;
+    std::array<Rounds, std::size(simd_level_names)> ns{};
+    for (int round = 0; round < benchmark_rounds; round++) {
+        for (size_t i = 0; i < levels.size(); i++) {
+            const int level = levels[(i + round) % levels.size()];
+            ns[level][round] = time_steady([&] { call(variants[level]); });
+        }
+    }
+
+    int best_level = levels[0];
+    double best_ns = INFINITY;
+    for (int level : levels) {
+        auto& rounds = ns[level];
+        std::nth_element(rounds.begin(), rounds.begin() + (rounds.size() / 2),
+                         rounds.end());
+        if (rounds[rounds.size() / 2] < best_ns) {
+            best_ns = rounds[rounds.size() / 2];
+            best_level = level;
+        }
+    }
+    return static_cast<SimdLevel>(best_level);
+}
+
+} // namespace
+
+SimdLevel cpu_simd_level() {
+#ifdef SCENEDETECT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        return SimdLevel::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::Sse2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+const Kernels& kernels() { return table(); }
+
+void bind_kernel(KernelId id, SimdLevel level) {
+    Kernels& k = table();
+    switch (id) {
+    case KernelId::Sad:
+        k.sad = sad_variants[pick(sad_variants, level)];
+        break;
+    case KernelId::Sum:
+        k.sum = sum_variants[pick(sum_variants, level)];
+        break;
+    case KernelId::Histogram:
+        k.histogram = histogram_variants[pick(histogram_variants, level)];
+        break;
+    case KernelId::SumRows:
+        k.sum_rows = sum_rows_variants[pick(sum_rows_variants, level)];
+        break;
+    case KernelId::Deinterleave:
+        k.deinterleave =
+            deinterleave_variants[pick(deinterleave_variants, level)];
+        break;
+    case KernelId::SpanSad:
+        k.span_sad = span_sad_variants[pick(span_sad_variants, level)];
+        break;
+    case KernelId::YuvSad:
+        k.yuv_sad = yuv_sad_variants[pick(yuv_sad_variants, level)];
+        break;
+    case KernelId::BlockSad:
+        k.block_sad = block_sad_variants[pick(block_sad_variants, level)];
+        break;
+    case KernelId::Gemm:
+        k.gemm_u8s8 = gemm_variants()[pick(gemm_variants(), level)];
+        break;
+    case KernelId::Distances:
+        k.sq_distances = distances_variants[pick(distances_variants, level)];
+        break;
+    }
+}
+
+KernelLevels benchmark_kernels() {
+    // a 360p plane: large enough to stream through L1; the time the
+    // benchmark takes is set by time_steady()
+    constexpr int w = 640;
+    constexpr int h = 360;
+    constexpr ptrdiff_t stride = w + 64;
+    std::vector<uint8_t> a(stride * h);
+    std::vector<uint8_t> b(stride * h);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < a.size(); i++) {
+        seed = (seed * 1664525U) + 1013904223U;
+        a[i] = static_cast<uint8_t>(seed >> 24);
+        b[i] = static_cast<uint8_t>(seed >> 16);
+    }
+    std::vector<uint32_t> sums(w);
+    std::array<uint32_t, 256> hist{};
+    std::vector<uint8_t> out_a(w * h / 2);
+    std::vector<uint8_t> out_b(w * h / 2);
+
+    // keeps the calls from being optimized away
+    volatile uint64_t sink = 0;
+
+    KernelLevels levels{};
+    levels[static_cast<size_t>(KernelId::Sad)] =
+        fastest(sad_variants, [&](SadFn fn) {
+            sink = sink + fn(a.data(), stride, b.data(), stride, w, h);
+        });
+    levels[static_cast<size_t>(KernelId::Sum)] =
+        fastest(sum_variants, [&](SumFn fn) {
+            sink = sink + fn(a.data(), stride, w, h);
+        });
+    levels[static_cast<size_t>(KernelId::Histogram)] =
+        fastest(histogram_variants, [&](HistogramFn fn) {
+            fn(a.data(), stride, w, h, hist.data());
+        });
+    levels[static_cast<size_t>(KernelId::SumRows)] =
+        fastest(sum_rows_variants, [&](SumRowsFn fn) {
+            // the row counts of a 1080p to thumbnail downscale
+            for (int y = 0; y + 16 <= h; y += 16) {
+                fn(a.data() + (y * stride), stride, 16, w, sums.data());
+            }
+        });
+    levels[static_cast<size_t>(KernelId::Deinterleave)] =
+        fastest(deinterleave_variants, [&](DeinterleaveFn fn) {
+            fn(a.data(), out_a.data(), out_b.data(), w * h / 2);
+        });
+
+    // a corner logo cut out of the top rows
+    std::vector<Span> spans;
+    std::vector<uint32_t> row_first;
+    for (int y = 0; y < h; y++) {
+        row_first.push_back(static_cast<uint32_t>(spans.size()));
+        if (y < h / 8) {
+            spans.push_back(Span{.x = 0, .width = w - (w / 8)});
+        } else {
+            spans.push_back(Span{.x = 0, .width = w});
+        }
+    }
+    row_first.push_back(static_cast<uint32_t>(spans.size()));
+    levels[static_cast<size_t>(KernelId::SpanSad)] =
+        fastest(span_sad_variants, [&](SpanSadFn fn) {
+            sink = sink + fn(a.data(), stride, b.data(), stride, spans.data(),
+                             row_first.data(), h);
+        });
+
+    // 4:2:0 with the chroma planes taken from the lower half of the buffers
+    const ptrdiff_t chroma_offset = stride * (h / 2);
+    const YuvPlanes ya = {
+        .data = {a.data(), a.data() + chroma_offset,
+                 a.data() + chroma_offset + (w / 2)},
+        .stride = {stride, stride, stride}};
+    const YuvPlanes yb = {
+        .data = {b.data(), b.data() + chroma_offset,
+                 b.data() + chroma_offset + (w / 2)},
+        .stride = {stride, stride, stride}};
+    std::array<uint64_t, 3> plane_sad{};
+    levels[static_cast<size_t>(KernelId::YuvSad)] =
+        fastest(yuv_sad_variants, [&](YuvSadFn fn) {
+            fn(ya, yb, w, h, w / 2, 1, plane_sad.data());
+            sink = sink + plane_sad[0];
+        });
+
+    // one hexagon step of a motion search for every block of the plane
+    std::array<ptrdiff_t, 6> hexagon{};
+    constexpr int hex[6][2] = {{-2, 0}, {2, 0}, {-1, -2}, {1, -2}, {-1, 2},
+                               {1, 2}};
+    for (size_t i = 0; i < hexagon.size(); i++) {
+        hexagon[i] = (hex[i][1] * stride) + hex[i][0];
+    }
+    std::array<uint32_t, 6> block_sads{};
+    levels[static_cast<size_t>(KernelId::BlockSad)] =
+        fastest(block_sad_variants, [&](BlockSadFn fn) {
+            for (int y = 2; y + sad_block + 2 <= h; y += sad_block) {
+                for (int x = 2; x + sad_block + 2 <= w; x += sad_block) {
+                    const ptrdiff_t at = (y * stride) + x;
+                    fn(b.data() + at, stride, a.data() + at, stride,
+                       hexagon.data(), 6, block_sads.data());
+                    sink = sink + block_sads[0];
+                }
+            }
+        });
+
+    // a convolution layer of the learned detector: 32 filters over 3x3x3
+    // patches of 16 channels, for a few hundred positions
+    constexpr int gemm_m = 32;
+    constexpr int gemm_depth = 448;
+    constexpr int gemm_n = 256;
+    std::vector<int8_t> weights(gemm_m * gemm_depth);
+    std::vector<uint8_t> patches(gemm_n * gemm_depth);
+    for (size_t i = 0; i < weights.size(); i++) {
+        weights[i] = static_cast<int8_t>(a[i]);
+    }
+    for (size_t i = 0; i < patches.size(); i++) {
+        patches[i] = static_cast<uint8_t>(b[i] & 0x7f);
+    }
+    std::vector<int32_t> products(gemm_m * gemm_n);
+    levels[static_cast<size_t>(KernelId::Gemm)] =
+        fastest(gemm_variants(), [&](GemmFn fn) {
+            fn(weights.data(), patches.data(), products.data(), gemm_m,
+               gemm_n, gemm_depth);
+            sink = sink + static_cast<uint64_t>(products[0]);
+        });
+
+    // all pairs of a few hundred scenes' feature vectors
+    constexpr int scenes = 256;
+    constexpr int dims = 145;
+    std::vector<float> features(static_cast<size_t>(scenes) * dims);
+    for (size_t i = 0; i < features.size(); i++) {
+        features[i] = static_cast<float>(a[i]) * 0.37F;
+    }
+    std::vector<float> dist(static_cast<size_t>(distance_rows) * scenes);
+
+    // Cluster ties depend on the exact distances, so a variant that does
+    // not give the scalar bits is never picked. An odd count covers the
+    // tails as well.
+    Variants<DistancesFn> exact = distances_variants;
+    std::vector<float> expected(dist.size());
+    sq_distances_scalar(features.data(), features.data() + 1, scenes, dims,
+                        distance_rows, scenes - 3, expected.data(), scenes);
+    const int top = static_cast<int>(cpu_simd_level());
+    for (int level = 1; level <= top; level++) {
+        if (exact[level] == nullptr) {
+            continue;
+        }
+        std::fill(dist.begin(), dist.end(), 0.0F);
+        exact[level](features.data(), features.data() + 1, scenes, dims,
+                     distance_rows, scenes - 3, dist.data(), scenes);
+        if (memcmp(dist.data(), expected.data(),
+                   dist.size() * sizeof(float)) != 0) {
+            (void)fprintf(stderr,
+                          "%s distances differ from scalar, not used\n",
+                          simd_level_names[level]);
+            exact[level] = nullptr;
+        }
+    }
+    levels[static_cast<size_t>(KernelId::Distances)] =
+        fastest(exact, [&](DistancesFn fn) {
+            for (int j = 0; j < scenes; j += distance_rows) {
+                fn(features.data(), features.data() + j, scenes, dims,
+                   distance_rows, scenes, dist.data(), scenes);
+                sink = sink + static_cast<uint64_t>(dist[0]);
+            }
+        });
+
+    for (size_t i = 0; i < kernel_count; i++) {
+        bind_kernel(static_cast<KernelId>(i), levels[i]);
+    }
+    return levels;
+}
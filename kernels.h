@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Instruction set levels the kernels are built for.
+enum class SimdLevel : uint8_t { Scalar, Sse2, Avx2, Avx512 };
+
+inline constexpr const char* simd_level_names[] = {"scalar", "sse2", "avx2",
+                                                   "avx512"};
+
+// Highest level this CPU supports.
+[[nodiscard]] SimdLevel cpu_simd_level();
+
+// Run of `width` pixels starting at column `x` of one row.
+struct Span {
+    int32_t x;
+    int32_t width;
+};
+
+// Width and height of the blocks block_sad() compares.
+inline constexpr int sad_block = 8;
+
+// gemm_u8s8() depths are padded with zeros to a multiple of this.
+inline constexpr int gemm_depth_align = 64;
+
+// Vectors sq_distances() measures against at once.
+inline constexpr int distance_rows = 4;
+
+// Luma and chroma planes of one frame, or of a block inside it.
+struct YuvPlanes {
+    const uint8_t* data[3];
+    ptrdiff_t stride[3];
+};
+
+// The analysis kernels, bound to one variant each. All of them take 8-bit
+// planes.
+struct Kernels {
+    // sum of absolute differences of two width x height blocks
+    uint64_t (*sad)(const uint8_t* a, ptrdiff_t a_stride, const uint8_t* b,
+                    ptrdiff_t b_stride, int width, int height);
+    // sum of all pixels, for means
+    uint64_t (*sum)(const uint8_t* src, ptrdiff_t stride, int width,
+                    int height);
+    // adds the block's pixel values to 256 bins
+    void (*histogram)(const uint8_t* src, ptrdiff_t stride, int width,
+                      int height, uint32_t* hist);
+    // vertical pass of an area downscale: col_sum[x] = sum of `rows` rows
+    void (*sum_rows)(const uint8_t* src, ptrdiff_t stride, int rows,
+                     int width, uint32_t* col_sum);
+    // splits n interleaved pairs (NV12 chroma) into two planes
+    void (*deinterleave)(const uint8_t* src, uint8_t* a, uint8_t* b, int n);
+    // SAD over row spans only: row y covers spans[row_first[y]] up to
+    // spans[row_first[y + 1]], so pixels outside them are never loaded
+    uint64_t (*span_sad)(const uint8_t* a, ptrdiff_t a_stride,
+                         const uint8_t* b, ptrdiff_t b_stride,
+                         const Span* spans, const uint32_t* row_first,
+                         int height);
+    // SAD of a width x height luma block and its chroma in one pass, each
+    // chroma row right after the luma rows it covers. `chroma_shift` is 1
+    // for 4:2:0 and 0 for 4:2:2. Chroma rows are `chroma_width` bytes; plane
+    // 2 is skipped if it is null (interleaved NV12 chroma). Per-plane sums go
+    // to sad[0..2].
+    void (*yuv_sad)(const YuvPlanes& a, const YuvPlanes& b, int width,
+                    int height, int chroma_width, int chroma_shift,
+                    uint64_t* sad);
+    // SAD of the sad_block x sad_block block at `cur` against `n` blocks at
+    // byte offsets from `ref`, into sad[0..n): the candidates of one motion
+    // search step. The current block is loaded once for all of them.
+    void (*block_sad)(const uint8_t* cur, ptrdiff_t cur_stride,
+                      const uint8_t* ref, ptrdiff_t ref_stride,
+                      const ptrdiff_t* offsets, int n, uint32_t* sad);
+    // int8 matrix product of the learned detector, cache blocked:
+    // c[j * m + i] = sum over k of a[i * depth + k] * b[j * depth + k] for
+    // i < m, j < n. `a` holds signed weights, `b` activations in [0, 127],
+    // so two products always fit 16 bits. `depth` is a multiple of
+    // gemm_depth_align.
+    void (*gemm_u8s8)(const int8_t* a, const uint8_t* b, int32_t* c, int m,
+                      int n, int depth);
+    // Squared Euclidean distances between float vectors stored one
+    // dimension per row, rows `stride` floats apart: from each of the
+    // `rows` (at most distance_rows) vectors starting at `b` to each of the
+    // `n` vectors starting at `a`, into out[r * out_stride + i]. Every
+    // dimension of `a` is loaded once for all rows.
+    void (*sq_distances)(const float* a, const float* b, ptrdiff_t stride,
+                         int dims, int rows, int n, float* out,
+                         ptrdiff_t out_stride);
+};
+
+enum class KernelId : uint8_t {
+    Sad,
+    Sum,
+    Histogram,
+    SumRows,
+    Deinterleave,
+    SpanSad,
+    YuvSad,
+    BlockSad,
+    Gemm,
+    Distances
+};
+inline constexpr size_t kernel_count = 10;
+inline constexpr const char* kernel_names[kernel_count] = {
+    "sad",      "sum",     "histogram", "sum-rows", "deinterleave",
+    "span-sad", "yuv-sad", "block-sad", "gemm",     "distances"};
+
+using KernelLevels = std::array<SimdLevel, kernel_count>;
+
+// The bound variants. Until bind_kernel() runs each kernel uses the highest
+// level the CPU supports.
+[[nodiscard]] const Kernels& kernels();
+
+// Binds `id` to its best variant at or below `level` and the CPU's level.
+// Not thread safe: call before analysis starts.
+void bind_kernel(KernelId id, SimdLevel level);
+
+// Times every variant the CPU supports on synthetic planes, binds the
+// fastest of each kernel and returns the choices. The highest ISA is not
+// always the fastest: wide vectors can lower the clock on some CPUs, so
+// variants are timed at steady clocks, which takes a few hundred ms.
+KernelLevels benchmark_kernels();
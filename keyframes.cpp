@@ -0,0 +1,46 @@
+#include "keyframes.h"
+
+#include <cerrno>
+#include <cstdio>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+int write_keyframes(const char* path, KeyframeFormat format,
+                    const CutList& cuts) {
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+        return AVERROR(errno);
+    }
+
+    for (size_t i = 0; i < cuts.frames.size(); i++) {
+        auto frame = static_cast<long long>(cuts.frames[i]);
+        const char* sep = i == 0 ? "" : ",";
+
+        switch (format) {
+        case KeyframeFormat::Qpfile:
+            (void)fprintf(out, "%lld K -1\n", frame);
+            break;
+        case KeyframeFormat::SvtAv1:
+            (void)fprintf(out, "%s%lldf", sep, frame);
+            break;
+        case KeyframeFormat::Frames:
+            (void)fprintf(out, "%lld\n", frame);
+            break;
+        case KeyframeFormat::Ffmpeg: {
+            double seconds =
+                static_cast<double>(cuts.pts[i] - cuts.start_pts) *
+                av_q2d(cuts.time_base);
+            (void)fprintf(out, "%s%.6f", sep, seconds);
+            break;
+        }
+        }
+    }
+
+    if (format == KeyframeFormat::SvtAv1 || format == KeyframeFormat::Ffmpeg) {
+        (void)fputc('\n', out);
+    }
+
+    return fclose(out) == 0 ? 0 : AVERROR(EIO);
+}
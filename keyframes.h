@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "detect.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+enum class KeyframeFormat : uint8_t {
+    // x264/x265 --qpfile: "<frame> K -1" per cut
+    Qpfile,
+    // SVT-AV1 --force-key-frames: "120f,348f,..."
+    SvtAv1,
+    // one frame number per line, for aomenc wrappers and similar tools
+    Frames,
+    // ffmpeg -force_key_frames: comma separated seconds from the first frame
+    Ffmpeg,
+};
+
+// Writes the cut list in a format encoders consume directly, so they can
+// skip their own scenecut lookahead. Returns 0 or a negative AVERROR.
+int write_keyframes(const char* path, KeyframeFormat format,
+                    const CutList& cuts);
+
+// For library users that feed decoded frames straight into an encoder:
+// forces an intra frame on every cut and clears any stale picture type
+// elsewhere. Frames must be applied in presentation order.
+class KeyframeForcer {
+  public:
+    // Keeps its own copy of the cut list, which is small.
+    explicit KeyframeForcer(std::vector<int64_t> cuts)
+        : cuts(std::move(cuts)) {}
+
+    void apply(AVFrame* frame, int64_t frame_idx) {
+        while (next < cuts.size() && cuts[next] < frame_idx) {
+            next++;
+        }
+        if (next < cuts.size() && cuts[next] == frame_idx) {
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            next++;
+        } else {
+            frame->pict_type = AV_PICTURE_TYPE_NONE;
+        }
+    }
+
+  private:
+    std::vector<int64_t> cuts;
+    size_t next{0};
+};
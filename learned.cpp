@@ -0,0 +1,462 @@
+#include "learned.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+constexpr uint32_t model_version = 1;
+constexpr int max_frame_size = 256;
+constexpr int max_window = 512;
+constexpr uint32_t max_layers = 64;
+constexpr int max_kernel = 15;
+constexpr int max_channels = 4096;
+// frames enter with Y, U and V halved, so 64 stands for zero
+constexpr uint8_t input_zero_point = 64;
+// im2col rows built and multiplied at a time: a few hundred KiB of
+// patches, which stay in L2 while every filter runs over them
+constexpr int block_positions = 256;
+
+// written by load_shot_model() before decoding starts, read-only afterwards
+std::optional<ShotModel> loaded_model;
+
+int align_depth(int n) {
+    return (n + gemm_depth_align - 1) / gemm_depth_align * gemm_depth_align;
+}
+
+bool read_exact(FILE* file, void* dst, size_t bytes) {
+    return fread(dst, 1, bytes, file) == bytes;
+}
+
+// Reads the weights, bias and scale of a layer with `values` inputs per
+// output and folds the input zero point into the bias.
+bool read_weights(FILE* file, ShotLayer& layer, int values) {
+    const auto out = static_cast<size_t>(layer.out_channels);
+    layer.depth = align_depth(values);
+    layer.weights.assign(out * layer.depth, 0);
+    layer.bias.resize(out);
+    layer.scale.resize(out);
+    for (size_t m = 0; m < out; m++) {
+        if (!read_exact(file, layer.weights.data() + (m * layer.depth),
+                        static_cast<size_t>(values))) {
+            return false;
+        }
+    }
+    if (!read_exact(file, layer.bias.data(), out * sizeof(int32_t)) ||
+        !read_exact(file, layer.scale.data(), out * sizeof(float))) {
+        return false;
+    }
+
+    for (size_t m = 0; m < out; m++) {
+        int32_t sum = 0;
+        for (int k = 0; k < values; k++) {
+            sum += layer.weights[(m * layer.depth) + k];
+        }
+        layer.bias[m] -= static_cast<int32_t>(layer.zero_point) * sum;
+        if (!std::isfinite(layer.scale[m])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t requantize(int32_t acc, int32_t bias, float scale) {
+    const float v = static_cast<float>(acc + bias) * scale;
+    return static_cast<uint8_t>(std::clamp(std::lrint(v), 0L, 127L));
+}
+
+} // namespace
+
+int load_shot_model(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+    auto closer = std::unique_ptr<FILE, decltype([](FILE* f) {
+                                      (void)fclose(f);
+                                  })>(file);
+
+    ShotModelHeader hdr{};
+    if (!read_exact(file, &hdr, sizeof(hdr)) ||
+        memcmp(hdr.magic, shot_model_magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != model_version || hdr.width < 8 ||
+        hdr.width > max_frame_size || hdr.height < 8 ||
+        hdr.height > max_frame_size || hdr.window < 3 ||
+        hdr.window > max_window || 2 * hdr.context >= hdr.window ||
+        hdr.layer_count == 0 || hdr.layer_count > max_layers) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    ShotModel model{
+        .width = hdr.width,
+        .height = hdr.height,
+        .window = static_cast<int>(hdr.window),
+        .context = static_cast<int>(hdr.context),
+        .layers = {},
+    };
+    // per-frame shape of the activations entering the next layer
+    int channels = 3;
+    int height = model.height;
+    int width = model.width;
+    uint8_t zero_point = input_zero_point;
+    for (uint32_t i = 0; i < hdr.layer_count; i++) {
+        ShotLayerHeader lh{};
+        if (!read_exact(file, &lh, sizeof(lh))) {
+            return AVERROR_INVALIDDATA;
+        }
+        ShotLayer layer{
+            .type = static_cast<ShotLayerType>(lh.type),
+            .in_channels = static_cast<int>(lh.in_channels),
+            .out_channels = static_cast<int>(lh.out_channels),
+            .kernel_t = lh.kernel_t,
+            .kernel_h = lh.kernel_h,
+            .kernel_w = lh.kernel_w,
+            .dilation = lh.dilation,
+            .depth = 0,
+            .zero_point = zero_point,
+            .weights = {},
+            .bias = {},
+            .scale = {},
+        };
+        const bool last = i + 1 == hdr.layer_count;
+        const int values = channels * height * width;
+        bool ok = lh.out_channels >= 1 && lh.out_channels <= max_channels;
+        switch (layer.type) {
+        case ShotLayerType::Conv3d:
+            ok = ok && !last && layer.in_channels == channels &&
+                 layer.kernel_t % 2 == 1 && layer.kernel_h % 2 == 1 &&
+                 layer.kernel_w % 2 == 1 && layer.kernel_t <= max_kernel &&
+                 layer.kernel_h <= max_kernel &&
+                 layer.kernel_w <= max_kernel && layer.dilation >= 1 &&
+                 read_weights(file, layer,
+                              layer.kernel_t * layer.kernel_h *
+                                  layer.kernel_w * channels);
+            channels = layer.out_channels;
+            zero_point = 0;
+            break;
+        case ShotLayerType::Pool:
+            ok = !last && height >= 2 && width >= 2;
+            height /= 2;
+            width /= 2;
+            break;
+        case ShotLayerType::Dense:
+            ok = ok && !last && layer.in_channels == values &&
+                 read_weights(file, layer, values);
+            channels = layer.out_channels;
+            height = 1;
+            width = 1;
+            zero_point = 0;
+            break;
+        case ShotLayerType::Output:
+            ok = ok && last && layer.in_channels == values &&
+                 layer.out_channels == 1 && read_weights(file, layer, values);
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            return AVERROR_INVALIDDATA;
+        }
+        model.layers.push_back(std::move(layer));
+    }
+    if (model.layers.back().type != ShotLayerType::Output) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    loaded_model = std::move(model);
+    return 0;
+}
+
+const ShotModel* shot_model() {
+    return loaded_model ? &*loaded_model : nullptr;
+}
+
+LearnedDetector::LearnedDetector(const ShotModel& model)
+    : model(model), thumbnailer(model.width),
+      planes(static_cast<size_t>(3) * model.width * model.height),
+      frame_bytes(3 * model.width * model.height),
+      stride(model.window - (2 * model.context)),
+      ring_frames((static_cast<int64_t>(batch_windows) * stride) +
+                  (2 * static_cast<int64_t>(model.context))) {
+    ring.resize(static_cast<size_t>(ring_frames) * frame_bytes);
+
+    // buffers for the largest layer
+    const auto frames = static_cast<size_t>(batch_windows) * model.window;
+    size_t values = static_cast<size_t>(frame_bytes);
+    size_t depth = 0;
+    size_t out = 0;
+    int c = 3;
+    int h = model.height;
+    int w = model.width;
+    for (const auto& layer : model.layers) {
+        depth = std::max(depth, static_cast<size_t>(layer.depth));
+        out = std::max(out, static_cast<size_t>(layer.out_channels));
+        switch (layer.type) {
+        case ShotLayerType::Conv3d:
+            c = layer.out_channels;
+            break;
+        case ShotLayerType::Pool:
+            h /= 2;
+            w /= 2;
+            break;
+        case ShotLayerType::Dense:
+        case ShotLayerType::Output:
+            c = layer.out_channels;
+            h = 1;
+            w = 1;
+            break;
+        }
+        values = std::max(values, static_cast<size_t>(c) * h * w);
+    }
+    act_a.resize(frames * values);
+    act_b.resize(frames * values);
+    patches.resize(block_positions * depth);
+    products.resize(block_positions * out);
+    logits.resize(frames);
+}
+
+uint8_t* LearnedDetector::slot(int64_t frame) {
+    const int64_t i = (frame + ring_frames) % ring_frames;
+    return ring.data() + (i * frame_bytes);
+}
+
+void LearnedDetector::push(const AVFrame* frame) {
+    // a frame that cannot be converted repeats the last one, so every
+    // frame still gets a probability
+    (void)thumbnailer.make(frame, thumb);
+    push(thumb);
+}
+
+void LearnedDetector::push(const Thumbnail& t) {
+    const int w = model.width;
+    const int h = model.height;
+    const auto pixels = static_cast<size_t>(w) * h;
+    if (pushed == 0) {
+        front = -model.context;
+        stored = front;
+    }
+
+    uint8_t* dst = slot(stored);
+    if (t.width == 0) {
+        std::fill_n(dst, frame_bytes, input_zero_point);
+    } else {
+        for (int p = 0; p < 3; p++) {
+            box_downscale(t.plane(p), planes.data() + (p * pixels), w, h);
+        }
+        for (size_t i = 0; i < pixels; i++) {
+            for (size_t p = 0; p < 3; p++) {
+                dst[(3 * i) + p] = planes[(p * pixels) + i] >> 1;
+            }
+        }
+    }
+    stored++;
+    // the start is padded with copies of the first frame
+    while (pushed == 0 && stored <= 0) {
+        std::copy_n(dst, frame_bytes, slot(stored));
+        stored++;
+    }
+    pushed++;
+
+    if (stored == predicted + (batch_windows * stride) + model.context) {
+        run_batch();
+    }
+}
+
+std::optional<float> LearnedDetector::pop() {
+    if (ready.empty()) {
+        return std::nullopt;
+    }
+    float p = ready.front();
+    ready.pop_front();
+    return p;
+}
+
+void LearnedDetector::flush() {
+    // the end is padded with copies of the last frame
+    while (predicted < pushed) {
+        while (stored < predicted + (batch_windows * stride) + model.context) {
+            std::copy_n(slot(stored - 1), frame_bytes, slot(stored));
+            stored++;
+        }
+        run_batch();
+    }
+}
+
+void LearnedDetector::run_batch() {
+    const int window = model.window;
+    for (int b = 0; b < batch_windows; b++) {
+        const int64_t first = predicted + (b * stride) - model.context;
+        for (int t = 0; t < window; t++) {
+            std::copy_n(slot(first + t), frame_bytes,
+                        act_a.data() + (static_cast<size_t>(
+                                            (b * window) + t) *
+                                        frame_bytes));
+        }
+    }
+
+    channels = 3;
+    height = model.height;
+    width = model.width;
+    uint8_t* in = act_a.data();
+    uint8_t* out = act_b.data();
+    for (const auto& layer : model.layers) {
+        switch (layer.type) {
+        case ShotLayerType::Conv3d:
+            conv(layer, in, out);
+            channels = layer.out_channels;
+            break;
+        case ShotLayerType::Pool:
+            pool(in, out);
+            height /= 2;
+            width /= 2;
+            break;
+        case ShotLayerType::Dense:
+            dense(layer, in, out, nullptr);
+            channels = layer.out_channels;
+            height = 1;
+            width = 1;
+            break;
+        case ShotLayerType::Output:
+            dense(layer, in, nullptr, logits.data());
+            break;
+        }
+        std::swap(in, out);
+    }
+
+    for (int b = 0; b < batch_windows; b++) {
+        for (int t = model.context; t < model.context + stride; t++) {
+            const int64_t frame = predicted + (b * stride) + t - model.context;
+            if (frame < pushed) {
+                const float logit = logits[(b * window) + t];
+                ready.push_back(1.0F / (1.0F + std::exp(-logit)));
+            }
+        }
+    }
+    predicted += static_cast<int64_t>(batch_windows) * stride;
+    front = predicted - model.context;
+}
+
+void LearnedDetector::conv(const ShotLayer& layer, const uint8_t* in,
+                           uint8_t* out) {
+    const int window = model.window;
+    const int c = channels;
+    const int plane = height * width;
+    const int positions = batch_windows * window * plane;
+    const int half_t = layer.kernel_t / 2;
+    const int half_h = layer.kernel_h / 2;
+    const int half_w = layer.kernel_w / 2;
+    const int m = layer.out_channels;
+    const auto gemm = kernels().gemm_u8s8;
+
+    for (int p0 = 0; p0 < positions; p0 += block_positions) {
+        const int n = std::min(block_positions, positions - p0);
+        for (int i = 0; i < n; i++) {
+            const int p = p0 + i;
+            const int f = p / plane;
+            const int y = (p % plane) / width;
+            const int x = p % width;
+            // windows are convolved separately: time stops at their ends
+            const int b = f / window;
+            const int t = f % window;
+            uint8_t* row = patches.data() + (static_cast<size_t>(i) *
+                                             layer.depth);
+            uint8_t* dst = row;
+            for (int dt = 0; dt < layer.kernel_t; dt++) {
+                const int tt = t + ((dt - half_t) * layer.dilation);
+                const bool t_in = tt >= 0 && tt < window;
+                const uint8_t* src =
+                    in + (static_cast<size_t>((b * window) + tt) * plane * c);
+                for (int dy = 0; dy < layer.kernel_h; dy++) {
+                    const int yy = y + dy - half_h;
+                    for (int dx = 0; dx < layer.kernel_w; dx++) {
+                        const int xx = x + dx - half_w;
+                        if (t_in && yy >= 0 && yy < height && xx >= 0 &&
+                            xx < width) {
+                            std::copy_n(src + (((yy * width) + xx) * c), c,
+                                        dst);
+                        } else {
+                            std::fill_n(dst, c, layer.zero_point);
+                        }
+                        dst += c;
+                    }
+                }
+            }
+            std::fill(dst, row + layer.depth, 0);
+        }
+
+        gemm(layer.weights.data(), patches.data(), products.data(), m, n,
+             layer.depth);
+        uint8_t* o = out + (static_cast<size_t>(p0) * m);
+        for (int i = 0; i < n * m; i++) {
+            o[i] = requantize(products[i], layer.bias[i % m],
+                              layer.scale[i % m]);
+        }
+    }
+}
+
+void LearnedDetector::pool(const uint8_t* in, uint8_t* out) {
+    const int frames = batch_windows * model.window;
+    const int c = channels;
+    const int oh = height / 2;
+    const int ow = width / 2;
+    const size_t row = static_cast<size_t>(width) * c;
+    for (int f = 0; f < frames; f++) {
+        const uint8_t* src = in + (static_cast<size_t>(f) * height * row);
+        uint8_t* dst = out + (static_cast<size_t>(f) * oh * ow * c);
+        for (int y = 0; y < oh; y++) {
+            const uint8_t* r0 = src + (2 * y * row);
+            const uint8_t* r1 = r0 + row;
+            for (int x = 0; x < ow; x++) {
+                for (int k = 0; k < c; k++) {
+                    const int i = (2 * x * c) + k;
+                    *dst++ = static_cast<uint8_t>(
+                        (r0[i] + r0[i + c] + r1[i] + r1[i + c] + 2) >> 2);
+                }
+            }
+        }
+    }
+}
+
+void LearnedDetector::dense(const ShotLayer& layer, const uint8_t* in,
+                            uint8_t* out, float* logits_out) {
+    const int frames = batch_windows * model.window;
+    const int values = channels * height * width;
+    const int m = layer.out_channels;
+    const auto gemm = kernels().gemm_u8s8;
+    for (int f0 = 0; f0 < frames; f0 += block_positions) {
+        const int n = std::min(block_positions, frames - f0);
+        for (int i = 0; i < n; i++) {
+            uint8_t* row = patches.data() + (static_cast<size_t>(i) *
+                                             layer.depth);
+            std::copy_n(in + (static_cast<size_t>(f0 + i) * values), values,
+                        row);
+            std::fill(row + values, row + layer.depth, 0);
+        }
+
+        gemm(layer.weights.data(), patches.data(), products.data(), m, n,
+             layer.depth);
+        if (logits_out != nullptr) {
+            for (int i = 0; i < n; i++) {
+                logits_out[f0 + i] =
+                    static_cast<float>(products[i] + layer.bias[0]) *
+                    layer.scale[0];
+            }
+            continue;
+        }
+        uint8_t* o = out + (static_cast<size_t>(f0) * m);
+        for (int i = 0; i < n * m; i++) {
+            o[i] = requantize(products[i], layer.bias[i % m],
+                              layer.scale[i % m]);
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "thumbnail.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Learned shot-boundary detector in the style of TransNetV2: dilated 3D
+// convolutions over windows of small frames, a per-frame dense head and
+// one boundary probability per frame. Inference is int8 on the gemm_u8s8
+// kernel; nothing outside this program is needed at run time.
+//
+// Model file (little endian), written by export_model.py:
+//   ShotModelHeader
+//   per layer: ShotLayerHeader, then for every type but Pool
+//     int8_t weights[out][in]   conv: [out][kernel_t][kernel_h][kernel_w][in]
+//     int32_t bias[out]
+//     float scale[out]
+//
+// Activations are bytes in [0, 127]. Frames enter as Y, U and V per pixel,
+// halved, so 64 stands for zero. A layer computes
+//   q = clamp(round((sum of weight * activation + bias) * scale), 0, 127)
+// which includes the ReLU; the Output layer's (sum + bias) * scale is the
+// logit of a boundary at that frame.
+
+inline constexpr char shot_model_magic[8] = {'S', 'D', 'S', 'H',
+                                             'O', 'T', 'N', '1'};
+
+enum class ShotLayerType : uint32_t { Conv3d = 1, Pool = 2, Dense = 3,
+                                      Output = 4 };
+
+struct ShotModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint16_t width;
+    uint16_t height;
+    // frames per window, and frames at each end of a window whose
+    // predictions are not used
+    uint32_t window;
+    uint32_t context;
+    uint32_t layer_count;
+    uint8_t reserved[4];
+};
+static_assert(sizeof(ShotModelHeader) == 32);
+
+struct ShotLayerHeader {
+    uint32_t type;
+    // conv: channels; dense and output: values per frame
+    uint32_t in_channels;
+    uint32_t out_channels;
+    // conv only; the kernel sizes are odd, dilation applies to time
+    uint8_t kernel_t;
+    uint8_t kernel_h;
+    uint8_t kernel_w;
+    uint8_t dilation;
+    uint8_t reserved[4];
+};
+static_assert(sizeof(ShotLayerHeader) == 20);
+
+struct ShotLayer {
+    ShotLayerType type;
+    int in_channels{0};
+    int out_channels{0};
+    int kernel_t{1};
+    int kernel_h{1};
+    int kernel_w{1};
+    int dilation{1};
+    // in values per output, padded to gemm_depth_align
+    int depth{0};
+    // activation value that stands for zero on the input: 64 up to the
+    // first conv or dense layer, 0 after a ReLU
+    uint8_t zero_point{0};
+    // [out][depth], zero padded
+    std::vector<int8_t> weights;
+    // with the input zero point folded in
+    std::vector<int32_t> bias;
+    std::vector<float> scale;
+};
+
+struct ShotModel {
+    int width{0};
+    int height{0};
+    int window{0};
+    int context{0};
+    std::vector<ShotLayer> layers;
+};
+
+// Reads and checks a model file before decoding starts. Returns 0 or a
+// negative AVERROR.
+int load_shot_model(const char* path);
+
+// The loaded model, if any.
+[[nodiscard]] const ShotModel* shot_model();
+
+// Runs a model over a stream. Frames are downscaled to the model size and
+// kept in a ring; every `batch_windows` windows of new frames the network
+// runs once on all of them, so each GEMM covers several windows. Windows
+// overlap by 2 x context frames and the stream's ends are padded with
+// copies of the first and last frame. A probability is ready about
+// batch_windows x (window - 2 x context) + context frames after its frame.
+class LearnedDetector {
+  public:
+    static constexpr int batch_windows = 4;
+    // probability at which a frame starts a new shot
+    static constexpr float cut_probability = 0.5F;
+
+    explicit LearnedDetector(const ShotModel& model);
+
+    void push(const AVFrame* frame);
+    // a thumbnail of any size, e.g. replayed from a thumbnail store
+    void push(const Thumbnail& thumb);
+
+    // Boundary probability of the oldest frame not handed out yet.
+    [[nodiscard]] std::optional<float> pop();
+
+    // End of stream: the remaining frames are predicted.
+    void flush();
+
+  private:
+    [[nodiscard]] uint8_t* slot(int64_t frame);
+    void run_batch();
+    void conv(const ShotLayer& layer, const uint8_t* in, uint8_t* out);
+    void pool(const uint8_t* in, uint8_t* out);
+    // dense and output layers, which see each frame as one vector
+    void dense(const ShotLayer& layer, const uint8_t* in, uint8_t* out,
+               float* logits);
+
+    const ShotModel& model;
+    Thumbnailer thumbnailer;
+    Thumbnail thumb;
+    // Y, U and V at the model size, before they are interleaved
+    std::vector<uint8_t> planes;
+    int frame_bytes;
+    // new frames per window
+    int stride;
+    // frames [front, stored) of the stream, ring indexed
+    std::vector<uint8_t> ring;
+    int64_t ring_frames;
+    int64_t front{0};
+    int64_t stored{0};
+    // real frames pushed, and frames with a probability so far
+    int64_t pushed{0};
+    int64_t predicted{0};
+    std::deque<float> ready;
+
+    // shape of the activations between layers, per frame
+    int channels{0};
+    int height{0};
+    int width{0};
+    std::vector<uint8_t> act_a;
+    std::vector<uint8_t> act_b;
+    // im2col rows of one block of positions, and their products
+    std::vector<uint8_t> patches;
+    std::vector<int32_t> products;
+    std::vector<float> logits;
+};
@@ -0,0 +1,485 @@
+#include "machine_profile.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "decoder_tuning.h"
+#include "thumbnail.h"
+#include "util.h"
+#include "work_queue.h"
+
+namespace {
+
+constexpr int trial_packets = 240;
+
+// A setting may give up this much throughput to save threads or memory,
+// which pays off when several jobs share the machine.
+constexpr double thread_tolerance = 0.9;
+constexpr double queue_tolerance = 0.97;
+
+constexpr int queue_depths[] = {8, 16, 32, 64, 128};
+
+// thumbnailing may take this share of the time it takes to decode a frame
+constexpr double thumb_budget = 0.05;
+constexpr int thumb_widths[] = {64, 96, 128, 192, 256};
+constexpr size_t kept_frames = 16;
+
+MachineProfile current;
+
+void make_dir(const char* dir) {
+#ifdef _WIN32
+    (void)mkdir(dir);
+#else
+    (void)mkdir(dir, 0755);
+#endif
+}
+
+// profile lines: "set <machine> <name> <value>"
+std::string setting_prefix(const std::string& machine) {
+    return "set " + machine + " ";
+}
+
+const char* thread_type_name(int type) {
+    return type == FF_THREAD_SLICE ? "slice" : "frame";
+}
+
+void apply_setting(MachineProfile& p, std::string_view name,
+                   std::string_view value) {
+    const std::string v(value);
+    if (name == "threads") {
+        p.decoder_threads = std::max(0, atoi(v.c_str()));
+    } else if (name == "thread-type") {
+        p.thread_type = value == "slice"   ? FF_THREAD_SLICE
+                        : value == "frame" ? FF_THREAD_FRAME
+                                           : 0;
+    } else if (name == "queue-depth") {
+        p.queue_depth = std::max(0, atoi(v.c_str()));
+    } else if (name == "thumb-width") {
+        p.thumb_width = std::clamp(atoi(v.c_str()), 0, 4096) & ~1;
+    } else if (name.starts_with("kernel-")) {
+        name.remove_prefix(7);
+        for (size_t k = 0; k < kernel_count; k++) {
+            if (name != kernel_names[k]) {
+                continue;
+            }
+            for (size_t i = 0; i < std::size(simd_level_names); i++) {
+                if (value == simd_level_names[i]) {
+                    p.kernels[k] = static_cast<SimdLevel>(i);
+                }
+            }
+        }
+    }
+}
+
+void append_kernel_lines(std::vector<std::string>& lines,
+                         const std::string& prefix, const MachineProfile& p) {
+    for (size_t k = 0; k < kernel_count; k++) {
+        if (p.kernels[k]) {
+            lines.push_back(prefix + "kernel-" + kernel_names[k] + " " +
+                            simd_level_names[static_cast<int>(*p.kernels[k])]);
+        }
+    }
+}
+
+void bind_kernels(MachineProfile& p) {
+    KernelLevels levels = benchmark_kernels();
+    for (size_t k = 0; k < kernel_count; k++) {
+        p.kernels[k] = levels[k];
+    }
+}
+
+void free_frames(std::vector<AVFrame*>& frames) {
+    for (auto*& f : frames) {
+        av_frame_free(&f);
+    }
+    frames.clear();
+}
+
+// Frames per second with a demuxer thread feeding the decoder through a
+// queue of `depth` packets, the way run_demux_pass() does. Unlike
+// time_decoder() this includes reading the input.
+double time_queue(const char* url, const AVCodec* codec,
+                  const MachineProfile& p, size_t depth) {
+    auto input = TrialInput::open(url);
+    if (!input) {
+        return -1.0;
+    }
+
+    AVCodecContext* dec = avcodec_alloc_context3(codec);
+    AVFrame* frame = av_frame_alloc();
+    auto cleanup = [&] {
+        av_frame_free(&frame);
+        avcodec_free_context(&dec);
+    };
+    if (dec == nullptr || frame == nullptr ||
+        avcodec_parameters_to_context(dec, input->codecpar()) < 0) {
+        cleanup();
+        return -1.0;
+    }
+    dec->thread_count = p.decoder_threads;
+    if (p.thread_type != 0) {
+        dec->thread_type = p.thread_type;
+    }
+    if (avcodec_open2(dec, codec, nullptr) < 0) {
+        cleanup();
+        return -1.0;
+    }
+
+    auto start = now();
+    WorkQueue<AVPacket*> queue(depth);
+    std::thread reader([&] {
+        for (int n = 0; n < trial_packets; n++) {
+            AVPacket* pkt = av_packet_alloc();
+            if (pkt == nullptr || input->read_packet(pkt) < 0) {
+                av_packet_free(&pkt);
+                break;
+            }
+            queue.push(pkt);
+        }
+        queue.close();
+    });
+
+    int64_t frames = 0;
+    auto drain = [&] {
+        while (avcodec_receive_frame(dec, frame) >= 0) {
+            frames++;
+            av_frame_unref(frame);
+        }
+    };
+    while (auto pkt = queue.pop()) {
+        avcodec_send_packet(dec, *pkt);
+        av_packet_free(&*pkt);
+        drain();
+    }
+    avcodec_send_packet(dec, nullptr);
+    drain();
+    reader.join();
+    auto elapsed_us = since<std::chrono::microseconds>(start).count();
+
+    cleanup();
+    if (frames == 0) {
+        return -1.0;
+    }
+    return static_cast<double>(frames) * 1e6 /
+           static_cast<double>(std::max<int64_t>(elapsed_us, 1));
+}
+
+// Microseconds per frame for `fn` over `frames`, best of a few rounds.
+template <typename Fn>
+double time_per_frame(const std::vector<AVFrame*>& frames, Fn&& fn) {
+    double best = 0.0;
+    for (int round = 0; round < 3; round++) {
+        auto start = now();
+        for (size_t i = 0; i < frames.size(); i++) {
+            fn(i);
+        }
+        double us =
+            static_cast<double>(
+                since<std::chrono::microseconds>(start).count()) /
+            static_cast<double>(frames.size());
+        best = round == 0 ? us : std::min(best, us);
+    }
+    return best;
+}
+
+} // namespace
+
+const MachineProfile& machine_profile() { return current; }
+
+std::string machine_id() {
+    std::string model;
+    if (FILE* file = fopen("/proc/cpuinfo", "r")) {
+        std::array<char, 512> buf{};
+        while (fgets(buf.data(), static_cast<int>(buf.size()), file) !=
+               nullptr) {
+            if (strncmp(buf.data(), "model name", 10) == 0) {
+                const char* colon = strchr(buf.data(), ':');
+                if (colon != nullptr) {
+                    model = colon + 1;
+                }
+                break;
+            }
+        }
+        (void)fclose(file);
+    }
+
+    // one token, so it can sit in a space separated profile line
+    std::string id;
+    for (char c : model) {
+        if (isalnum(static_cast<unsigned char>(c)) != 0) {
+            id += c;
+        } else if (!id.empty() && id.back() != '_') {
+            id += '_';
+        }
+    }
+    while (!id.empty() && id.back() == '_') {
+        id.pop_back();
+    }
+    if (id.empty()) {
+        id = "unknown";
+    }
+    return id + "-" + std::to_string(std::thread::hardware_concurrency()) +
+           "t";
+}
+
+std::vector<std::string> read_profile(const char* path) {
+    std::vector<std::string> lines;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return lines;
+    }
+    std::array<char, 512> buf{};
+    while (fgets(buf.data(), static_cast<int>(buf.size()), file) != nullptr) {
+        std::string line(buf.data());
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            lines.push_back(std::move(line));
+        }
+    }
+    (void)fclose(file);
+    return lines;
+}
+
+int write_profile(const char* path, const std::vector<std::string>& lines) {
+    std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    FILE* file = fopen(tmp.c_str(), "w");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+    for (const auto& line : lines) {
+        (void)fprintf(file, "%s\n", line.c_str());
+    }
+    if (fclose(file) != 0) {
+        (void)remove(tmp.c_str());
+        return AVERROR(EIO);
+    }
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    (void)remove(path);
+#endif
+    if (rename(tmp.c_str(), path) != 0) {
+        int ret = AVERROR(errno);
+        (void)remove(tmp.c_str());
+        return ret;
+    }
+    return 0;
+}
+
+int resolved_thumb_width(const Options& opts) {
+    if (opts.thumb_width > 0) {
+        return opts.thumb_width;
+    }
+    return current.thumb_width > 0 ? current.thumb_width
+                                   : default_thumb_width;
+}
+
+std::string kernel_cache_path() {
+    std::string dir;
+#ifdef _WIN32
+    if (const char* local = getenv("LOCALAPPDATA")) {
+        dir = local;
+    }
+#else
+    if (const char* cache = getenv("XDG_CACHE_HOME"); cache && *cache) {
+        dir = cache;
+    } else if (const char* home = getenv("HOME"); home && *home) {
+        dir = std::string(home) + "/.cache";
+    }
+#endif
+    if (dir.empty()) {
+        return {};
+    }
+    dir += "/scenedetect-cpp";
+
+    // mkdir fails harmlessly on existing levels; a real failure shows up
+    // when the profile is written
+    for (size_t slash = dir.find('/', 1); slash != std::string::npos;
+         slash = dir.find('/', slash + 1)) {
+        make_dir(dir.substr(0, slash).c_str());
+    }
+    make_dir(dir.c_str());
+    return dir + "/kernels";
+}
+
+int load_machine_profile(const char* path) {
+    const std::string prefix = setting_prefix(machine_id());
+    MachineProfile p;
+    std::vector<std::string> lines = read_profile(path);
+    for (const auto& line : lines) {
+        if (!line.starts_with(prefix)) {
+            continue;
+        }
+        std::string_view rest(line);
+        rest.remove_prefix(prefix.size());
+        size_t space = rest.find(' ');
+        if (space != std::string_view::npos) {
+            apply_setting(p, rest.substr(0, space), rest.substr(space + 1));
+        }
+    }
+
+    bool complete = true;
+    for (size_t k = 0; k < kernel_count; k++) {
+        if (p.kernels[k]) {
+            bind_kernel(static_cast<KernelId>(k), *p.kernels[k]);
+        } else {
+            complete = false;
+        }
+    }
+    current = p;
+    if (complete) {
+        return 0;
+    }
+
+    // first run on this machine: time the kernels once and keep the result
+    bind_kernels(current);
+    std::erase_if(lines, [&](const std::string& l) {
+        return l.starts_with(prefix + "kernel-");
+    });
+    append_kernel_lines(lines, prefix, current);
+    return write_profile(path, lines);
+}
+
+int calibrate_machine(const char* url, const char* path) {
+    auto input = TrialInput::open(url);
+    if (!input) {
+        return AVERROR_INVALIDDATA;
+    }
+    int ret = input->read_packets(trial_packets);
+    if (ret < 0) {
+        return ret;
+    }
+    const AVCodec* codec = find_video_decoder(input->codecpar());
+    if (codec == nullptr) {
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    MachineProfile p;
+
+    // decoder threads and threading type: the fewest threads within
+    // thread_tolerance of the best throughput
+    std::vector<int> types;
+    if ((codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) != 0) {
+        types.push_back(FF_THREAD_FRAME);
+    }
+    if ((codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) != 0) {
+        types.push_back(FF_THREAD_SLICE);
+    }
+    const int cores =
+        static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    std::vector<int> counts;
+    for (int t = 1; t < cores; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(cores);
+
+    struct ThreadTrial {
+        int threads;
+        int type;
+        double fps;
+    };
+    std::vector<ThreadTrial> trials;
+    double best_fps = 0.0;
+    if (types.empty()) {
+        double fps = time_decoder(*input, codec, 1);
+        trials.push_back(ThreadTrial{.threads = 1, .type = 0, .fps = fps});
+        best_fps = fps;
+    }
+    for (int type : types) {
+        for (int t : counts) {
+            double fps = time_decoder(*input, codec, t, type);
+            printf("  %2d %s threads: %.1f fps\n", t, thread_type_name(type),
+                   fps);
+            trials.push_back(
+                ThreadTrial{.threads = t, .type = type, .fps = fps});
+            best_fps = std::max(best_fps, fps);
+        }
+    }
+    if (best_fps <= 0.0) {
+        return AVERROR_INVALIDDATA;
+    }
+    const ThreadTrial* pick = nullptr;
+    for (const auto& t : trials) {
+        if (t.fps < thread_tolerance * best_fps) {
+            continue;
+        }
+        if (pick == nullptr || t.threads < pick->threads ||
+            (t.threads == pick->threads && t.fps > pick->fps)) {
+            pick = &t;
+        }
+    }
+    p.decoder_threads = pick->threads;
+    p.thread_type = pick->type;
+    const double decode_us = 1e6 / pick->fps;
+
+    // queue depth: the smallest within queue_tolerance of the best
+    std::vector<std::pair<int, double>> depth_fps;
+    double best_depth_fps = 0.0;
+    for (int depth : queue_depths) {
+        double fps = time_queue(url, codec, p, depth);
+        printf("  queue depth %3d: %.1f fps\n", depth, fps);
+        depth_fps.emplace_back(depth, fps);
+        best_depth_fps = std::max(best_depth_fps, fps);
+    }
+    for (auto [depth, fps] : depth_fps) {
+        if (fps >= queue_tolerance * best_depth_fps) {
+            p.queue_depth = depth;
+            break;
+        }
+    }
+
+    // kernels first, so the thumbnail trial runs on the chosen variants
+    bind_kernels(p);
+    for (size_t k = 0; k < kernel_count; k++) {
+        printf("  %s kernel: %s\n", kernel_names[k],
+               simd_level_names[static_cast<int>(*p.kernels[k])]);
+    }
+
+    // thumbnail width is measured on real frames
+    std::vector<AVFrame*> frames;
+    time_decoder(*input, codec, p.decoder_threads, p.thread_type, &frames,
+                 kept_frames);
+    Thumbnail probe;
+    if (!frames.empty() &&
+        Thumbnailer(thumb_widths[0]).make(frames[0], probe)) {
+        p.thumb_width = thumb_widths[0];
+        for (int w : thumb_widths) {
+            Thumbnailer thumbnailer(w);
+            Thumbnail thumb;
+            double us = time_per_frame(
+                frames, [&](size_t i) { thumbnailer.make(frames[i], thumb); });
+            printf("  thumbnail width %3d: %.1f us/frame\n", w, us);
+            if (us <= thumb_budget * decode_us) {
+                p.thumb_width = w;
+            }
+        }
+    }
+    free_frames(frames);
+
+    const std::string prefix = setting_prefix(machine_id());
+    std::vector<std::string> lines = read_profile(path);
+    std::erase_if(lines,
+                  [&](const std::string& l) { return l.starts_with(prefix); });
+    lines.push_back(prefix + "threads " + std::to_string(p.decoder_threads));
+    if (p.thread_type != 0) {
+        lines.push_back(prefix + "thread-type " +
+                        thread_type_name(p.thread_type));
+    }
+    lines.push_back(prefix + "queue-depth " + std::to_string(p.queue_depth));
+    if (p.thumb_width != 0) {
+        lines.push_back(prefix + "thumb-width " +
+                        std::to_string(p.thumb_width));
+    }
+    append_kernel_lines(lines, prefix, p);
+
+    current = p;
+    return write_profile(path, lines);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+#include "options.h"
+
+// Settings --calibrate picks for one machine. Zero fields keep the built-in
+// defaults.
+struct MachineProfile {
+    int decoder_threads{0};
+    // FF_THREAD_FRAME or FF_THREAD_SLICE
+    int thread_type{0};
+    // packets buffered per stream between the demuxer and its decoder
+    int queue_depth{0};
+    // thumbnail width when --thumb-width is not given
+    int thumb_width{0};
+    // variant per analysis kernel, indexed by KernelId
+    std::array<std::optional<SimdLevel>, kernel_count> kernels{};
+};
+
+// The profile loaded at startup; all defaults if there is none.
+[[nodiscard]] const MachineProfile& machine_profile();
+
+// Thumbnail width of a run: --thumb-width, else the profile's, else the
+// default.
+[[nodiscard]] int resolved_thumb_width(const Options& opts);
+
+// Loads this machine's settings from `path` and binds the analysis kernels.
+// Kernels without an entry are benchmarked and the result is added to the
+// profile. A missing file, other machines' entries and unknown lines are
+// ignored. Returns 0 or a negative AVERROR if the profile cannot be updated.
+int load_machine_profile(const char* path);
+
+// Per-user profile that keeps the kernel choices of runs without a profile,
+// so the benchmark runs once per machine: scenedetect-cpp/kernels under
+// $XDG_CACHE_HOME, ~/.cache or %LOCALAPPDATA%. Creates the directories.
+// Empty if there is no such place.
+[[nodiscard]] std::string kernel_cache_path();
+
+// Runs short trials on the start of `url` to choose every MachineProfile
+// setting, stores them for this machine in `path` and makes them current.
+// Returns 0 or a negative AVERROR.
+int calibrate_machine(const char* url, const char* path);
+
+// CPU model and thread count as one token. Profile entries carry it, so a
+// profile shared between machines keeps separate settings per machine.
+[[nodiscard]] std::string machine_id();
+
+// Profile files are plain text, one entry per line. Returns no lines if the
+// file does not exist.
+[[nodiscard]] std::vector<std::string> read_profile(const char* path);
+
+// Replaces the profile at once, so concurrent readers see either version.
+// Returns 0 or a negative AVERROR.
+int write_profile(const char* path, const std::vector<std::string>& lines);
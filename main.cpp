@@ -1,16 +1,41 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cerrno>
-#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 #include <utility>
 #include <variant>
+#include <vector>
+
+#include "audio_levels.h"
+#include "decode.h"
+#include "decoder_tuning.h"
+#include "detect.h"
+#include "image_seq.h"
+#include "intra_decode.h"
+#include "keyframes.h"
+#include "kernels.h"
+#include "learned.h"
+#include "machine_profile.h"
+#include "mask.h"
+#include "multi_stream.h"
+#include "options.h"
+#include "pipeline.h"
+#include "result_cache.h"
+#include "segments.h"
+#include "signature_index.h"
+#include "thumb_store.h"
+#include "util.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -24,335 +49,478 @@ extern "C" {
 
 namespace {
 
-#define AlwaysInline __attribute__((always_inline)) inline
-
-AlwaysInline void w_stdout(std::string_view sv) {
-    write(STDOUT_FILENO, sv.data(), sv.size());
-}
-AlwaysInline void w_stderr(std::string_view sv) {
-    write(STDERR_FILENO, sv.data(), sv.size());
-}
+// Replays a thumbnail store through the detectors. Returns the number of
+// thumbnails, or -1 if the store is damaged.
+int64_t run_thumb_store(const ThumbStoreReader& store, Pipeline& pipeline) {
+    std::vector<uint8_t> frames;
+    std::vector<int64_t> pts;
+    Thumbnail thumb;
+    thumb.resize(store.width(), store.height());
+    const size_t frame_bytes = thumb.data.size();
+
+    int64_t frame_idx = 0;
+    for (size_t c = 0; c < store.chunk_count(); c++) {
+        if (!store.read_chunk(c, frames, pts)) {
+            return -1;
+        }
+        for (size_t i = 0; i < pts.size(); i++) {
+            const uint8_t* src = frames.data() + (i * frame_bytes);
+            thumb.data.assign(src, src + frame_bytes);
+            pipeline.push_thumbnail(thumb, frame_idx++, pts[i]);
+        }
+    }
 
-template <typename T, auto Alloc, auto Free> auto make_managed() {
-    return std::unique_ptr<T, decltype([](T* ptr) { Free(&ptr); })>(Alloc());
+    return frame_idx;
 }
 
-struct DecoderCreationError {
-    enum DCErrorType : uint8_t {
-        AllocationFailure,
-        NoVideoStream,
-        NoDecoderAvailable,
-        AVError
-    } type;
-    int averror = 0;
-
-    [[nodiscard]] constexpr std::string_view errmsg() const {
-        static constexpr std::string_view errmsg_sv[] = {
-            [AllocationFailure] = "Allocation Failure in decoder construction",
-            [NoVideoStream] = "No video stream exists in input file",
-            [NoDecoderAvailable] = "No decoder available for codec",
-            [AVError] = "Unspecified AVError occurred",
-        };
-
-        return errmsg_sv[this->type];
-    }
+struct DecodeContextResult {
+    // This will just have nullptr fields
+    DecodeContext dc;
+    // if err.averror was non
+    DecoderCreationError err;
 };
 
-using FrameBuf = std::array<AVFrame*, 2>;
-
-struct DecodeContext {
-    // these fields can be null
-    AVFormatContext* demuxer{nullptr};
-    AVStream* stream{nullptr};
-    AVCodecContext* decoder{nullptr};
+// so it seems like you have to call
+// unref before you reuse AVPacket or AVFrame
 
-    AVPacket* pkt{nullptr};
-    FrameBuf framebuf{};
+void segvHandler(int /*unused*/) {
+    w_stderr("Segmentation Fault\n");
+    exit(EXIT_FAILURE); // NOLINT
+}
 
-    constexpr DecodeContext() = default;
+void print_scenes(const std::vector<int64_t>& cuts, int64_t frames) {
+    printf("Detected %zu scenes\n", cuts.size() + 1);
 
-    // move constructor
-    DecodeContext(DecodeContext&& source) = delete;
+    int64_t start = 0;
+    for (size_t i = 0; i <= cuts.size(); i++) {
+        int64_t end = i < cuts.size() ? cuts[i] : frames;
+        printf("  Scene %zu: frames %lld-%lld\n", i + 1,
+               static_cast<long long>(start), static_cast<long long>(end - 1));
+        start = end;
+    }
+}
 
-    // copy constructor
-    DecodeContext(DecodeContext&) = delete;
+// Outputs computed from the pixels of every frame, which neither a cached
+// result nor segment-parallel scores carry.
+bool needs_frame_pixels(const Options& opts) {
+    return opts.scene_image != ScenePick::None || opts.thumbs_path != nullptr ||
+           opts.scene_stats != nullptr || opts.signatures != nullptr ||
+           opts.reuse_index != nullptr || opts.clusters != nullptr ||
+           opts.metrics != nullptr;
+}
 
-    // copy assignment operator
-    DecodeContext& operator=(const DecodeContext&) = delete;
-    // move assignment operator
-    DecodeContext& operator=(const DecodeContext&&) = delete;
+// Outputs that mark the cuts as they are decided, before --audio confirm
+// can drop any of them.
+bool writes_cuts_early(const Options& opts) {
+    return opts.scene_image != ScenePick::None || opts.scene_stats != nullptr ||
+           opts.signatures != nullptr || opts.reuse_index != nullptr ||
+           opts.clusters != nullptr || opts.metrics != nullptr;
+}
 
-    constexpr ~DecodeContext() {
-        // Since we deleted all the copy/move constructors,
-        // we can do this without handling a "moved from" case.
+// Returns false if the keyframes file could not be written.
+[[nodiscard]] bool report_results(const Options& opts,
+                                  const DetectionResult& result) {
+    print_scenes(result.cuts.frames, result.frames);
 
-        for (auto* f : framebuf) {
-            av_frame_free(&f);
+    if (opts.keyframes_path != nullptr) {
+        int ret = write_keyframes(opts.keyframes_path, opts.keyframes_format,
+                                  result.cuts);
+        if (ret < 0) {
+            print_averror("Failed to write", opts.keyframes_path, ret);
+            return false;
         }
-
-        av_packet_free(&pkt);
-        avcodec_free_context(&decoder);
-        avformat_close_input(&demuxer);
     }
+    return true;
+}
 
-    DecodeContext(AVFormatContext* demuxer_, AVStream* stream_,
-                  AVCodecContext* decoder_, AVPacket* pkt_, FrameBuf frame_)
-        : demuxer(demuxer_), stream(stream_), decoder(decoder_), pkt(pkt_),
-          framebuf(frame_) {}
-
-    [[nodiscard]] static std::variant<DecodeContext, DecoderCreationError>
-    open(const char* url) {
-        auto pkt = make_managed<AVPacket, av_packet_alloc, av_packet_free>();
-        auto frame1 = make_managed<AVFrame, av_frame_alloc, av_frame_free>();
-        auto frame2 = make_managed<AVFrame, av_frame_alloc, av_frame_free>();
-
-        // this should work with the way smart pointers work right?
-        if ((pkt == nullptr) || (frame1 == nullptr) || (frame2 == nullptr)) {
-            return DecoderCreationError{
-                .type = DecoderCreationError::AllocationFailure};
+// Returns false if the keyframes file or the cache could not be written.
+[[nodiscard]] bool report_and_cache(const Options& opts,
+                                    const std::string& cache_key,
+                                    const DetectionResult& result) {
+    bool ok = report_results(opts, result);
+
+    if (!cache_key.empty()) {
+        int err = store_cached_result(opts.cache_dir, cache_key, result);
+        if (err < 0) {
+            print_averror("Failed to update cache in", opts.cache_dir, err);
+            ok = false;
         }
+    }
+    return ok;
+}
 
-        AVFormatContext* raw_demuxer = nullptr;
-
-        // avformat_open_input automatically frees on failure so we construct
-        // the smart pointer AFTER this expression.
-        {
-            int ret = avformat_open_input(&raw_demuxer, url, nullptr, nullptr);
-            if (ret < 0) {
-                return {DecoderCreationError{
-                    .type = DecoderCreationError::AVError, .averror = ret}};
-            }
+// Per-stream copy of the options. With --streams the output paths carry the
+// stream index.
+struct StreamRun {
+    int index;
+    Options opts;
+    std::string image_prefix;
+    std::string keyframes_path;
+    std::string thumbs_path;
+    std::string scene_stats_path;
+    std::string signatures_path;
+    std::string clusters_path;
+    std::string metrics_path;
+    std::unique_ptr<VideoStreamAnalyzer> analyzer;
+
+    StreamRun(int idx, const Options& base) : index(idx), opts(base) {
+        if (!base.all_streams && base.streams.empty()) {
+            return;
         }
-
-        assert(raw_demuxer != nullptr);
-        auto demuxer =
-            std::unique_ptr<AVFormatContext, decltype([](AVFormatContext* ctx) {
-                                avformat_close_input(&ctx);
-                            })>(raw_demuxer);
-
-        avformat_find_stream_info(demuxer.get(), nullptr);
-
-        // find stream idx of video stream
-        int stream_idx = [](AVFormatContext* demuxer) {
-            for (unsigned int stream_idx = 0; stream_idx < demuxer->nb_streams;
-                 stream_idx++) {
-                if (demuxer->streams[stream_idx]->codecpar->codec_type ==
-                    AVMEDIA_TYPE_VIDEO) {
-                    return static_cast<int>(stream_idx);
-                }
-            }
-            return -1;
-        }(demuxer.get());
-
-        if (stream_idx < 0) {
-            return {DecoderCreationError{
-                .type = DecoderCreationError::NoVideoStream,
-            }};
+        image_prefix = "scene-s" + std::to_string(idx) + "-";
+        opts.image_prefix = image_prefix.c_str();
+        if (base.keyframes_path != nullptr) {
+            keyframes_path = stream_output_path(base.keyframes_path, idx);
+            opts.keyframes_path = keyframes_path.c_str();
         }
-
-        // index is stored in AVStream->index
-        auto* stream = demuxer->streams[stream_idx];
-
-        const auto* codec = avcodec_find_decoder(stream->codecpar->codec_id);
-        if (codec == nullptr) {
-            return {DecoderCreationError{
-                .type = DecoderCreationError::NoDecoderAvailable,
-            }};
+        if (base.thumbs_path != nullptr) {
+            thumbs_path = stream_output_path(base.thumbs_path, idx);
+            opts.thumbs_path = thumbs_path.c_str();
         }
-
-        auto decoder =
-            std::unique_ptr<AVCodecContext, decltype([](AVCodecContext* ctx) {
-                                avcodec_free_context(&ctx);
-                            })>(avcodec_alloc_context3(codec));
-
-        {
-            int ret =
-                avcodec_parameters_to_context(decoder.get(), stream->codecpar);
-            if (ret < 0) {
-                return {DecoderCreationError{
-                    .type = DecoderCreationError::AVError, .averror = ret}};
-            }
+        if (base.scene_stats != nullptr) {
+            scene_stats_path = stream_output_path(base.scene_stats, idx);
+            opts.scene_stats = scene_stats_path.c_str();
+        }
+        if (base.signatures != nullptr) {
+            signatures_path = stream_output_path(base.signatures, idx);
+            opts.signatures = signatures_path.c_str();
+        }
+        if (base.clusters != nullptr) {
+            clusters_path = stream_output_path(base.clusters, idx);
+            opts.clusters = clusters_path.c_str();
+        }
+        if (base.metrics != nullptr) {
+            metrics_path = stream_output_path(base.metrics, idx);
+            opts.metrics = metrics_path.c_str();
         }
-
-        // set automatic threading
-        decoder->thread_count = 0;
-
-        FrameBuf framebuf{frame1.release(), frame2.release()};
-
-        return std::variant<DecodeContext, DecoderCreationError>{
-            std::in_place_type<DecodeContext>,
-            demuxer.release(),
-            stream,
-            decoder.release(),
-            pkt.release(),
-            framebuf};
     }
 };
 
-// Assumes same dimensions between frames
-uint32_t calc_frame_sad(const uint8_t* __restrict ptr1,
-                        const uint8_t* __restrict ptr2, size_t xsize,
-                        size_t ysize, size_t stride) {
-    uint32_t sum = 0;
-    while (ysize-- != 0) {
-        for (size_t i = 0; i < xsize; i++) {
-            sum += std::abs(static_cast<int32_t>(ptr1[i]) -
-                            static_cast<int32_t>(ptr2[i]));
-        }
-
-        ptr1 += stride;
-        ptr2 += stride;
+void print_silences(const AudioLevels& levels) {
+    auto silences = find_silences(levels);
+    printf("Audio: %zu silences\n", silences.size());
+    for (const auto& s : silences) {
+        printf("  silence %.3f-%.3f s\n", s.start, s.end);
     }
-
-    return sum;
 }
 
-// how do you make a static allocation?
+// Applies --audio to a video stream's result before it is reported.
+void apply_audio(const Options& opts, const AudioLevels& levels,
+                 DetectionResult& result) {
+    if (opts.audio == AudioMode::Confirm) {
+        size_t dropped = drop_unconfirmed_cuts(result.cuts, levels);
+        printf("Audio: dropped %zu cuts without audio support\n", dropped);
+        return;
+    }
 
-// Move cursor up and erase line
-#define ERASE_LINE_ANSI "\x1B[1A\x1B[2K"
+    const double tb = av_q2d(result.cuts.time_base);
+    for (size_t i = 0; i < result.cuts.frames.size(); i++) {
+        double seconds = static_cast<double>(result.cuts.pts[i]) * tb;
+        printf("  cut at frame %lld (%.3f s): %s\n",
+               static_cast<long long>(result.cuts.frames[i]), seconds,
+               audio_confirms_cut(levels, seconds) ? "audio supports"
+                                                   : "no audio support");
+    }
+}
 
-// assume DecodeContext is not in a moved-from state.
-int run_decoder(DecodeContext& dc) {
-    // AVCodecContext allocated with alloc context
-    // previously was allocated with non-NULL codec,
-    // so we can pass NULL here.
-    int ret = avcodec_open2(dc.decoder, nullptr, nullptr);
-    if (ret < 0) [[unlikely]] {
-        return ret;
+// Analyzes the video streams picked by --streams, and the audio for
+// --audio, in a single pass over the input.
+int run_multi_stream(const Options& opts) {
+    AVFormatContext* raw_demuxer = nullptr;
+    int ret = avformat_open_input(&raw_demuxer, opts.url, nullptr, nullptr);
+    if (ret < 0) {
+        print_averror("Failed to open", opts.url, ret);
+        return -1;
+    }
+    auto demuxer =
+        std::unique_ptr<AVFormatContext, decltype([](AVFormatContext* ctx) {
+                            avformat_close_input(&ctx);
+                        })>(raw_demuxer);
+    avformat_find_stream_info(demuxer.get(), nullptr);
+
+    std::vector<int> indices = select_video_streams(demuxer.get(), opts);
+    if (indices.empty()) {
+        (void)fprintf(stderr, "No matching video streams in %s\n", opts.url);
+        return -1;
     }
 
-    // start off with first conceptual frame = 0 index
-    int accessor_offset = 0;
+    // split the cores between the decoders, but use no more than the
+    // calibrated count
+    int threads = static_cast<int>(std::max<size_t>(
+        1, std::thread::hardware_concurrency() / indices.size()));
+    if (machine_profile().decoder_threads > 0) {
+        threads = std::min(threads, machine_profile().decoder_threads);
+    }
 
-    auto get_sad = [](AVFrame* f1, AVFrame* f2) {
-        return calc_frame_sad(f1->data[0], f2->data[0], f1->width, f1->height,
-                              f1->linesize[0]);
-    };
+    std::vector<std::unique_ptr<StreamRun>> runs;
+    std::vector<StreamConsumer*> consumers(demuxer->nb_streams, nullptr);
+    for (int idx : indices) {
+        auto run = std::make_unique<StreamRun>(idx, opts);
+        run->analyzer = std::make_unique<VideoStreamAnalyzer>(
+            demuxer->streams[idx], run->opts);
+        ret = run->analyzer->open(threads);
+        if (ret < 0) {
+            (void)fprintf(stderr, "Stream %d: ", idx);
+            print_averror("Failed to open decoder for", opts.url, ret);
+            return -1;
+        }
+        consumers[idx] = run->analyzer.get();
+        runs.push_back(std::move(run));
+    }
 
-    int last_frame = 0;
+    std::unique_ptr<AudioAnalyzer> audio;
+    if (opts.audio != AudioMode::Off) {
+        int idx = av_find_best_stream(demuxer.get(), AVMEDIA_TYPE_AUDIO, -1,
+                                      indices.front(), nullptr, 0);
+        if (idx >= 0) {
+            audio = std::make_unique<AudioAnalyzer>(demuxer->streams[idx]);
+            ret = audio->open();
+            if (ret < 0) {
+                print_averror("Audio analysis disabled for", opts.url, ret);
+                audio.reset();
+            } else {
+                consumers[idx] = audio.get();
+            }
+        } else {
+            (void)fprintf(stderr, "No audio stream in %s\n", opts.url);
+        }
+    }
 
-    auto receive_frames = [&dc, accessor_offset, get_sad]() mutable {
-        // receive last frames
-        while (true) {
-            // ret = avcodec_receive_frame(dc.decoder, dc.framebuf[0]);
+    auto start = now();
+    ret = run_demux_pass(demuxer.get(), consumers);
+    auto elapsed_ms = since(start).count();
 
-            int ret = avcodec_receive_frame(dc.decoder,
-                                            dc.framebuf[1 ^ accessor_offset]);
+    bool written = true;
+    for (auto& run : runs) {
+        written = run->analyzer->pipeline().finish() && written;
+    }
+    if (ret < 0) {
+        printf("Decoding error! value: %d\n", ret);
+        return -1;
+    }
 
-            if (ret < 0) [[unlikely]] {
-                return ret;
-            }
+    printf("Analyzed %zu video streams%s in %lld ms\n", runs.size(),
+           audio ? " and audio" : "", static_cast<long long>(elapsed_ms));
+    if (audio && opts.audio == AudioMode::Report) {
+        print_silences(audio->levels());
+    }
+    for (auto& run : runs) {
+        int64_t frames = run->analyzer->frames();
+        printf("Stream %d: %lld frames\n", run->index,
+               static_cast<long long>(frames));
+        DetectionResult result = run->analyzer->pipeline().result(frames);
+        if (audio) {
+            apply_audio(opts, audio->levels(), result);
+        }
+        written = report_results(run->opts, result) && written;
+    }
+    return written ? 0 : -1;
+}
 
-            if (dc.decoder->frame_num > 1) [[likely]] {
-                // use adjacent pair of frames
+} // namespace
 
-                // auto s1 = get_sad(dc.framebuf[0 ^ accessor_offset],
-                //                   dc.framebuf[1 ^ accessor_offset]);
+int main(int argc, char** argv) {
+    if (signal(SIGSEGV, segvHandler) == SIG_ERR) {
+        w_stderr(
+            "signal(): failed to set SIGSEGV signal handler, aborting...\n");
+        return -1;
+    }
 
-                // printf("Frame Pair SAD: %d\n", s1);
+    auto parsed = parse_options(argc, argv);
+    if (auto* err = std::get_if<OptionError>(&parsed)) {
+        std::string_view errmsg = err->errmsg();
+        (void)fprintf(stderr, "scenedetect-cpp: %.*s%s%s\n",
+                      (int)errmsg.size(), errmsg.data(),
+                      err->arg != nullptr ? ": " : "",
+                      err->arg != nullptr ? err->arg : "");
+        w_stderr(usage_text);
+        return -1;
+    }
+    const auto& opts = std::get<Options>(parsed);
 
-                av_frame_unref(dc.framebuf[0 ^ accessor_offset]);
-            } else {
-                // no unref needed, second frame is already unref
-                // and first frame is needed next iteration
-            }
+    const char* url = opts.url;
 
-            accessor_offset ^= 1;
+    if (opts.calibrate_path != nullptr) {
+        printf("Calibrating on %s\n", url);
+        int ret = tune_decoder(url, opts.calibrate_path);
+        if (ret >= 0) {
+            ret = calibrate_machine(url, opts.calibrate_path);
         }
-    };
-
-    printf("Received 0 frames so far\n");
+        if (ret < 0) {
+            print_averror("Calibration failed for", url, ret);
+            return -1;
+        }
+        const auto& p = machine_profile();
+        printf("Wrote %s: %d decoder threads, queue depth %d, thumbnail "
+               "width %d\n",
+               opts.calibrate_path, p.decoder_threads, p.queue_depth,
+               p.thumb_width);
+        return 0;
+    }
 
-    while (true) {
-        // Get packet (compressed data) from demuxer
-        int ret = av_read_frame(dc.demuxer, dc.pkt);
-        // EOF in compressed data
-        if (ret < 0) [[unlikely]] {
-            break;
+    if (opts.build_index != nullptr) {
+        int64_t scenes = build_signature_index(url, opts.build_index);
+        if (scenes < 0) {
+            print_averror("Failed to build", opts.build_index,
+                          static_cast<int>(scenes));
+            return -1;
         }
+        printf("Indexed %lld scenes in %s\n", static_cast<long long>(scenes),
+               opts.build_index);
+        return 0;
+    }
 
-        // skip packets other than the ones we're interested in
-        if (dc.pkt->stream_index != dc.stream->index) [[unlikely]] {
-            av_packet_unref(dc.pkt);
-            continue;
+    const char* profile =
+        opts.profile != nullptr ? opts.profile : getenv("SCENEDETECT_PROFILE");
+    if (profile != nullptr) {
+        int ret = load_machine_profile(profile);
+        if (ret >= 0) {
+            ret = tune_decoder(url, profile);
         }
+        if (ret < 0) {
+            print_averror("Failed to update", profile, ret);
+        }
+    } else if (std::string cache = kernel_cache_path(); !cache.empty()) {
+        // only the kernel choices are kept; decoder tuning stays opt-in
+        int ret = load_machine_profile(cache.c_str());
+        if (ret < 0) {
+            print_averror("Failed to update", cache.c_str(), ret);
+        }
+    } else {
+        benchmark_kernels();
+    }
 
-        // Send the compressed data to the decoder
-        ret = avcodec_send_packet(dc.decoder, dc.pkt);
+    if (opts.mask != nullptr && std::string_view(opts.mask) != "auto") {
+        int ret = load_mask_image(opts.mask);
         if (ret < 0) {
-            // Error decoding frame
-            av_packet_unref(dc.pkt);
+            print_averror("Failed to load mask", opts.mask, ret);
+            return -1;
+        }
+    }
+    if (opts.model != nullptr) {
+        int ret = load_shot_model(opts.model);
+        if (ret < 0) {
+            print_averror("Failed to load model", opts.model, ret);
+            return -1;
+        }
+    }
 
-            w_stdout("Error decoding frame!\nError was not EAGAIN\n");
+    if (opts.audio == AudioMode::Confirm && writes_cuts_early(opts)) {
+        (void)fprintf(stderr, "scenedetect-cpp: --audio confirm drops cuts "
+                              "after scene images, statistics, "
+                              "signatures, clusters and metrics are "
+                              "written; use --audio report with those\n");
+        return -1;
+    }
+    if (opts.all_streams || !opts.streams.empty() ||
+        opts.audio != AudioMode::Off) {
+        return run_multi_stream(opts);
+    }
 
-            return ret;
-        } else {
-            av_packet_unref(dc.pkt);
+    // Thumbnails and the scene outputs need the decoded frames, so a cached
+    // result is only good enough when none are requested. It is still
+    // refreshed below.
+    std::string cache_key;
+    if (opts.cache_dir != nullptr) {
+        if (auto fp = fingerprint_file(url)) {
+            cache_key = result_cache_key(*fp, opts);
+        }
+    }
+    if (!cache_key.empty() && !needs_frame_pixels(opts)) {
+        if (auto cached = load_cached_result(opts.cache_dir, cache_key)) {
+            printf("Loaded cached result for %s\n", url);
+            return report_results(opts, *cached) ? 0 : -1;
         }
+    }
 
-        receive_frames();
+    if (auto store = ThumbStoreReader::open(url)) {
+        Pipeline pipeline(opts, store->time_base());
 
-        if (dc.decoder->frame_num - last_frame > 40) {
-            last_frame = (int)dc.decoder->frame_num;
+        auto start = now();
+        int64_t frames = run_thumb_store(*store, pipeline);
+        auto elapsed_ms = since(start).count();
+        const bool written = pipeline.finish();
 
-            printf(ERASE_LINE_ANSI "Received %d frames so far\n", last_frame);
+        if (frames < 0) {
+            (void)fprintf(stderr, "Thumbnail store %s is damaged\n", url);
+            return -1;
         }
-    }
 
-    // send flush packet
-    avcodec_send_packet(dc.decoder, nullptr);
-    receive_frames();
+        printf("Replayed %lld thumbnails in %lld ms\n",
+               static_cast<long long>(frames),
+               static_cast<long long>(elapsed_ms));
 
-    printf(ERASE_LINE_ANSI "Received %d frames so far\n",
-           (int)dc.decoder->frame_num);
+        const bool reported =
+            report_and_cache(opts, cache_key, pipeline.result(frames));
+        return written && reported ? 0 : -1;
+    }
 
-    return 0;
-}
+    if (auto segments = find_segments(url)) {
+        // Scene outputs, thumbnails, the learned detector, the learned
+        // mask and the flash and transition detectors need every decoded
+        // frame in one place. Playlists can still go through the demuxer
+        // for those.
+        bool needs_frames =
+            needs_frame_pixels(opts) || opts.model != nullptr ||
+            opts.flash_window > 0 || opts.transition_frames > 0 ||
+            (opts.mask != nullptr && std::string_view(opts.mask) == "auto");
+        struct stat st {};
+        bool is_dir = stat(url, &st) == 0 && S_ISDIR(st.st_mode);
+
+        if (needs_frames && is_dir) {
+            (void)fprintf(stderr, "scenedetect-cpp: scene outputs, "
+                                  "thumbnails, models, flash filtering, "
+                                  "transitions and --mask auto are not "
+                                  "supported for segment directories\n");
+            return -1;
+        }
 
-struct DecodeContextResult {
-    // This will just have nullptr fields
-    DecodeContext dc;
-    // if err.averror was non
-    DecoderCreationError err;
-};
+        if (!needs_frames) {
+            Pipeline pipeline(opts, AVRational{1, 1});
 
-// so it seems like you have to call
-// unref before you reuse AVPacket or AVFrame
+            auto start = now();
+            int64_t frames =
+                run_segments(*segments, opts.segment_threads, pipeline);
+            auto elapsed_ms = since(start).count();
+            const bool written = pipeline.finish();
 
-void segvHandler(int /*unused*/) {
-    w_stderr("Segmentation Fault\n");
-    exit(EXIT_FAILURE); // NOLINT
-}
+            if (frames < 0) {
+                printf("Decoding error! value: %d\n", static_cast<int>(frames));
+                return -1;
+            }
 
-template <class> inline constexpr bool always_false_v = false;
+            printf("Decoded %lld frames from %zu segments in %lld ms\n",
+                   static_cast<long long>(frames), segments->segments.size(),
+                   static_cast<long long>(elapsed_ms));
 
-template <class result_t = std::chrono::milliseconds,
-          class clock_t = std::chrono::steady_clock,
-          class duration_t = std::chrono::milliseconds>
-auto since(std::chrono::time_point<clock_t, duration_t> const& start) {
-    return std::chrono::duration_cast<result_t>(clock_t::now() - start);
-}
+            const bool reported =
+                report_and_cache(opts, cache_key, pipeline.result(frames));
+            return written && reported ? 0 : -1;
+        }
+    }
 
-auto now() { return std::chrono::steady_clock::now(); }
+    if (auto images = find_image_sequence(url)) {
+        Pipeline pipeline(opts, image_sequence_time_base);
 
-} // namespace
+        auto start = now();
+        int64_t frames =
+            run_image_sequence(*images, pipeline, opts.intra_threads);
+        auto elapsed_ms = since(start).count();
+        const bool written = pipeline.finish();
 
-int main(int argc, char** argv) {
-    if (signal(SIGSEGV, segvHandler) == SIG_ERR) {
-        w_stderr(
-            "signal(): failed to set SIGSEGV signal handler, aborting...\n");
-        return -1;
-    }
+        if (frames < 0) {
+            printf("Decoding error! value: %d\n", static_cast<int>(frames));
+            return -1;
+        }
 
-    if (argc != 2) {
-        w_stderr("scenedetect-cpp: invalid number of arguments\n"
-                 "   usage: scenedetect-cpp  <video_file>\n");
-        return -1;
-    }
+        printf("Decoded %lld images in %lld ms\n",
+               static_cast<long long>(frames),
+               static_cast<long long>(elapsed_ms));
 
-    // can assume argv[1] is now available
-    char* url = argv[1];
+        const bool reported =
+            report_and_cache(opts, cache_key, pipeline.result(frames));
+        return written && reported ? 0 : -1;
+    }
 
     // bro how on earth is the exit code being set to
     // something other than 0???
@@ -364,8 +532,8 @@ int main(int argc, char** argv) {
     // so we should probably find a way to not use things that increase the
     // binary size a lot...
 
-    std::visit(
-        [](auto&& arg) {
+    return std::visit(
+        [&opts, &cache_key](auto&& arg) -> int {
             using T = std::decay_t<decltype(arg)>;
 
             if constexpr (std::is_same_v<T, DecodeContext>) {
@@ -373,12 +541,25 @@ int main(int argc, char** argv) {
 
                 w_stdout("DecodeContext held in std::variant<>\n");
 
+                Pipeline pipeline(opts, d_ctx.stream->time_base);
+
                 auto start = now();
-                int ret = run_decoder(d_ctx);
+                int ret = 0;
+                int64_t frames = 0;
+                if (opts.intra_threads != 1 &&
+                    supports_packet_parallel(d_ctx.stream)) {
+                    frames = run_packet_parallel(d_ctx, pipeline,
+                                                 opts.intra_threads);
+                    ret = frames < 0 ? static_cast<int>(frames) : 0;
+                } else {
+                    ret = run_decoder(d_ctx, pipeline);
+                    frames = d_ctx.decoder->frame_num;
+                }
                 auto elapsed_ms = since(start).count();
 
-                auto frames = d_ctx.decoder->frame_num;
+                const bool written = pipeline.finish();
 
+                bool reported = true;
                 if (ret == 0) {
                     double fps = 1000.0 * (static_cast<double>(frames) /
                                            static_cast<double>(elapsed_ms));
@@ -386,9 +567,14 @@ int main(int argc, char** argv) {
                     printf(
                         "Successfully decoded %d frames in %lld ms (%f fps)\n",
                         (int)frames, elapsed_ms, fps);
+
+                    reported = report_and_cache(opts, cache_key,
+                                                pipeline.result(frames));
                 } else {
                     printf("Decoding error! value: %d\n", ret);
+                    return -1;
                 }
+                return written && reported ? 0 : -1;
 
             } else if constexpr (std::is_same_v<T, DecoderCreationError>) {
                 auto error = arg;
@@ -407,6 +593,7 @@ int main(int argc, char** argv) {
                                   "Failed to initialize decoder: %.*s\n",
                                   (int)errmsg.size(), errmsg.data());
                 }
+                return 0;
 
             } else {
                 static_assert(always_false_v<T>);
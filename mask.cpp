@@ -0,0 +1,268 @@
+#include "mask.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "decode.h"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+namespace {
+
+// mask image pixels at or above this are left out
+constexpr uint8_t excluded_level = 128;
+
+// frames between samples while learning
+constexpr int64_t sample_interval = 10;
+// mean luma difference to the last counted sample for a new one to count;
+// about a scene change
+constexpr uint64_t sample_change = 25;
+// a pixel that moves by more than this has content, not an overlay
+constexpr int pixel_tolerance = 10;
+// counted samples before the mask is built
+constexpr int samples_needed = 6;
+// stop looking after this many frames without enough scene changes
+constexpr int64_t learn_frames = 9000;
+// a larger static area is a still picture or a frame, not an overlay
+constexpr double max_static_fraction = 0.25;
+// isolated static pixels are chance matches and only fragment the spans
+constexpr int min_static_run = 8;
+
+struct MaskImage {
+    int width{0};
+    int height{0};
+    std::vector<uint8_t> gray;
+};
+
+// written by load_mask_image() before decoding starts, read-only afterwards
+std::optional<MaskImage> mask_image;
+
+// Keeps the first decoded frame.
+struct FirstFrame {
+    AVFrame* frame{nullptr};
+
+    void push_frame(const AVFrame* cur, const AVFrame* /*prev*/,
+                    int64_t /*frame_idx*/) {
+        if (frame->format < 0) {
+            (void)av_frame_ref(frame, cur);
+        }
+    }
+};
+
+} // namespace
+
+SpanMask SpanMask::from_excluded(const uint8_t* excluded, int width,
+                                 int height, int min_run) {
+    SpanMask m;
+    m.width = width;
+    m.height = height;
+    m.row_first.reserve(static_cast<size_t>(height) + 1);
+    for (int y = 0; y < height; y++) {
+        m.row_first.push_back(static_cast<uint32_t>(m.spans.size()));
+        const uint8_t* row = excluded + (static_cast<size_t>(y) * width);
+        int start = 0;
+        int x = 0;
+        while (x < width) {
+            if (row[x] == 0) {
+                x++;
+                continue;
+            }
+            int end = x;
+            while (end < width && row[end] != 0) {
+                end++;
+            }
+            if (end - x >= min_run) {
+                if (x > start) {
+                    m.spans.push_back(Span{.x = start, .width = x - start});
+                }
+                start = end;
+            }
+            x = end;
+        }
+        if (width > start) {
+            m.spans.push_back(Span{.x = start, .width = width - start});
+        }
+    }
+    m.row_first.push_back(static_cast<uint32_t>(m.spans.size()));
+
+    for (const auto& s : m.spans) {
+        m.pixels += static_cast<uint64_t>(s.width);
+    }
+    return m;
+}
+
+SpanMask SpanMask::clip(Rect area) const {
+    SpanMask m;
+    m.width = width;
+    m.height = height;
+    m.y = std::max(area.y, y);
+    const int end = std::min(area.y + area.height, y + rows());
+    const int x1 = area.x + area.width;
+    for (int row = m.y; row < end; row++) {
+        m.row_first.push_back(static_cast<uint32_t>(m.spans.size()));
+        for (uint32_t i = row_first[row - y]; i < row_first[row - y + 1];
+             i++) {
+            int s0 = std::max(spans[i].x, area.x);
+            int s1 = std::min(spans[i].x + spans[i].width, x1);
+            if (s1 > s0) {
+                m.spans.push_back(Span{.x = s0, .width = s1 - s0});
+                m.pixels += static_cast<uint64_t>(s1 - s0);
+            }
+        }
+    }
+    m.row_first.push_back(static_cast<uint32_t>(m.spans.size()));
+    return m;
+}
+
+int load_mask_image(const char* path) {
+    auto opened = DecodeContext::open(path);
+    if (auto* err = std::get_if<DecoderCreationError>(&opened)) {
+        return err->type == DecoderCreationError::AVError ? err->averror
+                                                          : AVERROR(EINVAL);
+    }
+    auto& dc = std::get<DecodeContext>(opened);
+
+    auto frame = make_managed<AVFrame, av_frame_alloc, av_frame_free>();
+    if (frame == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+    FirstFrame sink{.frame = frame.get()};
+    int ret = run_decoder(dc, sink, false);
+    if (ret < 0) {
+        return ret;
+    }
+    if (frame->format < 0) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    MaskImage img{
+        .width = frame->width,
+        .height = frame->height,
+        .gray = std::vector<uint8_t>(static_cast<size_t>(frame->width) *
+                                     frame->height),
+    };
+    SwsContext* sws = sws_getContext(
+        frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+        img.width, img.height, AV_PIX_FMT_GRAY8, SWS_POINT, nullptr, nullptr,
+        nullptr);
+    if (sws == nullptr) {
+        return AVERROR(EINVAL);
+    }
+    uint8_t* const dst[4] = {img.gray.data(), nullptr, nullptr, nullptr};
+    const int dst_stride[4] = {img.width, 0, 0, 0};
+    ret = sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst,
+                    dst_stride);
+    sws_freeContext(sws);
+    if (ret <= 0) {
+        return AVERROR(EINVAL);
+    }
+
+    mask_image = std::move(img);
+    return 0;
+}
+
+std::optional<SpanMask> mask_for_size(int width, int height) {
+    if (!mask_image || width <= 0 || height <= 0) {
+        return std::nullopt;
+    }
+
+    // nearest neighbour, so a mask drawn at another resolution still fits
+    const MaskImage& img = *mask_image;
+    std::vector<uint8_t> excluded(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+        const int sy = static_cast<int>(static_cast<int64_t>(y) * img.height /
+                                        height);
+        const uint8_t* src = img.gray.data() + (static_cast<size_t>(sy) *
+                                                img.width);
+        uint8_t* dst = excluded.data() + (static_cast<size_t>(y) * width);
+        for (int x = 0; x < width; x++) {
+            const int sx = static_cast<int>(static_cast<int64_t>(x) *
+                                            img.width / width);
+            dst[x] = src[sx] >= excluded_level ? 1 : 0;
+        }
+    }
+    return SpanMask::from_excluded(excluded.data(), width, height);
+}
+
+void StaticPixelLearner::reset(int w, int h) {
+    width = w;
+    height = h;
+    frames = 0;
+    counted = 0;
+    done = false;
+    prev.clear();
+    changed.assign(static_cast<size_t>(w) * h, 0);
+    learned.reset();
+}
+
+void StaticPixelLearner::push(const AVFrame* frame) {
+    if (frame->width != width || frame->height != height) {
+        reset(frame->width, frame->height);
+    }
+    if (done) {
+        return;
+    }
+    if (frames % sample_interval == 0) {
+        sample(frame);
+    }
+    frames++;
+    if (!done && frames >= learn_frames) {
+        // too few scene changes to tell overlays from a static shot
+        done = true;
+        prev = {};
+        changed = {};
+    }
+}
+
+void StaticPixelLearner::sample(const AVFrame* frame) {
+    const auto pixels = static_cast<size_t>(width) * height;
+    const uint8_t* luma = frame->data[0];
+    const ptrdiff_t stride = frame->linesize[0];
+
+    if (prev.empty()) {
+        prev.resize(pixels);
+        for (int y = 0; y < height; y++) {
+            std::copy_n(luma + (y * stride), width,
+                        prev.data() + (static_cast<size_t>(y) * width));
+        }
+        return;
+    }
+
+    uint64_t sad = kernels().sad(luma, stride, prev.data(), width, width,
+                                 height);
+    if (sad < sample_change * pixels) {
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* src = luma + (y * stride);
+        uint8_t* last = prev.data() + (static_cast<size_t>(y) * width);
+        uint8_t* moved = changed.data() + (static_cast<size_t>(y) * width);
+        for (int x = 0; x < width; x++) {
+            if (std::abs(src[x] - last[x]) > pixel_tolerance) {
+                moved[x] = 1;
+            }
+            last[x] = src[x];
+        }
+    }
+    if (++counted < samples_needed) {
+        return;
+    }
+
+    done = true;
+    // static pixels are the ones that never moved
+    for (auto& c : changed) {
+        c = c == 0 ? 1 : 0;
+    }
+    SpanMask m = SpanMask::from_excluded(changed.data(), width, height,
+                                         min_static_run);
+    if (static_cast<double>(pixels - m.pixels) <=
+            max_static_fraction * static_cast<double>(pixels) &&
+        m.pixels < pixels) {
+        learned = std::move(m);
+    }
+    prev = {};
+    changed = {};
+}
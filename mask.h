@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "crop.h"
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Where the mask of regions left out of scoring comes from: station logos,
+// tickers and burned-in captions would otherwise trigger or hide cuts.
+enum class MaskSource : uint8_t { None, Image, Learned };
+
+// The scored pixels of rows y .. y + row_first.size() - 2 as spans, in the
+// layout Kernels::span_sad reads.
+struct SpanMask {
+    int width{0};
+    int height{0};
+    // first row the spans describe; the rest of the frame is not scored
+    int y{0};
+    std::vector<Span> spans;
+    // spans of row y + i: [row_first[i], row_first[i + 1])
+    std::vector<uint32_t> row_first;
+    // scored pixel count
+    uint64_t pixels{0};
+
+    // Spans of the zero pixels of a width x height map where nonzero means
+    // left out. Left-out runs shorter than `min_run` are scored anyway.
+    [[nodiscard]] static SpanMask from_excluded(const uint8_t* excluded,
+                                                int width, int height,
+                                                int min_run = 1);
+
+    // The part inside `area`.
+    [[nodiscard]] SpanMask clip(Rect area) const;
+
+    [[nodiscard]] int rows() const {
+        return static_cast<int>(row_first.size()) - 1;
+    }
+};
+
+// Loads an image whose light pixels mark regions to leave out and makes it
+// the mask of every stream, scaled to each stream's size. Returns 0 or a
+// negative AVERROR.
+int load_mask_image(const char* path);
+
+// The loaded mask image for a width x height frame, if there is one.
+[[nodiscard]] std::optional<SpanMask> mask_for_size(int width, int height);
+
+// Learns pixels that stay the same across scene changes: logos and other
+// overlays. A sample is taken every few frames and counts only if the
+// picture changed a lot since the last counted one; pixels that did not
+// change in any counted sample are left out. Scrolling tickers are not
+// static and need a mask image.
+class StaticPixelLearner {
+  public:
+    // Feeds one frame of the stream. Only the luma plane is read.
+    void push(const AVFrame* frame);
+
+    // Set once enough scene changes were seen, unless the static area was
+    // too large to be an overlay.
+    [[nodiscard]] const std::optional<SpanMask>& mask() const {
+        return learned;
+    }
+
+  private:
+    void reset(int w, int h);
+    void sample(const AVFrame* frame);
+
+    int width{0};
+    int height{0};
+    int64_t frames{0};
+    int counted{0};
+    bool done{false};
+    // luma of the last counted sample
+    std::vector<uint8_t> prev;
+    // nonzero once the pixel changed between counted samples
+    std::vector<uint8_t> changed;
+    std::optional<SpanMask> learned;
+};
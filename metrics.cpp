@@ -0,0 +1,327 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+constexpr uint32_t metrics_version = 1;
+constexpr uint64_t chunk_alignment = 4096;
+constexpr uint32_t column_alignment = 64;
+// bytes of the longest varint of a 64-bit value
+constexpr uint32_t max_varint = 10;
+
+constexpr size_t col(MetricColumn c) { return static_cast<size_t>(c); }
+
+// bytes per value of a raw column
+constexpr uint32_t raw_width(MetricColumn c) {
+    switch (c) {
+    case MetricColumn::Pts:
+        return sizeof(int64_t);
+    case MetricColumn::Cut:
+        return sizeof(uint8_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+int write_all(FILE* file, const void* data, size_t size) {
+    return fwrite(data, 1, size, file) == size ? 0 : AVERROR(EIO);
+}
+
+} // namespace
+
+MetricsWriter::~MetricsWriter() { (void)close(); }
+
+int MetricsWriter::push(const FrameScore& score, const TileGrid& grid,
+                        bool scene_start) {
+    if (closed) {
+        return AVERROR(EINVAL);
+    }
+    if (file == nullptr) {
+        file = fopen(path, "wb");
+        if (file == nullptr) {
+            return AVERROR(errno);
+        }
+
+        header.version = metrics_version;
+        header.chunk_frames = chunk_frames;
+        header.time_base_num = time_base.num;
+        header.time_base_den = time_base.den;
+        header.column_count = metric_columns;
+        header.encoding[col(MetricColumn::Pts)] = static_cast<uint8_t>(
+            packed ? MetricEncoding::DeltaVarint : MetricEncoding::Raw);
+
+        // placeholder without the magic, so a file cut short by a crash is
+        // not mistaken for a complete one; rewritten by close()
+        int ret = write_all(file, &header, sizeof(header));
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    float mean = NAN;
+    float spread = NAN;
+    float change = NAN;
+    if (grid.valid) {
+        double sum = 0.0;
+        double sum_sq = 0.0;
+        for (uint8_t m : grid.mean) {
+            sum += m;
+            sum_sq += static_cast<double>(m) * m;
+        }
+        const auto n = static_cast<double>(grid.mean.size());
+        mean = static_cast<float>(sum / n);
+        spread = static_cast<float>(
+            std::sqrt(std::max(0.0, (sum_sq / n) - ((sum / n) * (sum / n)))));
+        if (prev_grid.valid) {
+            change = static_cast<float>(grid.distance(prev_grid));
+        }
+    }
+    prev_grid = grid;
+
+    pts.push_back(score.pts);
+    values[col(MetricColumn::Sad)].push_back(static_cast<float>(score.sad));
+    values[col(MetricColumn::MeanLuma)].push_back(mean);
+    values[col(MetricColumn::TileSpread)].push_back(spread);
+    values[col(MetricColumn::TileChange)].push_back(change);
+    values[col(MetricColumn::Boundary)].push_back(score.boundary);
+    cuts.push_back(scene_start ? 1 : 0);
+
+    if (pts.size() == chunk_frames) {
+        return flush_chunk();
+    }
+    return 0;
+}
+
+int MetricsWriter::flush_chunk() {
+    if (pts.empty()) {
+        return 0;
+    }
+    const size_t frames = pts.size();
+
+    std::vector<uint8_t> packed_pts;
+    if (packed) {
+        packed_pts.reserve(frames * 2);
+        uint64_t prev = 0;
+        for (int64_t p : pts) {
+            const uint64_t d = static_cast<uint64_t>(p) - prev;
+            put_varint(packed_pts, (d << 1) ^ (0 - (d >> 63)));
+            prev = static_cast<uint64_t>(p);
+        }
+    }
+
+    MetricsChunkEntry entry{};
+    std::array<const void*, metric_columns> data{};
+    uint32_t pos = 0;
+    for (int c = 0; c < metric_columns; c++) {
+        const auto column = static_cast<MetricColumn>(c);
+        if (column == MetricColumn::Pts) {
+            data[c] = packed ? static_cast<const void*>(packed_pts.data())
+                             : pts.data();
+            entry.column_size[c] =
+                static_cast<uint32_t>(packed ? packed_pts.size()
+                                             : frames * sizeof(int64_t));
+        } else if (column == MetricColumn::Cut) {
+            data[c] = cuts.data();
+            entry.column_size[c] = static_cast<uint32_t>(frames);
+        } else {
+            data[c] = values[c].data();
+            entry.column_size[c] =
+                static_cast<uint32_t>(frames * sizeof(float));
+        }
+        pos = (pos + column_alignment - 1) & ~(column_alignment - 1);
+        entry.column_offset[c] = pos;
+        pos += entry.column_size[c];
+    }
+
+    // pad to the chunk alignment
+    static constexpr uint8_t zeros[chunk_alignment] = {};
+    auto offset = static_cast<uint64_t>(ftello(file));
+    uint64_t aligned = (offset + chunk_alignment - 1) & ~(chunk_alignment - 1);
+    int ret = write_all(file, zeros, aligned - offset);
+    uint32_t written = 0;
+    for (int c = 0; c < metric_columns && ret >= 0; c++) {
+        ret = write_all(file, zeros, entry.column_offset[c] - written);
+        if (ret >= 0) {
+            ret = write_all(file, data[c], entry.column_size[c]);
+        }
+        written = entry.column_offset[c] + entry.column_size[c];
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    entry.offset = aligned;
+    entry.first_frame = frames_written;
+    entry.frames = static_cast<uint32_t>(frames);
+    entry.size = pos;
+    index.push_back(entry);
+    frames_written += static_cast<int64_t>(frames);
+
+    pts.clear();
+    for (auto& v : values) {
+        v.clear();
+    }
+    cuts.clear();
+    return 0;
+}
+
+int MetricsWriter::close() {
+    if (file == nullptr) {
+        return 0;
+    }
+
+    int ret = flush_chunk();
+    if (ret >= 0) {
+        memcpy(header.magic, metrics_magic, sizeof(header.magic));
+        header.chunk_count = static_cast<uint32_t>(index.size());
+        header.frame_count = frames_written;
+        header.index_offset = static_cast<uint64_t>(ftello(file));
+        ret = write_all(file, index.data(),
+                        index.size() * sizeof(MetricsChunkEntry));
+    }
+    if (ret >= 0) {
+        ret = fseeko(file, 0, SEEK_SET) == 0
+                  ? write_all(file, &header, sizeof(header))
+                  : AVERROR(EIO);
+    }
+
+    if (fclose(file) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    file = nullptr;
+    closed = true;
+    return ret;
+}
+
+std::unique_ptr<MetricsReader> MetricsReader::open(const char* path) {
+    auto reader = std::unique_ptr<MetricsReader>(new MetricsReader());
+
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    const bool loaded = reader->mapped.load(file);
+    (void)fclose(file);
+    if (!loaded) {
+        return nullptr;
+    }
+    const uint8_t* base = reader->mapped.data();
+    const size_t size = reader->mapped.size();
+
+    auto& hdr = reader->header;
+    if (size < sizeof(hdr)) {
+        return nullptr;
+    }
+    memcpy(&hdr, base, sizeof(hdr));
+    if (memcmp(hdr.magic, metrics_magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != metrics_version ||
+        hdr.column_count != metric_columns) {
+        return nullptr;
+    }
+    for (int c = 0; c < metric_columns; c++) {
+        const auto column = static_cast<MetricColumn>(c);
+        if (hdr.encoding[c] != static_cast<uint8_t>(MetricEncoding::Raw) &&
+            (column != MetricColumn::Pts ||
+             hdr.encoding[c] !=
+                 static_cast<uint8_t>(MetricEncoding::DeltaVarint))) {
+            return nullptr;
+        }
+    }
+
+    const uint64_t index_bytes =
+        static_cast<uint64_t>(hdr.chunk_count) * sizeof(MetricsChunkEntry);
+    if (hdr.index_offset > size || index_bytes > size - hdr.index_offset) {
+        return nullptr;
+    }
+    reader->index.resize(hdr.chunk_count);
+    memcpy(reader->index.data(), base + hdr.index_offset, index_bytes);
+
+    for (const auto& entry : reader->index) {
+        if (entry.offset > size || entry.size > size - entry.offset ||
+            entry.offset % chunk_alignment != 0) {
+            return nullptr;
+        }
+        for (int c = 0; c < metric_columns; c++) {
+            const auto column = static_cast<MetricColumn>(c);
+            const uint64_t end = static_cast<uint64_t>(entry.column_offset[c]) +
+                                 entry.column_size[c];
+            const bool raw =
+                hdr.encoding[c] == static_cast<uint8_t>(MetricEncoding::Raw);
+            const uint64_t frames = entry.frames;
+            if (end > entry.size ||
+                entry.column_offset[c] % column_alignment != 0 ||
+                (raw && entry.column_size[c] != frames * raw_width(column)) ||
+                (!raw && entry.column_size[c] > frames * max_varint)) {
+                return nullptr;
+            }
+        }
+    }
+
+    return reader;
+}
+
+const uint8_t* MetricsReader::column(size_t i, MetricColumn c) const {
+    const auto& entry = index[i];
+    return mapped.data() + entry.offset + entry.column_offset[col(c)];
+}
+
+const float* MetricsReader::floats(size_t i, MetricColumn c) const {
+    if (c == MetricColumn::Pts || c == MetricColumn::Cut) {
+        return nullptr;
+    }
+    return reinterpret_cast<const float*>(column(i, c));
+}
+
+const uint8_t* MetricsReader::cuts(size_t i) const {
+    return column(i, MetricColumn::Cut);
+}
+
+bool MetricsReader::read_pts(size_t i, std::vector<int64_t>& pts) const {
+    const auto& entry = index[i];
+    const uint8_t* data = column(i, MetricColumn::Pts);
+    pts.resize(entry.frames);
+
+    if (header.encoding[col(MetricColumn::Pts)] ==
+        static_cast<uint8_t>(MetricEncoding::Raw)) {
+        memcpy(pts.data(), data, pts.size() * sizeof(int64_t));
+        return true;
+    }
+
+    const uint8_t* end = data + entry.column_size[col(MetricColumn::Pts)];
+    uint64_t prev = 0;
+    for (auto& p : pts) {
+        uint64_t z = 0;
+        int shift = 0;
+        while (true) {
+            if (data == end || shift > 63) {
+                return false;
+            }
+            const uint8_t b = *data++;
+            z |= static_cast<uint64_t>(b & 0x7F) << shift;
+            shift += 7;
+            if (b < 0x80) {
+                break;
+            }
+        }
+        prev += (z >> 1) ^ (0 - (z & 1));
+        p = static_cast<int64_t>(prev);
+    }
+    return data == end;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "detect.h"
+#include "flash.h"
+#include "util.h"
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+// Per-frame metrics in columns, for plotting and QA tools that would spend
+// most of their time parsing text otherwise.
+//
+// Layout (little endian):
+//   MetricsFileHeader
+//   chunks, each starting on a 4 KiB boundary, one block per column, each
+//   block starting on a 64 byte boundary of the chunk:
+//     pts          int64_t[frames], or zigzag varint deltas when packed
+//     sad          float[frames]   mean absolute luma difference
+//     mean_luma    float[frames]   mean of the tile grid
+//     tile_spread  float[frames]   standard deviation of the tile means
+//     tile_change  float[frames]   tile grid distance to the last frame
+//     boundary     float[frames]   learned cut probability, -1 without
+//     cut          uint8_t[frames] 1 where a scene starts
+//   MetricsChunkEntry index[chunk_count] at header.index_offset
+//
+// Tile columns are NaN for frames without a luma plane. Raw columns can be
+// used in place once the file is mapped; only the timestamps, which shrink
+// to a byte or two a frame, are ever packed.
+
+inline constexpr char metrics_magic[8] = {'S', 'D', 'M', 'E',
+                                          'T', 'R', 'C', '1'};
+
+enum class MetricColumn : uint8_t {
+    Pts,
+    Sad,
+    MeanLuma,
+    TileSpread,
+    TileChange,
+    Boundary,
+    Cut,
+};
+inline constexpr int metric_columns = 7;
+
+enum class MetricEncoding : uint8_t {
+    Raw,
+    // zigzag coded difference to the previous value of the chunk, 7 bits
+    // per byte, low bits first
+    DeltaVarint,
+};
+
+struct MetricsFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_frames;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint32_t chunk_count;
+    uint32_t column_count;
+    int64_t frame_count;
+    uint64_t index_offset;
+    // MetricEncoding of every column
+    uint8_t encoding[metric_columns];
+    uint8_t reserved[9];
+};
+static_assert(sizeof(MetricsFileHeader) == 64);
+
+struct MetricsChunkEntry {
+    uint64_t offset;
+    int64_t first_frame;
+    uint32_t frames;
+    uint32_t size;
+    // relative to `offset`
+    uint32_t column_offset[metric_columns];
+    uint32_t column_size[metric_columns];
+};
+static_assert(sizeof(MetricsChunkEntry) == 80);
+
+class MetricsWriter {
+  public:
+    // With `packed` the timestamps are delta coded.
+    MetricsWriter(const char* path, AVRational time_base, bool packed,
+                  uint32_t chunk_frames = 4096)
+        : path(path), time_base(time_base), packed(packed),
+          chunk_frames(chunk_frames) {}
+    ~MetricsWriter();
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    // Takes every frame in order with the cut decision on it; the file is
+    // created on the first call. Returns 0 or a negative AVERROR.
+    int push(const FrameScore& score, const TileGrid& grid, bool scene_start);
+
+    // Flushes the last chunk and writes the index.
+    int close();
+
+  private:
+    int flush_chunk();
+
+    const char* path;
+    AVRational time_base;
+    bool packed;
+    uint32_t chunk_frames;
+
+    FILE* file{nullptr};
+    MetricsFileHeader header{};
+    std::vector<MetricsChunkEntry> index;
+    TileGrid prev_grid;
+
+    // columns of the chunk being built
+    std::vector<int64_t> pts;
+    std::vector<float> values[metric_columns];
+    std::vector<uint8_t> cuts;
+    int64_t frames_written{0};
+    bool closed{false};
+};
+
+class MetricsReader {
+  public:
+    // Returns nullptr if `path` is not a readable metrics file.
+    [[nodiscard]] static std::unique_ptr<MetricsReader> open(const char* path);
+
+    MetricsReader(const MetricsReader&) = delete;
+    MetricsReader& operator=(const MetricsReader&) = delete;
+
+    [[nodiscard]] int64_t frame_count() const { return header.frame_count; }
+    [[nodiscard]] AVRational time_base() const {
+        return AVRational{header.time_base_num, header.time_base_den};
+    }
+    [[nodiscard]] size_t chunk_count() const { return index.size(); }
+    [[nodiscard]] const MetricsChunkEntry& chunk(size_t i) const {
+        return index[i];
+    }
+
+    // Column `c` of chunk `i` in the mapped file, chunk(i).frames values;
+    // nullptr for the pts and cut columns.
+    [[nodiscard]] const float* floats(size_t i, MetricColumn c) const;
+    [[nodiscard]] const uint8_t* cuts(size_t i) const;
+
+    // Decodes the timestamps of chunk `i`.
+    bool read_pts(size_t i, std::vector<int64_t>& pts) const;
+
+  private:
+    MetricsReader() = default;
+
+    [[nodiscard]] const uint8_t* column(size_t i, MetricColumn c) const;
+
+    MappedFile mapped;
+    MetricsFileHeader header{};
+    std::vector<MetricsChunkEntry> index;
+};
@@ -0,0 +1,104 @@
+"""Reads the per-frame metrics written by --metrics.
+
+The file is mapped; raw columns of a single-chunk file are views of the
+mapping, longer files are joined chunk by chunk. See metrics.h for the
+layout.
+
+Usage as a script: python metrics.py metrics.bin   (prints a summary)
+"""
+
+import mmap
+import struct
+import sys
+
+import numpy
+
+MAGIC = b"SDMETRC1"
+VERSION = 1
+COLUMNS = ["pts", "sad", "mean_luma", "tile_spread", "tile_change",
+           "boundary", "cut"]
+DTYPES = {"pts": "<i8", "cut": "u1"}
+RAW, DELTA_VARINT = 0, 1
+
+HEADER = struct.Struct("<8sIIiiIIqQ7B9x")
+CHUNK = struct.Struct("<qqII7I7I")
+
+
+def decode_varints(data: numpy.ndarray) -> numpy.ndarray:
+    """Decodes back to back zigzag varint deltas into absolute values.
+
+    Arguments:
+        data: uint8 bytes of one chunk's column.
+
+    Returns:
+        int64 values, the running sum of the decoded deltas.
+    """
+    last = (data & 0x80) == 0
+    starts = numpy.concatenate(([0], numpy.flatnonzero(last)[:-1] + 1))
+    group = numpy.cumsum(numpy.concatenate(([0], last[:-1])))
+    shift = (numpy.arange(len(data)) - starts[group]) * 7
+    parts = (data & 0x7F).astype(numpy.uint64) << shift.astype(numpy.uint64)
+    z = numpy.add.reduceat(parts, starts) if len(data) else parts
+    deltas = (z >> numpy.uint64(1)) ^ (numpy.uint64(0) - (z & numpy.uint64(1)))
+    return numpy.cumsum(deltas.view(numpy.int64))
+
+
+def read_metrics(path: str) -> dict:
+    """Maps a metrics file.
+
+    Arguments:
+        path: File written by --metrics.
+
+    Returns:
+        A dict of numpy arrays, one per column name, plus "frame" and
+        "time_base" (num, den).
+    """
+    with open(path, "rb") as f:
+        buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    (magic, version, _, tb_num, tb_den, chunk_count, column_count,
+     frame_count, index_offset, *encoding) = HEADER.unpack_from(buf, 0)
+    if (magic != MAGIC or version != VERSION or
+            column_count != len(COLUMNS)):
+        raise ValueError(f"{path} is not a metrics file")
+
+    parts = {name: [] for name in COLUMNS}
+    frames = []
+    for i in range(chunk_count):
+        offset, first, count, _, *cols = CHUNK.unpack_from(
+            buf, index_offset + i * CHUNK.size)
+        frames.append(numpy.arange(first, first + count))
+        for c, name in enumerate(COLUMNS):
+            at, size = offset + cols[c], cols[len(COLUMNS) + c]
+            if encoding[c] == DELTA_VARINT:
+                data = numpy.frombuffer(buf, numpy.uint8, size, at)
+                parts[name].append(decode_varints(data))
+            else:
+                dtype = numpy.dtype(DTYPES.get(name, "<f4"))
+                parts[name].append(numpy.frombuffer(buf, dtype, count, at))
+
+    def join(arrays, dtype):
+        if len(arrays) == 1:
+            return arrays[0]
+        return numpy.concatenate(arrays) if arrays else numpy.empty(0, dtype)
+
+    result = {name: join(parts[name], DTYPES.get(name, "<f4"))
+              for name in COLUMNS}
+    result["frame"] = join(frames, numpy.int64)
+    result["time_base"] = (tb_num, tb_den)
+    if len(result["frame"]) != frame_count:
+        raise ValueError(f"{path} is damaged")
+    return result
+
+
+def is_metrics_file(path: str) -> bool:
+    """True if `path` starts like a metrics file."""
+    with open(path, "rb") as f:
+        return f.read(len(MAGIC)) == MAGIC
+
+
+if __name__ == "__main__":
+    m = read_metrics(sys.argv[1])
+    num, den = m["time_base"]
+    print(f"{len(m['frame'])} frames, time base {num}/{den}, "
+          f"{int(m['cut'].sum())} cuts, "
+          f"mean score {float(numpy.mean(m['sad'])):.3f}")
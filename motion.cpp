@@ -0,0 +1,337 @@
+#include "motion.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+
+#include "kernels.h"
+
+namespace {
+
+// Correlation peak over the RMS of the correlation surface below which two
+// pictures are taken as unrelated. Unrelated pictures peak at 4 to 9; a
+// clean shift at the square root of the number of bins.
+constexpr double min_peak_ratio = 10.0;
+
+// motion explains a change when the residual after the block search is
+// below this share of the intra cost; cuts land well above 1
+constexpr double max_explained_residual = 0.75;
+
+// search patterns around the best vector so far
+constexpr Shift hexagon[] = {{.dx = -2, .dy = 0},  {.dx = 2, .dy = 0},
+                             {.dx = -1, .dy = -2}, {.dx = 1, .dy = -2},
+                             {.dx = -1, .dy = 2},  {.dx = 1, .dy = 2}};
+constexpr Shift diamond[] = {{.dx = -1, .dy = 0},
+                             {.dx = 1, .dy = 0},
+                             {.dx = 0, .dy = -1},
+                             {.dx = 0, .dy = 1}};
+// candidates of the largest step, the hexagon
+constexpr int max_candidates = 6;
+
+int next_pow2(int n) {
+    int p = 1;
+    while (p < n) {
+        p *= 2;
+    }
+    return p;
+}
+
+std::vector<float> hann(int n) {
+    std::vector<float> w(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        w[i] = static_cast<float>(
+            0.5 - (0.5 * std::cos(2.0 * std::numbers::pi * (i + 0.5) / n)));
+    }
+    return w;
+}
+
+} // namespace
+
+GlobalMotion::~GlobalMotion() { free_transforms(); }
+
+void GlobalMotion::free_transforms() {
+    av_tx_uninit(&row_fwd);
+    av_tx_uninit(&row_inv);
+    av_tx_uninit(&col_fwd);
+    av_tx_uninit(&col_inv);
+}
+
+bool GlobalMotion::resize(int w, int h) {
+    if (w == width && h == height && row_fwd != nullptr) {
+        return true;
+    }
+    free_transforms();
+    width = 0;
+    height = 0;
+    cols = next_pow2(w);
+    rows = next_pow2(h);
+
+    const float scale = 1.0F;
+    if (av_tx_init(&row_fwd, &row_fwd_fn, AV_TX_FLOAT_FFT, 0, cols, &scale,
+                   0) < 0 ||
+        av_tx_init(&row_inv, &row_inv_fn, AV_TX_FLOAT_FFT, 1, cols, &scale,
+                   0) < 0 ||
+        av_tx_init(&col_fwd, &col_fwd_fn, AV_TX_FLOAT_FFT, 0, rows, &scale,
+                   0) < 0 ||
+        av_tx_init(&col_inv, &col_inv_fn, AV_TX_FLOAT_FFT, 1, rows, &scale,
+                   0) < 0) {
+        free_transforms();
+        return false;
+    }
+
+    width = w;
+    height = h;
+    window_x = hann(w);
+    window_y = hann(h);
+    const auto bins = static_cast<size_t>(cols) * rows;
+    spectrum_a.resize(bins);
+    spectrum_b.resize(bins);
+    line_in.resize(static_cast<size_t>(std::max(cols, rows)));
+    line_out.resize(line_in.size());
+    return true;
+}
+
+void GlobalMotion::forward(PlaneView p, AVComplexFloat* out) {
+    uint64_t sum = kernels().sum(p.data, p.stride, p.width, p.height);
+    const auto mean = static_cast<float>(
+        static_cast<double>(sum) /
+        (static_cast<double>(p.width) * static_cast<double>(p.height)));
+
+    // the mean removed, so the picture's DC term does not dominate
+    std::fill_n(out, static_cast<size_t>(cols) * rows, AVComplexFloat{});
+    for (int y = 0; y < p.height; y++) {
+        const uint8_t* src = p.data + (y * p.stride);
+        AVComplexFloat* dst = out + (static_cast<size_t>(y) * cols);
+        for (int x = 0; x < p.width; x++) {
+            dst[x].re = (static_cast<float>(src[x]) - mean) * window_x[x] *
+                        window_y[y];
+        }
+    }
+    transform_2d(out, false);
+}
+
+void GlobalMotion::transform_2d(AVComplexFloat* buf, bool inverse) {
+    AVTXContext* row_tx = inverse ? row_inv : row_fwd;
+    AVTXContext* col_tx = inverse ? col_inv : col_fwd;
+    av_tx_fn row_fn = inverse ? row_inv_fn : row_fwd_fn;
+    av_tx_fn col_fn = inverse ? col_inv_fn : col_fwd_fn;
+    constexpr auto stride = static_cast<ptrdiff_t>(sizeof(AVComplexFloat));
+
+    // forward, the padding rows are zero and stay zero
+    const int used_rows = inverse ? rows : height;
+    for (int y = 0; y < used_rows; y++) {
+        AVComplexFloat* row = buf + (static_cast<size_t>(y) * cols);
+        std::copy_n(row, cols, line_in.data());
+        row_fn(row_tx, row, line_in.data(), stride);
+    }
+    for (int x = 0; x < cols; x++) {
+        for (int y = 0; y < rows; y++) {
+            line_in[y] = buf[(static_cast<size_t>(y) * cols) + x];
+        }
+        col_fn(col_tx, line_out.data(), line_in.data(), stride);
+        for (int y = 0; y < rows; y++) {
+            buf[(static_cast<size_t>(y) * cols) + x] = line_out[y];
+        }
+    }
+}
+
+std::optional<Shift> GlobalMotion::estimate(PlaneView a, PlaneView b) {
+    if (a.width != b.width || a.height != b.height || a.width < 8 ||
+        a.height < 8 || !resize(a.width, a.height)) {
+        return std::nullopt;
+    }
+    forward(a, spectrum_a.data());
+    forward(b, spectrum_b.data());
+
+    // B * conj(A), normalized towards unit magnitude so the phase, which
+    // holds the offset, dominates. Adding the mean magnitude keeps weak
+    // terms, mostly noise in smooth pictures, from counting as much as the
+    // picture's own frequencies.
+    double total = 0.0;
+    for (size_t i = 0; i < spectrum_a.size(); i++) {
+        const AVComplexFloat fa = spectrum_a[i];
+        const AVComplexFloat fb = spectrum_b[i];
+        spectrum_b[i] = AVComplexFloat{.re = (fb.re * fa.re) + (fb.im * fa.im),
+                                       .im = (fb.im * fa.re) - (fb.re * fa.im)};
+        total += std::hypot(spectrum_b[i].re, spectrum_b[i].im);
+    }
+    const auto bias =
+        static_cast<float>(total / static_cast<double>(spectrum_b.size()));
+    if (bias <= 0.0F) {
+        return std::nullopt;
+    }
+    for (size_t i = 0; i < spectrum_b.size(); i++) {
+        const AVComplexFloat c = spectrum_b[i];
+        const float norm = std::hypot(c.re, c.im) + bias;
+        spectrum_a[i] = AVComplexFloat{.re = c.re / norm, .im = c.im / norm};
+    }
+    transform_2d(spectrum_a.data(), true);
+
+    size_t peak = 0;
+    double energy = 0.0;
+    for (size_t i = 0; i < spectrum_a.size(); i++) {
+        const double v = spectrum_a[i].re;
+        energy += v * v;
+        if (v > spectrum_a[peak].re) {
+            peak = i;
+        }
+    }
+    const double rms =
+        std::sqrt(energy / static_cast<double>(spectrum_a.size()));
+    if (spectrum_a[peak].re < min_peak_ratio * rms) {
+        return std::nullopt;
+    }
+
+    // the transform wraps around: the upper half are negative offsets
+    int dx = static_cast<int>(peak % cols);
+    int dy = static_cast<int>(peak / cols);
+    dx = dx >= cols / 2 ? dx - cols : dx;
+    dy = dy >= rows / 2 ? dy - rows : dy;
+    if (2 * std::abs(dx) > a.width || 2 * std::abs(dy) > a.height) {
+        return std::nullopt;
+    }
+    return Shift{.dx = dx, .dy = dy};
+}
+
+double GlobalMotion::compensated_score(PlaneView a, PlaneView b,
+                                       double plain) {
+    auto shift = estimate(a, b);
+    if (!shift || *shift == Shift{}) {
+        return plain;
+    }
+    return std::min(plain, shifted_score(a, b, *shift));
+}
+
+double shifted_score(PlaneView a, PlaneView b, Shift shift) {
+    const int x0 = std::max(0, shift.dx);
+    const int y0 = std::max(0, shift.dy);
+    const int w = b.width - std::abs(shift.dx);
+    const int h = b.height - std::abs(shift.dy);
+    if (w <= 0 || h <= 0) {
+        return 0.0;
+    }
+    const uint8_t* pa =
+        a.data + ((y0 - shift.dy) * a.stride) + (x0 - shift.dx);
+    const uint8_t* pb = b.data + (y0 * b.stride) + x0;
+    uint64_t sad = kernels().sad(pa, a.stride, pb, b.stride, w, h);
+    return static_cast<double>(sad) /
+           (static_cast<double>(w) * static_cast<double>(h));
+}
+
+double BlockResidual::compensate(double score) const {
+    if (plain <= 0.0 || compensated > max_explained_residual * intra) {
+        return score;
+    }
+    return score * std::min(1.0, compensated / plain);
+}
+
+BlockResidual BlockMotion::residual(PlaneView a, PlaneView b,
+                                    Shift predictor) {
+    const int cols = b.width / sad_block;
+    const int rows = b.height / sad_block;
+    if (a.width != b.width || a.height != b.height || cols == 0 ||
+        rows == 0) {
+        return {};
+    }
+    const auto& k = kernels();
+    const auto block_sad = k.block_sad;
+    above.assign(static_cast<size_t>(cols), Shift{});
+    current.assign(static_cast<size_t>(cols), Shift{});
+
+    uint64_t plain = 0;
+    uint64_t compensated = 0;
+    uint64_t intra = 0;
+    // a flat block at a block's mean, for its intra cost
+    std::array<uint8_t, sad_block * sad_block> flat{};
+    constexpr ptrdiff_t flat_offset = 0;
+    for (int by = 0; by < rows; by++) {
+        const int y = by * sad_block;
+        for (int bx = 0; bx < cols; bx++) {
+            const int x = bx * sad_block;
+            const uint8_t* cur = b.data + (y * b.stride) + x;
+            const uint8_t* ref = a.data + (y * a.stride) + x;
+
+            Shift vectors[max_candidates];
+            ptrdiff_t offsets[max_candidates];
+            uint32_t sads[max_candidates];
+            int n = 0;
+            // b(x, y) ~ a(x - dx, y - dy)
+            auto add = [&](Shift v) {
+                if (std::abs(v.dx) > range || std::abs(v.dy) > range ||
+                    x - v.dx < 0 || x - v.dx + sad_block > a.width ||
+                    y - v.dy < 0 || y - v.dy + sad_block > a.height) {
+                    return;
+                }
+                vectors[n] = v;
+                offsets[n] = -(v.dy * a.stride) - v.dx;
+                n++;
+            };
+            Shift best{};
+            uint32_t best_sad = UINT32_MAX;
+            auto search = [&] {
+                block_sad(cur, b.stride, ref, a.stride, offsets, n, sads);
+                bool moved = false;
+                for (int i = 0; i < n; i++) {
+                    if (sads[i] < best_sad) {
+                        best_sad = sads[i];
+                        best = vectors[i];
+                        moved = true;
+                    }
+                }
+                n = 0;
+                return moved;
+            };
+
+            // no motion comes first, so sads[0] is the plain score
+            add(Shift{});
+            add(predictor);
+            if (bx > 0) {
+                add(current[bx - 1]);
+            }
+            if (by > 0) {
+                add(above[bx]);
+            }
+            search();
+            plain += sads[0];
+
+            for (int step = 0; step < range && best_sad > 0; step++) {
+                const Shift center = best;
+                for (const Shift& h : hexagon) {
+                    add(Shift{.dx = center.dx + h.dx,
+                              .dy = center.dy + h.dy});
+                }
+                if (!search()) {
+                    break;
+                }
+            }
+            if (best_sad > 0) {
+                const Shift center = best;
+                for (const Shift& d : diamond) {
+                    add(Shift{.dx = center.dx + d.dx,
+                              .dy = center.dy + d.dy});
+                }
+                search();
+            }
+            compensated += best_sad;
+            current[bx] = best;
+
+            const uint64_t sum = k.sum(cur, b.stride, sad_block, sad_block);
+            flat.fill(static_cast<uint8_t>(
+                (sum + (flat.size() / 2)) / flat.size()));
+            uint32_t deviation = 0;
+            block_sad(cur, b.stride, flat.data(), sad_block, &flat_offset, 1,
+                      &deviation);
+            intra += deviation;
+        }
+        std::swap(above, current);
+    }
+
+    const double pixels = static_cast<double>(cols) * rows * sad_block *
+                          sad_block;
+    return BlockResidual{
+        .plain = static_cast<double>(plain) / pixels,
+        .compensated = static_cast<double>(compensated) / pixels,
+        .intra = static_cast<double>(intra) / pixels,
+    };
+}
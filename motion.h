@@ -0,0 +1,114 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "thumbnail.h"
+
+extern "C" {
+#include <libavutil/tx.h>
+}
+
+// Translation of a whole picture, in pixels: b(x, y) ~ a(x - dx, y - dy).
+struct Shift {
+    int dx{0};
+    int dy{0};
+
+    bool operator==(const Shift&) const = default;
+};
+
+// Camera pans and tilts estimated by phase correlation: the normalized
+// cross-power spectrum of two pictures transforms back to a single peak at
+// their offset. Meant for thumbnails; the transforms are sized to the next
+// powers of two above the plane and reused while the size stays the same.
+class GlobalMotion {
+  public:
+    GlobalMotion() = default;
+    ~GlobalMotion();
+
+    GlobalMotion(const GlobalMotion&) = delete;
+    GlobalMotion& operator=(const GlobalMotion&) = delete;
+
+    // The translation from `a` to `b`, which must have the same size.
+    // Nothing if the correlation has no clear peak (a cut rather than a
+    // pan) or the shift leaves less than half of either dimension shared.
+    [[nodiscard]] std::optional<Shift> estimate(PlaneView a, PlaneView b);
+
+    // Mean absolute difference of `a` and `b` over the part they share
+    // once the estimated translation is undone. Returns `plain`, their
+    // uncompensated mean, if there is no translation or it scores higher.
+    [[nodiscard]] double compensated_score(PlaneView a, PlaneView b,
+                                           double plain);
+
+  private:
+    bool resize(int w, int h);
+    void free_transforms();
+    // windowed forward transform of `p` into `out`
+    void forward(PlaneView p, AVComplexFloat* out);
+    // 2D transform of `buf` in place, rows then columns
+    void transform_2d(AVComplexFloat* buf, bool inverse);
+
+    int width{0};
+    int height{0};
+    // transform sizes
+    int cols{0};
+    int rows{0};
+    AVTXContext* row_fwd{nullptr};
+    AVTXContext* row_inv{nullptr};
+    AVTXContext* col_fwd{nullptr};
+    AVTXContext* col_inv{nullptr};
+    av_tx_fn row_fwd_fn{nullptr};
+    av_tx_fn row_inv_fn{nullptr};
+    av_tx_fn col_fwd_fn{nullptr};
+    av_tx_fn col_inv_fn{nullptr};
+    // Hann windows, so the picture edges do not correlate as a shift of 0
+    std::vector<float> window_x;
+    std::vector<float> window_y;
+    std::vector<AVComplexFloat> spectrum_a;
+    std::vector<AVComplexFloat> spectrum_b;
+    // one row or column in and out of a 1D transform
+    std::vector<AVComplexFloat> line_in;
+    std::vector<AVComplexFloat> line_out;
+};
+
+// Mean absolute difference of `a` and `b` where they overlap after `b` is
+// shifted back by `shift`.
+[[nodiscard]] double shifted_score(PlaneView a, PlaneView b, Shift shift);
+
+// Mean absolute difference per pixel over the blocks of a motion search,
+// without motion and after each block is matched, and the blocks' own mean
+// absolute deviation. A residual well below that intra cost means the
+// picture is predicted by motion; after a cut, matching finds nothing much
+// better than each block's mean.
+struct BlockResidual {
+    double plain{0.0};
+    double compensated{0.0};
+    double intra{0.0};
+
+    // `score` of the same frames scaled by compensated / plain if motion
+    // explains the change, else `score` as is.
+    [[nodiscard]] double compensate(double score) const;
+};
+
+// Motion search per sad_block x sad_block block, for motion one global
+// shift does not describe: players in front of a panning background,
+// zooms. Each block of `b` starts from the best of a few predictors (no
+// motion, the global shift, the vectors of its left and upper
+// neighbours), walks a hexagon pattern downhill and ends with a small
+// diamond. Vectors stay within `range` pixels and inside `a`.
+class BlockMotion {
+  public:
+    // width of the downscaled frames searched
+    static constexpr int search_width = 256;
+    static constexpr int range = 16;
+
+    // `a` and `b` must have the same size; `predictor` is a global shift
+    // from a to b, if one is known.
+    [[nodiscard]] BlockResidual residual(PlaneView a, PlaneView b,
+                                         Shift predictor = {});
+
+  private:
+    // vectors of the block row above and of the current one
+    std::vector<Shift> above;
+    std::vector<Shift> current;
+};
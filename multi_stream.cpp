@@ -0,0 +1,230 @@
+#include "multi_stream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "decoder_tuning.h"
+#include "machine_profile.h"
+#include "util.h"
+#include "work_queue.h"
+
+namespace {
+
+// enough to ride out a decoder stalling on a frame-threading flush without
+// holding many seconds of compressed video; --calibrate may pick another
+constexpr size_t packet_queue_depth = 64;
+
+size_t queue_depth() {
+    int calibrated = machine_profile().queue_depth;
+    return calibrated > 0 ? static_cast<size_t>(calibrated)
+                          : packet_queue_depth;
+}
+
+struct ConsumerThread {
+    StreamConsumer* consumer;
+    WorkQueue<AVPacket*> packets{queue_depth()};
+    int error{0};
+    std::thread thread;
+
+    explicit ConsumerThread(StreamConsumer* c) : consumer(c) {}
+
+    void run() {
+        // keep draining after an error so the demuxer never blocks on a
+        // full queue
+        while (auto pkt = packets.pop()) {
+            if (error == 0) {
+                error = consumer->consume(*pkt);
+            }
+            av_packet_free(&*pkt);
+        }
+        if (error == 0) {
+            error = consumer->consume(nullptr);
+        }
+    }
+};
+
+} // namespace
+
+int run_demux_pass(AVFormatContext* demuxer,
+                   const std::vector<StreamConsumer*>& consumers) {
+    std::vector<std::unique_ptr<ConsumerThread>> threads;
+    std::vector<ConsumerThread*> route(demuxer->nb_streams, nullptr);
+    for (size_t i = 0; i < consumers.size() && i < route.size(); i++) {
+        if (consumers[i] != nullptr) {
+            threads.push_back(std::make_unique<ConsumerThread>(consumers[i]));
+            route[i] = threads.back().get();
+        }
+    }
+    for (auto& t : threads) {
+        t->thread = std::thread([ct = t.get()] { ct->run(); });
+    }
+
+    int error = 0;
+    AVPacket* pkt = av_packet_alloc();
+    if (pkt == nullptr) {
+        error = AVERROR(ENOMEM);
+    }
+
+    while (error == 0) {
+        int ret = av_read_frame(demuxer, pkt);
+        if (ret < 0) {
+            if (ret != AVERROR_EOF) {
+                error = ret;
+            }
+            break;
+        }
+
+        auto idx = static_cast<size_t>(pkt->stream_index);
+        ConsumerThread* dst = idx < route.size() ? route[idx] : nullptr;
+        if (dst == nullptr) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        AVPacket* queued = av_packet_alloc();
+        if (queued == nullptr) {
+            av_packet_unref(pkt);
+            error = AVERROR(ENOMEM);
+            break;
+        }
+        av_packet_move_ref(queued, pkt);
+        dst->packets.push(queued);
+    }
+    av_packet_free(&pkt);
+
+    for (auto& t : threads) {
+        t->packets.close();
+    }
+    for (auto& t : threads) {
+        t->thread.join();
+        if (error == 0) {
+            error = t->error;
+        }
+    }
+
+    return error;
+}
+
+VideoStreamAnalyzer::VideoStreamAnalyzer(const AVStream* stream,
+                                         const Options& opts)
+    : stream(stream), pipe(opts, stream->time_base) {}
+
+VideoStreamAnalyzer::~VideoStreamAnalyzer() {
+    for (auto* f : framebuf) {
+        av_frame_free(&f);
+    }
+    avcodec_free_context(&decoder);
+}
+
+int VideoStreamAnalyzer::open(int threads) {
+    const auto* codec = find_video_decoder(stream->codecpar);
+    if (codec == nullptr) {
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    decoder = avcodec_alloc_context3(codec);
+    framebuf = {av_frame_alloc(), av_frame_alloc()};
+    if (decoder == nullptr || framebuf[0] == nullptr ||
+        framebuf[1] == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    int ret = avcodec_parameters_to_context(decoder, stream->codecpar);
+    if (ret < 0) {
+        return ret;
+    }
+    decoder->thread_count = threads;
+    if (machine_profile().thread_type != 0) {
+        decoder->thread_type = machine_profile().thread_type;
+    }
+    return avcodec_open2(decoder, codec, nullptr);
+}
+
+int VideoStreamAnalyzer::consume(const AVPacket* pkt) {
+    int ret = avcodec_send_packet(decoder, pkt);
+    if (ret < 0 && ret != AVERROR_EOF) {
+        return ret;
+    }
+    return receive_frames();
+}
+
+// framebuf[0] holds the previous frame, framebuf[1] receives the next one
+int VideoStreamAnalyzer::receive_frames() {
+    while (true) {
+        AVFrame* cur = framebuf[1];
+        int ret = avcodec_receive_frame(decoder, cur);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+
+        AVFrame* prev = frame_count > 0 ? framebuf[0] : nullptr;
+        pipe.push_frame(cur, prev, frame_count++);
+
+        av_frame_unref(framebuf[0]);
+        std::swap(framebuf[0], framebuf[1]);
+    }
+}
+
+std::vector<int> select_video_streams(const AVFormatContext* demuxer,
+                                      const Options& opts) {
+    auto is_video = [demuxer](int idx) {
+        return idx >= 0 && static_cast<unsigned>(idx) < demuxer->nb_streams &&
+               demuxer->streams[idx]->codecpar->codec_type ==
+                   AVMEDIA_TYPE_VIDEO;
+    };
+
+    std::vector<int> selected;
+    if (opts.all_streams) {
+        for (unsigned i = 0; i < demuxer->nb_streams; i++) {
+            if (is_video(static_cast<int>(i))) {
+                selected.push_back(static_cast<int>(i));
+            }
+        }
+        return selected;
+    }
+    if (opts.streams.empty()) {
+        for (unsigned i = 0; i < demuxer->nb_streams; i++) {
+            if (is_video(static_cast<int>(i))) {
+                selected.push_back(static_cast<int>(i));
+                break;
+            }
+        }
+        return selected;
+    }
+
+    for (int idx : opts.streams) {
+        if (!is_video(idx)) {
+            (void)fprintf(stderr, "Stream %d is not a video stream, skipped\n",
+                          idx);
+            continue;
+        }
+        if (std::find(selected.begin(), selected.end(), idx) ==
+            selected.end()) {
+            selected.push_back(idx);
+        }
+    }
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+std::string stream_output_path(const char* path, int stream_index) {
+    std::string out(path);
+    size_t slash = out.find_last_of('/');
+    size_t dot = out.find_last_of('.');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash) ||
+        dot == (slash == std::string::npos ? 0 : slash + 1)) {
+        dot = out.size();
+    }
+
+    char tag[16];
+    (void)snprintf(tag, sizeof(tag), "-s%d", stream_index);
+    out.insert(dot, tag);
+    return out;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decode.h"
+#include "options.h"
+#include "pipeline.h"
+
+// Receives the packets of one stream on a thread of its own.
+class StreamConsumer {
+  public:
+    StreamConsumer() = default;
+    StreamConsumer(const StreamConsumer&) = delete;
+    StreamConsumer& operator=(const StreamConsumer&) = delete;
+    virtual ~StreamConsumer() = default;
+
+    // `pkt` is nullptr once at the end to flush. A negative AVERROR stops
+    // this consumer; the others keep going.
+    virtual int consume(const AVPacket* pkt) = 0;
+};
+
+// Reads `demuxer` once and hands every packet to `consumers[stream_index]`
+// (nullptr = discard) through a bounded queue per consumer, so a slow
+// stream holds back the demuxer instead of buffering without limit.
+// Returns 0, or the first negative AVERROR from the demuxer or a consumer.
+int run_demux_pass(AVFormatContext* demuxer,
+                   const std::vector<StreamConsumer*>& consumers);
+
+// Decodes one video stream and runs its frames through a Pipeline of its
+// own.
+class VideoStreamAnalyzer final : public StreamConsumer {
+  public:
+    // `opts` must outlive the analyzer.
+    VideoStreamAnalyzer(const AVStream* stream, const Options& opts);
+    ~VideoStreamAnalyzer() override;
+
+    // Opens the decoder with `threads` decoding threads (0 = automatic).
+    int open(int threads);
+
+    int consume(const AVPacket* pkt) override;
+
+    [[nodiscard]] int64_t frames() const { return frame_count; }
+    Pipeline& pipeline() { return pipe; }
+
+  private:
+    int receive_frames();
+
+    const AVStream* stream;
+    AVCodecContext* decoder{nullptr};
+    FrameBuf framebuf{};
+    int64_t frame_count{0};
+    Pipeline pipe;
+};
+
+// Indices of the video streams selected by --streams, in stream order, or
+// the first video stream without it. Indices that do not name a video
+// stream are reported and skipped.
+[[nodiscard]] std::vector<int>
+select_video_streams(const AVFormatContext* demuxer, const Options& opts);
+
+// "<stem>-s<index><ext>", so per-stream outputs do not overwrite each other
+[[nodiscard]] std::string stream_output_path(const char* path,
+                                             int stream_index);
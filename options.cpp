@@ -0,0 +1,255 @@
+#include "options.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+template <typename T> bool parse_number(const char* str, T& out) {
+    const char* end = str + strlen(str);
+    auto [ptr, ec] = std::from_chars(str, end, out);
+    return ec == std::errc() && ptr == end;
+}
+
+bool parse_scene_pick(std::string_view sv, ScenePick& out) {
+    if (sv == "first") {
+        out = ScenePick::First;
+    } else if (sv == "middle") {
+        out = ScenePick::Middle;
+    } else if (sv == "sharpest") {
+        out = ScenePick::Sharpest;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_image_format(std::string_view sv, ImageFormat& out) {
+    if (sv == "jpg" || sv == "jpeg") {
+        out = ImageFormat::Jpeg;
+    } else if (sv == "png") {
+        out = ImageFormat::Png;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_audio_mode(std::string_view sv, AudioMode& out) {
+    if (sv == "off") {
+        out = AudioMode::Off;
+    } else if (sv == "report") {
+        out = AudioMode::Report;
+    } else if (sv == "confirm") {
+        out = AudioMode::Confirm;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_motion_mode(std::string_view sv, MotionMode& out) {
+    if (sv == "off") {
+        out = MotionMode::Off;
+    } else if (sv == "global") {
+        out = MotionMode::Global;
+    } else if (sv == "blocks") {
+        out = MotionMode::Blocks;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_keyframe_format(std::string_view sv, KeyframeFormat& out) {
+    if (sv == "qpfile") {
+        out = KeyframeFormat::Qpfile;
+    } else if (sv == "svt-av1") {
+        out = KeyframeFormat::SvtAv1;
+    } else if (sv == "frames") {
+        out = KeyframeFormat::Frames;
+    } else if (sv == "ffmpeg") {
+        out = KeyframeFormat::Ffmpeg;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// three non-negative comma separated weights, not all zero
+bool parse_weights(std::string_view sv, std::array<double, 3>& out) {
+    std::array<double, 3> w{};
+    for (size_t i = 0; i < w.size(); i++) {
+        size_t comma = sv.find(',');
+        if ((comma == std::string_view::npos) != (i == w.size() - 1)) {
+            return false;
+        }
+        std::string_view item = sv.substr(0, comma);
+        auto [ptr, ec] =
+            std::from_chars(item.data(), item.data() + item.size(), w[i]);
+        if (ec != std::errc() || ptr != item.data() + item.size() ||
+            w[i] < 0) {
+            return false;
+        }
+        sv = comma == std::string_view::npos ? std::string_view{}
+                                             : sv.substr(comma + 1);
+    }
+    if (w[0] + w[1] + w[2] <= 0) {
+        return false;
+    }
+    out = w;
+    return true;
+}
+
+// "all" or a comma separated list of stream indices
+bool parse_streams(std::string_view sv, Options& opts) {
+    if (sv == "all") {
+        opts.all_streams = true;
+        return true;
+    }
+
+    while (!sv.empty()) {
+        size_t comma = sv.find(',');
+        std::string_view item = sv.substr(0, comma);
+        int idx = 0;
+        auto [ptr, ec] =
+            std::from_chars(item.data(), item.data() + item.size(), idx);
+        if (ec != std::errc() || ptr != item.data() + item.size() || idx < 0) {
+            return false;
+        }
+        opts.streams.push_back(idx);
+        sv = comma == std::string_view::npos ? std::string_view{}
+                                             : sv.substr(comma + 1);
+    }
+    return !opts.streams.empty();
+}
+
+} // namespace
+
+std::variant<Options, OptionError> parse_options(int argc, char** argv) {
+    Options opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+
+        if (arg.empty() || arg[0] != '-' || arg == "-") {
+            if (opts.url != nullptr) {
+                return OptionError{.type = OptionError::ExtraArgument,
+                                   .arg = argv[i]};
+            }
+            opts.url = argv[i];
+            continue;
+        }
+
+        // every option below takes exactly one value
+        if (i + 1 >= argc) {
+            return OptionError{.type = OptionError::MissingValue,
+                               .arg = argv[i]};
+        }
+        const char* value = argv[++i];
+
+        bool ok = false;
+        if (arg == "-t" || arg == "--threshold") {
+            ok = parse_number(value, opts.threshold) && opts.threshold >= 0;
+        } else if (arg == "-m" || arg == "--min-scene-len") {
+            ok = parse_number(value, opts.min_scene_len) &&
+                 opts.min_scene_len >= 0;
+        } else if (arg == "--flash-window") {
+            ok = parse_number(value, opts.flash_window) &&
+                 opts.flash_window >= 0 && opts.flash_window <= 250;
+        } else if (arg == "--transitions") {
+            ok = parse_number(value, opts.transition_frames) &&
+                 opts.transition_frames >= 0 && opts.transition_frames <= 600;
+        } else if (arg == "--weights") {
+            ok = parse_weights(value, opts.weights);
+        } else if (arg == "--scene-images") {
+            ok = parse_scene_pick(value, opts.scene_image);
+        } else if (arg == "--image-format") {
+            ok = parse_image_format(value, opts.image_format);
+        } else if (arg == "--image-dir") {
+            opts.image_dir = value;
+            ok = true;
+        } else if (arg == "--image-threads") {
+            ok = parse_number(value, opts.image_threads) &&
+                 opts.image_threads >= 0;
+        } else if (arg == "--keyframes") {
+            opts.keyframes_path = value;
+            ok = true;
+        } else if (arg == "--cache-dir") {
+            opts.cache_dir = value;
+            ok = true;
+        } else if (arg == "--thumbs") {
+            opts.thumbs_path = value;
+            ok = true;
+        } else if (arg == "--thumb-width") {
+            ok = parse_number(value, opts.thumb_width) &&
+                 opts.thumb_width >= 2 && opts.thumb_width <= 4096;
+        } else if (arg == "--segment-threads") {
+            ok = parse_number(value, opts.segment_threads) &&
+                 opts.segment_threads >= 0;
+        } else if (arg == "--intra-threads") {
+            ok = parse_number(value, opts.intra_threads) &&
+                 opts.intra_threads >= 0;
+        } else if (arg == "--streams") {
+            ok = parse_streams(value, opts);
+        } else if (arg == "--audio") {
+            ok = parse_audio_mode(value, opts.audio);
+        } else if (arg == "--crop") {
+            std::string_view mode = value;
+            ok = mode == "auto" || mode == "off";
+            opts.autocrop = mode == "auto";
+        } else if (arg == "--motion") {
+            ok = parse_motion_mode(value, opts.motion);
+        } else if (arg == "--mask") {
+            opts.mask = value;
+            ok = true;
+        } else if (arg == "--model") {
+            opts.model = value;
+            ok = true;
+        } else if (arg == "--scene-stats") {
+            opts.scene_stats = value;
+            ok = true;
+        } else if (arg == "--signatures") {
+            opts.signatures = value;
+            ok = true;
+        } else if (arg == "--build-index") {
+            opts.build_index = value;
+            ok = true;
+        } else if (arg == "--find-reuse") {
+            opts.reuse_index = value;
+            ok = true;
+        } else if (arg == "--clusters") {
+            opts.clusters = value;
+            ok = true;
+        } else if (arg == "--metrics") {
+            opts.metrics = value;
+            ok = true;
+        } else if (arg == "--metrics-encoding") {
+            std::string_view mode = value;
+            ok = mode == "raw" || mode == "packed";
+            opts.metrics_packed = mode == "packed";
+        } else if (arg == "--profile") {
+            opts.profile = value;
+            ok = true;
+        } else if (arg == "--calibrate") {
+            opts.calibrate_path = value;
+            ok = true;
+        } else if (arg == "--keyframes-format") {
+            ok = parse_keyframe_format(value, opts.keyframes_format);
+        } else {
+            return OptionError{.type = OptionError::UnknownOption,
+                               .arg = argv[i - 1]};
+        }
+
+        if (!ok) {
+            return OptionError{.type = OptionError::InvalidValue,
+                               .arg = argv[i - 1]};
+        }
+    }
+
+    if (opts.url == nullptr) {
+        return OptionError{.type = OptionError::MissingInput};
+    }
+
+    return opts;
+}
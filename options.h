@@ -0,0 +1,226 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "keyframes.h"
+
+enum class ScenePick : uint8_t { None, First, Middle, Sharpest };
+
+enum class ImageFormat : uint8_t { Jpeg, Png };
+
+// Off, print silences and which cuts the audio supports, or drop the cuts
+// it does not support
+enum class AudioMode : uint8_t { Off, Report, Confirm };
+
+// What is undone before a score counts as a cut: nothing, one shift of the
+// whole picture, or motion per block
+enum class MotionMode : uint8_t { Off, Global, Blocks };
+
+struct Options {
+    const char* url{nullptr};
+
+    // mean absolute luma difference per pixel that triggers a cut
+    double threshold{20.0};
+    // frames a cut is held back to check for a flash or strobe, 0 = off
+    int flash_window{0};
+    // longest dissolve or wipe looked for, in frames, 0 = off
+    int transition_frames{0};
+    // Y, U and V weights of the score; chroma is off by default
+    std::array<double, 3> weights{1.0, 0.0, 0.0};
+    int min_scene_len{15};
+
+    // representative image per scene
+    ScenePick scene_image{ScenePick::None};
+    ImageFormat image_format{ImageFormat::Jpeg};
+    const char* image_dir{"."};
+    // file name prefix, extended per stream in multi-stream runs
+    const char* image_prefix{"scene-"};
+    // 0 = half the cores
+    int image_threads{0};
+
+    // encoder keyframe hints
+    const char* keyframes_path{nullptr};
+    KeyframeFormat keyframes_format{KeyframeFormat::Qpfile};
+
+    // results keyed by input fingerprint and detector settings
+    const char* cache_dir{nullptr};
+
+    // per-frame thumbnail store for re-analysis without decoding
+    const char* thumbs_path{nullptr};
+    // 0 = the machine profile's choice, or 64
+    int thumb_width{0};
+
+    // concurrent segment decoders for playlists and segment directories,
+    // 0 = one per core
+    int segment_threads{0};
+
+    // decoder instances for intra-only codecs and image sequences,
+    // 0 = one per core, 1 = regular decoding
+    int intra_threads{0};
+
+    // video streams analyzed in one demux pass; empty and !all_streams means
+    // the first video stream only
+    std::vector<int> streams;
+    bool all_streams{false};
+
+    AudioMode audio{AudioMode::Off};
+
+    // score only the picture inside black bars
+    bool autocrop{true};
+    MotionMode motion{MotionMode::Blocks};
+    // regions left out of scoring: an image whose light pixels mark them,
+    // or "auto" to learn static overlays such as logos
+    const char* mask{nullptr};
+    // learned shot-boundary model (export_model.py); its probabilities
+    // replace the score threshold
+    const char* model{nullptr};
+    // per-scene statistics CSV, written while decoding
+    const char* scene_stats{nullptr};
+    // scene signatures of the input, for --build-index
+    const char* signatures{nullptr};
+    // look the input's scenes up in this signature index
+    const char* reuse_index{nullptr};
+    // build a signature index from the signature files listed in the input
+    const char* build_index{nullptr};
+    // CSV assigning recurring shots (shot/reverse-shot, returning
+    // locations) to clusters
+    const char* clusters{nullptr};
+    // per-frame metrics in the columnar format of metrics.h
+    const char* metrics{nullptr};
+    // delta code the metric timestamps instead of keeping every column
+    // mappable as an array
+    bool metrics_packed{false};
+
+    // machine profile loaded at startup (--profile or $SCENEDETECT_PROFILE);
+    // the decoder choice for a new codec is tuned on a miss
+    const char* profile{nullptr};
+    // write a machine profile from trials on the input instead of detecting
+    const char* calibrate_path{nullptr};
+};
+
+struct OptionError {
+    enum OptionErrorType : uint8_t {
+        MissingInput,
+        UnknownOption,
+        MissingValue,
+        InvalidValue,
+        ExtraArgument,
+    } type;
+    const char* arg = nullptr;
+
+    [[nodiscard]] constexpr std::string_view errmsg() const {
+        constexpr std::string_view errmsg_sv[] = {
+            [MissingInput] = "no input file given",
+            [UnknownOption] = "unknown option",
+            [MissingValue] = "missing value for option",
+            [InvalidValue] = "invalid value for option",
+            [ExtraArgument] = "unexpected extra argument",
+        };
+
+        return errmsg_sv[this->type];
+    }
+};
+
+inline constexpr std::string_view usage_text =
+    "   usage: scenedetect-cpp [options] <video_file>\n"
+    "   <video_file> may also be an HLS/DASH playlist, a directory of "
+    "segments\n"
+    "   or images, or an image pattern such as plate.%04d.exr\n"
+    "\n"
+    "   -t, --threshold <float>      cut threshold, mean abs luma diff "
+    "(default 20)\n"
+    "   -m, --min-scene-len <n>      minimum scene length in frames "
+    "(default 15)\n"
+    "   --flash-window <n>           drop cuts where the picture returns "
+    "within n\n"
+    "                                frames: flashes, strobes (default 0, "
+    "off)\n"
+    "   --transitions <n>            also cut on dissolves, fades and wipes "
+    "up to\n"
+    "                                n frames long (default 0, off)\n"
+    "   --weights <y,u,v>            plane weights of the score, e.g. "
+    "1,0.5,0.5 to\n"
+    "                                catch hue-only cuts (default 1,0,0)\n"
+    "   --scene-images <pick>        save one image per scene: first, "
+    "middle, sharpest\n"
+    "   --image-format <fmt>         jpg or png (default jpg)\n"
+    "   --image-dir <dir>            output directory for scene images\n"
+    "   --image-threads <n>          image encoder workers (default: "
+    "half the cores)\n"
+    "   --keyframes <file>           write cuts as encoder keyframe hints\n"
+    "   --keyframes-format <fmt>     qpfile (x264/x265), svt-av1, frames, "
+    "ffmpeg\n"
+    "                                (default qpfile)\n"
+    "   --cache-dir <dir>            reuse results for inputs seen before\n"
+    "   --thumbs <file>              also store per-frame thumbnails; pass "
+    "the\n"
+    "                                file as input to re-run detection on "
+    "them\n"
+    "   --thumb-width <n>            thumbnail width in pixels (default "
+    "64 or\n"
+    "                                calibrated)\n"
+    "   --segment-threads <n>        segments of an .m3u8/.mpd/directory "
+    "decoded\n"
+    "                                at once (default: cores)\n"
+    "   --intra-threads <n>          parallel decoders for intra-only "
+    "codecs and\n"
+    "                                image sequences (default: cores)\n"
+    "   --streams <all|i,j,...>      analyze several video streams in one "
+    "pass;\n"
+    "                                outputs get a -s<index> suffix\n"
+    "   --audio <mode>               off, report (silences and cuts they "
+    "support)\n"
+    "                                or confirm (drop cuts the audio does "
+    "not support;\n"
+    "                                not with the per-scene outputs)\n"
+    "   --crop <mode>                auto (leave out letterbox/pillarbox "
+    "bars) or\n"
+    "                                off (default auto)\n"
+    "   --motion <mode>              motion undone before cutting: blocks "
+    "(per\n"
+    "                                block), global (pans and tilts only) "
+    "or off\n"
+    "                                (default blocks)\n"
+    "   --mask <file|auto>           leave out the light pixels of an image, "
+    "or\n"
+    "                                learn static logos and overlays\n"
+    "   --model <file>               cut where a learned model sees a "
+    "shot\n"
+    "                                boundary (written by "
+    "export_model.py)\n"
+    "   --scene-stats <file>         write duration, mean luma, motion, "
+    "color and\n"
+    "                                peak score of every scene as CSV\n"
+    "   --signatures <file>          write a signature of every scene, for "
+    "an index\n"
+    "   --build-index <file>         build a signature index from the "
+    "signature\n"
+    "                                files listed in the input, one per "
+    "line\n"
+    "   --find-reuse <index>         report scenes found in a signature "
+    "index\n"
+    "   --clusters <file>            group scenes showing the same setup "
+    "and write\n"
+    "                                the groups as CSV\n"
+    "   --metrics <file>             write per-frame scores and tile "
+    "statistics in a\n"
+    "                                columnar binary file (read with "
+    "metrics.py)\n"
+    "   --metrics-encoding <mode>    raw (default) or packed: delta coded "
+    "timestamps\n"
+    "   --profile <file>             machine profile to load; also picks "
+    "the\n"
+    "                                fastest decoder per codec (default: "
+    "$SCENEDETECT_PROFILE)\n"
+    "   --calibrate <file>           time decoder threads, queue depth, "
+    "thumbnail\n"
+    "                                size and SIMD level on the input and "
+    "write a\n"
+    "                                profile\n";
+
+[[nodiscard]] std::variant<Options, OptionError> parse_options(int argc,
+                                                               char** argv);
@@ -0,0 +1,340 @@
+#include "pipeline.h"
+
+#include <cstdio>
+#include <string_view>
+
+#include "flash.h"
+#include "machine_profile.h"
+#include "signature_index.h"
+#include "util.h"
+
+namespace {
+
+ScoreConfig make_score_config(const Options& opts) {
+    MaskSource mask = MaskSource::None;
+    if (opts.mask != nullptr) {
+        mask = std::string_view(opts.mask) == "auto" ? MaskSource::Learned
+                                                     : MaskSource::Image;
+    }
+    return ScoreConfig{
+        .thumb_width = resolved_thumb_width(opts),
+        .autocrop = opts.autocrop,
+        .mask = mask,
+        .weights = opts.weights,
+        .motion_above =
+            opts.motion != MotionMode::Off ? opts.threshold : 0.0,
+        .block_motion = opts.motion == MotionMode::Blocks,
+    };
+}
+
+} // namespace
+
+Pipeline::Pipeline(const Options& opts, AVRational time_base)
+    : time_base(time_base), detector(opts.threshold, opts.min_scene_len),
+      config(make_score_config(opts)), scorer(config),
+      source(opts.url), signatures_path(opts.signatures),
+      reuse_index(opts.reuse_index), clusters_path(opts.clusters),
+      thumbnailer(resolved_thumb_width(opts)) {
+    if (opts.flash_window > 0) {
+        flash.emplace(opts.flash_window, opts.threshold);
+    }
+    if (opts.transition_frames > 0) {
+        transitions.emplace(opts.threshold, opts.transition_frames);
+    }
+    if (const ShotModel* model = shot_model()) {
+        learned.emplace(*model);
+    }
+    if (opts.scene_image != ScenePick::None) {
+        images.emplace(opts.scene_image, opts.image_format, opts.image_dir,
+                       opts.image_prefix, opts.image_threads,
+                       opts.min_scene_len);
+    }
+    if (opts.thumbs_path != nullptr) {
+        thumb_store.emplace(opts.thumbs_path, time_base);
+    }
+    if (opts.scene_stats != nullptr) {
+        stats.emplace(opts.scene_stats, time_base);
+    }
+    if (signatures_path != nullptr || reuse_index != nullptr) {
+        signatures.emplace();
+    }
+    if (clusters_path != nullptr) {
+        clusters.emplace();
+    }
+    if (opts.metrics != nullptr) {
+        metrics.emplace(opts.metrics, time_base, opts.metrics_packed);
+    }
+}
+
+void Pipeline::push_frame(const AVFrame* cur, const AVFrame* prev,
+                          int64_t frame_idx) {
+    if (prev == nullptr) [[unlikely]] {
+        start_pts = cur->best_effort_timestamp;
+    }
+    FrameScore score{
+        .frame = frame_idx,
+        .pts = cur->best_effort_timestamp,
+        .sad = prev != nullptr ? scorer.score(prev, cur) : 0.0,
+    };
+    const bool grids =
+        flash || transitions || signatures || clusters || metrics;
+    const bool direct = has_luma_plane(cur->format);
+    // one thumbnail serves the store, the scene statistics and the tile
+    // grid of frames without an 8-bit luma plane
+    const bool made = (thumb_store || stats || (grids && !direct)) &&
+                      thumbnailer.make(cur, thumb);
+    if (stats && made) {
+        score.means = plane_means(thumb);
+    }
+
+    TileGrid grid;
+    if (grids && direct) {
+        grid = TileGrid::of(PlaneView{.data = cur->data[0],
+                                      .stride = cur->linesize[0],
+                                      .width = cur->width,
+                                      .height = cur->height});
+    } else if (grids && made) {
+        grid = TileGrid::of(thumb.plane(0));
+    } else if (grids && !grid_warned) {
+        (void)fprintf(stderr, "Tile grids unavailable: unsupported pixel "
+                              "format; flash, transition, signature, "
+                              "cluster and metric outputs are degraded\n");
+        grid_warned = true;
+    }
+    if (images) {
+        images->push(cur, frame_idx);
+    }
+    if (learned) {
+        learned->push(cur);
+    }
+    predict(score, grid);
+
+    if (thumb_store) {
+        write_thumbnail(made, cur->best_effort_timestamp);
+    }
+}
+
+void Pipeline::predict(const FrameScore& score, const TileGrid& grid) {
+    if (!learned) {
+        decide(score, grid);
+        return;
+    }
+
+    pending.push_back(Pending{.score = score, .grid = grid});
+    release_learned();
+}
+
+void Pipeline::release_learned() {
+    while (auto p = learned->pop()) {
+        Pending next = pending.front();
+        pending.pop_front();
+        next.score.boundary = *p;
+        decide(next.score, next.grid);
+    }
+}
+
+void Pipeline::decide(const FrameScore& score, const TileGrid& grid) {
+    if (!flash) {
+        judge(score, grid);
+        return;
+    }
+
+    flash->push(score, grid);
+    release_decided();
+}
+
+void Pipeline::release_decided() {
+    while (auto decided = flash->pop()) {
+        judge(decided->score, decided->grid);
+    }
+}
+
+void Pipeline::judge(const FrameScore& score, const TileGrid& grid) {
+    const bool cut = is_cut(score, grid);
+    if (stats) {
+        int ret = stats->push(score, cut);
+        if (ret < 0) {
+            print_averror("Failed to write", "scene statistics", ret);
+            stats.reset();
+            stats_failed = true;
+        }
+    }
+    if (signatures) {
+        signatures->push(score, grid, cut);
+    }
+    if (clusters) {
+        clusters->push(score, grid, cut);
+    }
+    if (metrics) {
+        int ret = metrics->push(score, grid, cut);
+        if (ret < 0) {
+            print_averror("Failed to write", "frame metrics", ret);
+            metrics.reset();
+            metrics_failed = true;
+        }
+    }
+    if (images) {
+        images->decide(score.frame, cut);
+    }
+}
+
+bool Pipeline::is_cut(const FrameScore& score, const TileGrid& grid) {
+    const bool gradual = transitions && transitions->push(score, grid);
+    if (score.frame == 0) {
+        return false;
+    }
+    if (score.boundary >= 0.0F) {
+        // the model replaces the score threshold; transitions still count
+        return (score.boundary >= LearnedDetector::cut_probability ||
+                gradual) &&
+               detector.push_cut(score);
+    }
+    return detector.push(score) || (gradual && detector.push_cut(score));
+}
+
+void Pipeline::write_thumbnail(bool made, int64_t pts) {
+    if (!made) {
+        (void)fprintf(stderr,
+                      "Thumbnail store disabled: unsupported pixel format\n");
+        thumb_store.reset();
+        thumb_store_failed = true;
+        return;
+    }
+
+    int ret = thumb_store->append(thumb, pts);
+    if (ret < 0) {
+        print_averror("Failed to write", "thumbnail store", ret);
+        thumb_store.reset();
+        thumb_store_failed = true;
+    }
+}
+
+void Pipeline::push_score(const FrameScore& score) {
+    if (score.frame == 0) {
+        start_pts = score.pts;
+    } else {
+        detector.push(score);
+    }
+}
+
+void Pipeline::push_thumbnail(const Thumbnail& cur, int64_t frame_idx,
+                              int64_t pts) {
+    // Scores come from the stored luma thumbnails, so thresholds tuned on
+    // full resolution frames are close but not identical.
+    FrameScore score{.frame = frame_idx, .pts = pts, .sad = 0.0};
+    if (stats) {
+        score.means = plane_means(cur);
+    }
+    if (frame_idx > 0) [[likely]] {
+        PlaneView a = prev_thumb.plane(0);
+        PlaneView b = cur.plane(0);
+        uint32_t sad =
+            calc_frame_sad(a.data, b.data, b.width, b.height, b.stride);
+        score.sad = static_cast<double>(sad) / (b.width * b.height);
+        if (config.motion_above > 0.0 && score.sad >= config.motion_above) {
+            score.sad = thumb_motion.compensated_score(a, b, score.sad);
+        }
+    } else {
+        start_pts = pts;
+    }
+    const bool grids =
+        flash || transitions || signatures || clusters || metrics;
+    if (learned) {
+        learned->push(cur);
+    }
+    predict(score, grids ? TileGrid::of(cur.plane(0)) : TileGrid{});
+
+    prev_thumb.width = cur.width;
+    prev_thumb.height = cur.height;
+    prev_thumb.data = cur.data;
+}
+
+bool Pipeline::finish() {
+    bool ok = true;
+
+    if (learned) {
+        learned->flush();
+        release_learned();
+    }
+    if (flash) {
+        flash->flush();
+        release_decided();
+    }
+
+    if (signatures) {
+        signatures->finish();
+        int ret = 0;
+        if (signatures_path != nullptr) {
+            ret = write_signatures(signatures_path, source,
+                                   signatures->scenes());
+            if (ret < 0) {
+                print_averror("Failed to write", signatures_path, ret);
+                ok = false;
+            }
+        }
+        if (reuse_index != nullptr) {
+            ret = print_reuse(reuse_index, signatures->scenes());
+            if (ret < 0) {
+                print_averror("Failed to read", reuse_index, ret);
+                ok = false;
+            }
+        }
+    }
+
+    if (clusters) {
+        clusters->finish();
+        int ret = clusters->write(clusters_path);
+        if (ret < 0) {
+            print_averror("Failed to write", clusters_path, ret);
+            ok = false;
+        }
+    }
+
+    if (metrics) {
+        int ret = metrics->close();
+        if (ret < 0) {
+            print_averror("Failed to write", "frame metrics", ret);
+            ok = false;
+        }
+    }
+
+    if (stats) {
+        int ret = stats->close();
+        if (ret < 0) {
+            print_averror("Failed to write", "scene statistics", ret);
+            ok = false;
+        }
+    }
+
+    if (images) {
+        int failed = images->finish();
+        if (failed > 0) {
+            (void)fprintf(stderr, "%d scene images failed\n", failed);
+            ok = false;
+        }
+    }
+
+    if (thumb_store) {
+        int ret = thumb_store->close();
+        if (ret < 0) {
+            print_averror("Failed to write", "thumbnail store", ret);
+            ok = false;
+        }
+    }
+
+    // the flushes above still judge frames, so writes can fail up to here
+    return ok && !thumb_store_failed && !stats_failed && !metrics_failed;
+}
+
+DetectionResult Pipeline::result(int64_t frames) const {
+    return DetectionResult{
+        .frames = frames,
+        .cuts =
+            CutList{
+                .frames = detector.cuts(),
+                .pts = detector.cut_pts(),
+                .start_pts = start_pts,
+                .time_base = time_base,
+            },
+    };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+#include "cluster.h"
+#include "detect.h"
+#include "flash.h"
+#include "learned.h"
+#include "metrics.h"
+#include "options.h"
+#include "scene_images.h"
+#include "scene_stats.h"
+#include "signature.h"
+#include "thumb_store.h"
+#include "thumbnail.h"
+#include "transition.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+}
+
+// Everything that consumes decoded frames, in presentation order.
+class Pipeline {
+  public:
+    Pipeline(const Options& opts, AVRational time_base);
+
+    // for scorers that run outside the pipeline, e.g. per segment
+    [[nodiscard]] const ScoreConfig& score_config() const { return config; }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // `prev` is the previously pushed frame, or nullptr for the first one.
+    void push_frame(const AVFrame* cur, const AVFrame* prev,
+                    int64_t frame_idx);
+
+    void set_time_base(AVRational tb) { time_base = tb; }
+
+    // Score computed elsewhere, e.g. by segment-parallel decoding. Frame 0
+    // only carries the start timestamp. Consumers that need pixels do not
+    // see these frames, and neither does the flash filter.
+    void push_score(const FrameScore& score);
+
+    // Input replayed from a thumbnail store instead of a decoder.
+    void push_thumbnail(const Thumbnail& thumb, int64_t frame_idx,
+                        int64_t pts);
+
+    // Flushes the detectors, writes the outputs and waits for the image
+    // workers. Returns false if any output could not be written.
+    [[nodiscard]] bool finish();
+
+    [[nodiscard]] DetectionResult result(int64_t frames) const;
+
+  private:
+    // a frame waiting for its learned boundary probability
+    struct Pending {
+        FrameScore score;
+        TileGrid grid;
+    };
+
+    // Passes a frame on to decide() once the learned detector has a
+    // probability for it, or right away without one.
+    void predict(const FrameScore& score, const TileGrid& grid);
+    void release_learned();
+    // Passes a score to the detector, through the flash filter when there
+    // is one.
+    void decide(const FrameScore& score, const TileGrid& grid);
+    void release_decided();
+    // Final cut decision for one frame, which closes the scene statistics
+    // and the scene image on a cut.
+    void judge(const FrameScore& score, const TileGrid& grid);
+    [[nodiscard]] bool is_cut(const FrameScore& score, const TileGrid& grid);
+    // `made` is false if the frame could not be turned into `thumb`
+    void write_thumbnail(bool made, int64_t pts);
+
+    AVRational time_base;
+    SceneDetector detector;
+    ScoreConfig config;
+    FrameScorer scorer;
+    std::optional<FlashFilter> flash;
+    std::optional<TransitionDetector> transitions;
+    std::optional<LearnedDetector> learned;
+    // frames pushed to the learned detector and not predicted yet
+    std::deque<Pending> pending;
+    int64_t start_pts{0};
+
+    // sees frames as they are decoded and the cuts once they are decided
+    std::optional<SceneImageWriter> images;
+    std::optional<SceneStatsWriter> stats;
+    bool stats_failed{false};
+
+    // for --signatures and --find-reuse
+    std::optional<SignatureCollector> signatures;
+    const char* source;
+    const char* signatures_path;
+    const char* reuse_index;
+
+    // for --clusters
+    std::optional<ShotClusterer> clusters;
+    const char* clusters_path;
+
+    std::optional<MetricsWriter> metrics;
+    bool metrics_failed{false};
+
+    std::optional<ThumbStoreWriter> thumb_store;
+    Thumbnailer thumbnailer;
+    Thumbnail thumb;
+    Thumbnail prev_thumb;
+    // pans in replayed thumbnails
+    GlobalMotion thumb_motion;
+    bool thumb_store_failed{false};
+    // set once the missing tile grids have been reported
+    bool grid_warned{false};
+};
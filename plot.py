@@ -1,16 +1,30 @@
+import sys
+
 import pandas as pd
 import matplotlib.pyplot as plt
 
-file_name = "data.txt"
+from metrics import is_metrics_file, read_metrics
 
-# read data from file
-data = pd.read_csv(file_name, header=None)
+file_name = sys.argv[1] if len(sys.argv) > 1 else "data.txt"
 
-# plot data
 plt.figure(figsize=(10, 6))
-plt.plot(data[0])
-plt.title("Plot from Text File Data")
-plt.xlabel("Line Number")
-plt.ylabel("Value")
+if is_metrics_file(file_name):
+    # per-frame metrics written by --metrics, with the cuts marked
+    data = read_metrics(file_name)
+    plt.plot(data["frame"], data["sad"], linewidth=0.5)
+    for frame in data["frame"][data["cut"] != 0]:
+        plt.axvline(frame, color="red", alpha=0.3, linewidth=0.5)
+    plt.title(f"Frame scores of {file_name}")
+    plt.xlabel("Frame")
+    plt.ylabel("Score")
+else:
+    # read data from file
+    data = pd.read_csv(file_name, header=None)
+
+    # plot data
+    plt.plot(data[0])
+    plt.title("Plot from Text File Data")
+    plt.xlabel("Line Number")
+    plt.ylabel("Value")
 plt.grid(True)
 plt.show()
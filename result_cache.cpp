@@ -0,0 +1,258 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "machine_profile.h"
+
+extern "C" {
+#include <libavutil/error.h>
+#include <libavutil/sha.h>
+}
+
+namespace {
+
+constexpr size_t header_bytes = 64 * 1024;
+constexpr size_t sample_bytes = 4 * 1024;
+constexpr int sample_count = 32;
+
+// bumped whenever the detector or the file layout changes meaning
+constexpr int cache_version = 2;
+// more cuts than any real input has; bounds the allocation of a damaged
+// entry
+constexpr size_t max_cuts = size_t{1} << 24;
+
+using ShaPtr = std::unique_ptr<AVSHA, decltype([](AVSHA* ctx) {
+                                   av_free(ctx);
+                               })>;
+
+std::string to_hex(const uint8_t* digest, size_t len) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string out(len * 2, '0');
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[digest[i] >> 4];
+        out[(2 * i) + 1] = digits[digest[i] & 0xF];
+    }
+    return out;
+}
+
+std::string sha256_hex(ShaPtr& sha) {
+    std::array<uint8_t, 32> digest{};
+    av_sha_final(sha.get(), digest.data());
+    return to_hex(digest.data(), digest.size());
+}
+
+std::string cache_path(const char* dir, const std::string& key) {
+    std::string path = dir;
+    path += '/';
+    path += key;
+    path += ".txt";
+    return path;
+}
+
+int make_dir(const char* dir) {
+#ifdef _WIN32
+    int ret = mkdir(dir);
+#else
+    int ret = mkdir(dir, 0755);
+#endif
+    return ret == 0 || errno == EEXIST ? 0 : AVERROR(errno);
+}
+
+} // namespace
+
+std::optional<std::string> fingerprint_file(const char* path) {
+    struct stat st {};
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return std::nullopt;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return std::nullopt;
+    }
+    auto closer = std::unique_ptr<FILE, decltype([](FILE* f) {
+                                      (void)fclose(f);
+                                  })>(file);
+
+    ShaPtr sha(av_sha_alloc());
+    if (sha == nullptr || av_sha_init(sha.get(), 256) < 0) {
+        return std::nullopt;
+    }
+
+    const auto size = static_cast<uint64_t>(st.st_size);
+    std::array<uint8_t, 8> size_le{};
+    for (size_t i = 0; i < size_le.size(); i++) {
+        size_le[i] = static_cast<uint8_t>(size >> (8 * i));
+    }
+    av_sha_update(sha.get(), size_le.data(), size_le.size());
+
+    std::vector<uint8_t> buf(header_bytes);
+    auto hash_range = [&](uint64_t offset, size_t len) {
+        if (fseeko(file, static_cast<off_t>(offset), SEEK_SET) != 0) {
+            return false;
+        }
+        size_t got = fread(buf.data(), 1, len, file);
+        av_sha_update(sha.get(), buf.data(), got);
+        return got == len || feof(file) != 0;
+    };
+
+    if (!hash_range(0, header_bytes)) {
+        return std::nullopt;
+    }
+
+    // samples past the header, the last one ending at EOF
+    if (size > header_bytes + sample_bytes) {
+        const uint64_t span = size - header_bytes - sample_bytes;
+        for (int i = 1; i <= sample_count; i++) {
+            uint64_t offset = header_bytes + (span * i / sample_count);
+            if (!hash_range(offset, sample_bytes)) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    return sha256_hex(sha);
+}
+
+std::string result_cache_key(const std::string& fingerprint,
+                             const Options& opts) {
+    std::array<char, 256> settings{};
+    int len = snprintf(settings.data(), settings.size(),
+                       "v%d threshold=%.6f min_scene_len=%d crop=%d "
+                       "weights=%.6f,%.6f,%.6f flash=%d transitions=%d "
+                       "motion=%d thumb_width=%d",
+                       cache_version, opts.threshold, opts.min_scene_len,
+                       static_cast<int>(opts.autocrop), opts.weights[0],
+                       opts.weights[1], opts.weights[2], opts.flash_window,
+                       opts.transition_frames, static_cast<int>(opts.motion),
+                       resolved_thumb_width(opts));
+    std::string config(settings.data(),
+                       std::clamp<size_t>(len, 0, settings.size() - 1));
+    // mask images and models are keyed by content, so retraining a model
+    // or editing a mask in place misses the cache
+    auto add_file = [&](const char* name, const char* path) {
+        config += ' ';
+        config += name;
+        config += '=';
+        auto fp = fingerprint_file(path);
+        config += fp ? *fp : std::string(path);
+    };
+    if (opts.mask != nullptr) {
+        if (std::string_view(opts.mask) == "auto") {
+            config += " mask=auto";
+        } else {
+            add_file("mask", opts.mask);
+        }
+    }
+    if (opts.model != nullptr) {
+        add_file("model", opts.model);
+    }
+
+    ShaPtr sha(av_sha_alloc());
+    if (sha == nullptr || av_sha_init(sha.get(), 256) < 0) {
+        return {};
+    }
+    av_sha_update(sha.get(),
+                  reinterpret_cast<const uint8_t*>(fingerprint.data()),
+                  fingerprint.size());
+    av_sha_update(sha.get(), reinterpret_cast<const uint8_t*>(config.data()),
+                  config.size());
+    return sha256_hex(sha);
+}
+
+std::optional<DetectionResult> load_cached_result(const char* dir,
+                                                  const std::string& key) {
+    FILE* file = fopen(cache_path(dir, key).c_str(), "r");
+    if (file == nullptr) {
+        return std::nullopt;
+    }
+    auto closer = std::unique_ptr<FILE, decltype([](FILE* f) {
+                                      (void)fclose(f);
+                                  })>(file);
+
+    int version = 0;
+    size_t count = 0;
+    DetectionResult result;
+    if (fscanf(file,
+               "scenedetect-cpp-cache %d\n"
+               "frames %" SCNd64 "\n"
+               "start_pts %" SCNd64 "\n"
+               "time_base %d %d\n"
+               "cuts %zu\n",
+               &version, &result.frames, &result.cuts.start_pts,
+               &result.cuts.time_base.num, &result.cuts.time_base.den,
+               &count) != 6 ||
+        version != cache_version || result.frames < 0 || count > max_cuts ||
+        count > static_cast<uint64_t>(result.frames)) {
+        return std::nullopt;
+    }
+
+    result.cuts.frames.resize(count);
+    result.cuts.pts.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        if (fscanf(file, "%" SCNd64 " %" SCNd64 "\n", &result.cuts.frames[i],
+                   &result.cuts.pts[i]) != 2) {
+            return std::nullopt;
+        }
+    }
+
+    return result;
+}
+
+int store_cached_result(const char* dir, const std::string& key,
+                        const DetectionResult& result) {
+    int ret = make_dir(dir);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // write to a private file first so concurrent jobs never observe a
+    // partially written entry
+    std::string path = cache_path(dir, key);
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+
+    FILE* file = fopen(tmp.c_str(), "w");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+
+    (void)fprintf(file,
+                  "scenedetect-cpp-cache %d\n"
+                  "frames %" PRId64 "\n"
+                  "start_pts %" PRId64 "\n"
+                  "time_base %d %d\n"
+                  "cuts %zu\n",
+                  cache_version, result.frames, result.cuts.start_pts,
+                  result.cuts.time_base.num, result.cuts.time_base.den,
+                  result.cuts.frames.size());
+    for (size_t i = 0; i < result.cuts.frames.size(); i++) {
+        (void)fprintf(file, "%" PRId64 " %" PRId64 "\n", result.cuts.frames[i],
+                      result.cuts.pts[i]);
+    }
+
+    if (fclose(file) != 0) {
+        (void)remove(tmp.c_str());
+        return AVERROR(EIO);
+    }
+
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    (void)remove(path.c_str());
+#endif
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        ret = AVERROR(errno);
+        (void)remove(tmp.c_str());
+        return ret;
+    }
+
+    return 0;
+}
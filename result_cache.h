@@ -0,0 +1,25 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "detect.h"
+#include "options.h"
+
+// Content fingerprint of a local file: its size, the leading bytes (which
+// hold the container header) and evenly spaced samples through the payload.
+// Renaming or copying a file keeps its fingerprint. Returns std::nullopt for
+// inputs that are not regular files, e.g. network URLs.
+[[nodiscard]] std::optional<std::string> fingerprint_file(const char* path);
+
+// Cache key for a fingerprint combined with every setting that changes the
+// detector output.
+[[nodiscard]] std::string result_cache_key(const std::string& fingerprint,
+                                           const Options& opts);
+
+[[nodiscard]] std::optional<DetectionResult>
+load_cached_result(const char* dir, const std::string& key);
+
+// Returns 0 or a negative AVERROR.
+int store_cached_result(const char* dir, const std::string& key,
+                        const DetectionResult& result);
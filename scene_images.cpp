@@ -0,0 +1,399 @@
+#include "scene_images.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+
+#include "detect.h"
+#include "util.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/error.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+namespace {
+
+// Mean absolute horizontal + vertical luma gradient, sampled on every other
+// row. Blurry frames (motion blur, defocus, fades) score low.
+double luma_sharpness(PlaneView luma) {
+    const uint8_t* data = luma.data;
+    const ptrdiff_t stride = luma.stride;
+    const int w = luma.width - 1;
+    const int h = luma.height - 1;
+    if (w <= 0 || h <= 0) {
+        return 0.0;
+    }
+
+    uint64_t sum = 0;
+    for (int y = 0; y < h; y += 2) {
+        const uint8_t* row = data + (y * stride);
+        const uint8_t* below = row + stride;
+        uint32_t row_sum = 0;
+        for (int x = 0; x < w; x++) {
+            row_sum += std::abs(static_cast<int32_t>(row[x + 1]) - row[x]);
+            row_sum += std::abs(static_cast<int32_t>(below[x]) - row[x]);
+        }
+        sum += row_sum;
+    }
+
+    return static_cast<double>(sum) /
+           (static_cast<double>(w) * static_cast<double>((h + 1) / 2));
+}
+
+// Per-worker encoder state, reused as long as the frame geometry does not
+// change.
+struct ImageEncoder {
+    AVCodecContext* enc{nullptr};
+    SwsContext* sws{nullptr};
+    AVFrame* conv{nullptr};
+    AVPacket* pkt{nullptr};
+
+    ImageEncoder() = default;
+    ImageEncoder(const ImageEncoder&) = delete;
+    ImageEncoder& operator=(const ImageEncoder&) = delete;
+
+    ~ImageEncoder() {
+        avcodec_free_context(&enc);
+        sws_freeContext(sws);
+        av_frame_free(&conv);
+        av_packet_free(&pkt);
+    }
+
+    int reconfigure(ImageFormat format, int width, int height) {
+        if (enc != nullptr && enc->width == width && enc->height == height) {
+            return 0;
+        }
+
+        avcodec_free_context(&enc);
+        av_frame_free(&conv);
+
+        const bool jpeg = format == ImageFormat::Jpeg;
+        const auto* codec =
+            avcodec_find_encoder(jpeg ? AV_CODEC_ID_MJPEG : AV_CODEC_ID_PNG);
+        if (codec == nullptr) {
+            return AVERROR_ENCODER_NOT_FOUND;
+        }
+
+        enc = avcodec_alloc_context3(codec);
+        conv = av_frame_alloc();
+        if (pkt == nullptr) {
+            pkt = av_packet_alloc();
+        }
+        if (enc == nullptr || conv == nullptr || pkt == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+
+        enc->width = width;
+        enc->height = height;
+        enc->time_base = AVRational{1, 25};
+        enc->pix_fmt = jpeg ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_RGB24;
+        // encoding is already parallel across scenes
+        enc->thread_count = 1;
+        if (jpeg) {
+            enc->flags |= AV_CODEC_FLAG_QSCALE;
+            enc->global_quality = FF_QP2LAMBDA * 2;
+        }
+
+        int ret = avcodec_open2(enc, codec, nullptr);
+        if (ret < 0) {
+            return ret;
+        }
+
+        conv->format = enc->pix_fmt;
+        conv->width = width;
+        conv->height = height;
+        return av_frame_get_buffer(conv, 0);
+    }
+
+    int encode(ImageFormat format, const AVFrame* src, FILE* out) {
+        int ret = reconfigure(format, src->width, src->height);
+        if (ret < 0) {
+            return ret;
+        }
+
+        sws = sws_getCachedContext(
+            sws, src->width, src->height,
+            static_cast<AVPixelFormat>(src->format), conv->width,
+            conv->height, static_cast<AVPixelFormat>(conv->format),
+            SWS_BICUBIC, nullptr, nullptr, nullptr);
+        if (sws == nullptr) {
+            return AVERROR(EINVAL);
+        }
+
+        ret = av_frame_make_writable(conv);
+        if (ret < 0) {
+            return ret;
+        }
+        sws_scale(sws, src->data, src->linesize, 0, src->height, conv->data,
+                  conv->linesize);
+        if (format == ImageFormat::Jpeg) {
+            conv->quality = enc->global_quality;
+        }
+
+        ret = avcodec_send_frame(enc, conv);
+        if (ret < 0) {
+            return ret;
+        }
+
+        // image encoders emit exactly one packet per frame
+        while ((ret = avcodec_receive_packet(enc, pkt)) >= 0) {
+            auto size = static_cast<size_t>(pkt->size);
+            size_t written = fwrite(pkt->data, 1, size, out);
+            av_packet_unref(pkt);
+            if (written != size) {
+                return AVERROR(EIO);
+            }
+        }
+
+        return ret == AVERROR(EAGAIN) ? 0 : ret;
+    }
+};
+
+int resolve_threads(int threads) {
+    if (threads > 0) {
+        return threads;
+    }
+    return static_cast<int>(
+        std::max(1U, std::thread::hardware_concurrency() / 2));
+}
+
+} // namespace
+
+SceneImageWriter::SceneImageWriter(ScenePick pick, ImageFormat format,
+                                   const char* dir, const char* prefix,
+                                   int threads, int min_scene_len)
+    : pick(pick), format(format), dir(dir), prefix(prefix),
+      max_stride(std::max(1, min_scene_len)),
+      jobs(static_cast<size_t>(2 * resolve_threads(threads))) {
+    threads = resolve_threads(threads);
+
+    workers.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([this] { worker(); });
+    }
+}
+
+SceneImageWriter::~SceneImageWriter() {
+    if (!finished) {
+        jobs.close();
+        for (auto& t : workers) {
+            t.join();
+        }
+    }
+
+    for (auto& c : candidates) {
+        av_frame_free(&c.frame);
+    }
+    for (auto& c : undecided) {
+        av_frame_free(&c.frame);
+    }
+}
+
+void SceneImageWriter::push(const AVFrame* frame, int64_t frame_idx) {
+    if (pick == ScenePick::None) {
+        return;
+    }
+
+    double sharpness = 0.0;
+    if (pick == ScenePick::Sharpest) {
+        if (has_luma_plane(frame->format)) {
+            sharpness = luma_sharpness(PlaneView{.data = frame->data[0],
+                                                 .stride = frame->linesize[0],
+                                                 .width = frame->width,
+                                                 .height = frame->height});
+        } else if (thumbnailer.make(frame, thumb)) {
+            sharpness = luma_sharpness(thumb.plane(0));
+        }
+    }
+    AVFrame* ref = av_frame_clone(frame);
+    if (ref == nullptr) {
+        return;
+    }
+
+    // The newest frame is always kept, so the last scene has one too. It
+    // replaces the one before it while that leaves no gap over a stride.
+    const size_t n = undecided.size();
+    if (n >= 2 && frame_idx - undecided[n - 2].frame_idx <= undecided_stride) {
+        av_frame_free(&undecided.back().frame);
+        undecided.back() = {ref, frame_idx, sharpness};
+        return;
+    }
+    undecided.push_back({ref, frame_idx, sharpness});
+
+    while (undecided.size() > max_undecided && undecided_stride < max_stride) {
+        undecided_stride = std::min(2 * undecided_stride, max_stride);
+        thin_undecided();
+    }
+}
+
+void SceneImageWriter::thin_undecided() {
+    // drops every frame whose neighbours are at most a stride apart; the
+    // oldest and the newest frame stay
+    size_t kept = 1;
+    for (size_t i = 1; i + 1 < undecided.size(); i++) {
+        if (undecided[i + 1].frame_idx - undecided[kept - 1].frame_idx <=
+            undecided_stride) {
+            av_frame_free(&undecided[i].frame);
+        } else {
+            undecided[kept++] = undecided[i];
+        }
+    }
+    undecided[kept++] = undecided.back();
+    undecided.resize(kept);
+}
+
+void SceneImageWriter::decide(int64_t frame_idx, bool scene_start) {
+    if (scene_start) {
+        submit_scene();
+        scene++;
+        scene_start_idx = frame_idx;
+        taken = 0;
+        stride = 1;
+        best_sharpness = -1.0;
+    }
+    last_idx = frame_idx;
+
+    while (!undecided.empty() && undecided.front().frame_idx <= frame_idx) {
+        Candidate c = undecided.front();
+        undecided.pop_front();
+        if (c.frame_idx == frame_idx) {
+            take(c);
+        } else {
+            // never decided
+            av_frame_free(&c.frame);
+        }
+    }
+    // caught up with the decoder: sample densely again
+    if (undecided.size() <= max_undecided / 4 && undecided_stride > 1) {
+        undecided_stride /= 2;
+    }
+}
+
+void SceneImageWriter::take(Candidate c) {
+    switch (pick) {
+    case ScenePick::None:
+        av_frame_free(&c.frame);
+        break;
+
+    case ScenePick::First:
+        if (candidates.empty()) {
+            candidates.push_back(c);
+        } else {
+            av_frame_free(&c.frame);
+        }
+        break;
+
+    case ScenePick::Sharpest:
+        if (c.sharpness > best_sharpness) {
+            best_sharpness = c.sharpness;
+            for (auto& old : candidates) {
+                av_frame_free(&old.frame);
+            }
+            candidates.clear();
+            candidates.push_back(c);
+        } else {
+            av_frame_free(&c.frame);
+        }
+        break;
+
+    case ScenePick::Middle: {
+        const int64_t n = taken++;
+        if (n % stride != 0) {
+            av_frame_free(&c.frame);
+            break;
+        }
+        if (candidates.size() == max_candidates) {
+            // keep every other sample and halve the sample rate
+            size_t kept = 0;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (i % 2 == 0) {
+                    candidates[kept++] = candidates[i];
+                } else {
+                    av_frame_free(&candidates[i].frame);
+                }
+            }
+            candidates.resize(kept);
+            stride *= 2;
+            if (n % stride != 0) {
+                av_frame_free(&c.frame);
+                break;
+            }
+        }
+        candidates.push_back(c);
+        break;
+    }
+    }
+}
+
+void SceneImageWriter::submit_scene() {
+    if (candidates.empty()) {
+        (void)fprintf(stderr, "No image for scene %lld\n",
+                      static_cast<long long>(scene));
+        return;
+    }
+
+    size_t chosen = 0;
+    if (pick == ScenePick::Middle) {
+        int64_t middle = scene_start_idx + ((last_idx - scene_start_idx) / 2);
+        for (size_t i = 1; i < candidates.size(); i++) {
+            if (std::abs(candidates[i].frame_idx - middle) <
+                std::abs(candidates[chosen].frame_idx - middle)) {
+                chosen = i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (i == chosen && candidates[i].frame != nullptr) {
+            jobs.push(Job{.frame = candidates[i].frame, .scene = scene});
+        } else {
+            av_frame_free(&candidates[i].frame);
+        }
+    }
+    candidates.clear();
+}
+
+int SceneImageWriter::finish() {
+    if (!finished) {
+        submit_scene();
+        jobs.close();
+        for (auto& t : workers) {
+            t.join();
+        }
+        finished = true;
+    }
+    return failures.load();
+}
+
+void SceneImageWriter::worker() {
+    ImageEncoder encoder;
+    std::array<char, 4096> path{};
+
+    while (auto job = jobs.pop()) {
+        (void)snprintf(path.data(), path.size(), "%s/%s%05lld.%s", dir, prefix,
+                       static_cast<long long>(job->scene),
+                       format == ImageFormat::Jpeg ? "jpg" : "png");
+
+        int ret = AVERROR(EIO);
+        if (FILE* out = fopen(path.data(), "wb")) {
+            ret = encoder.encode(format, job->frame, out);
+            if (fclose(out) != 0 && ret >= 0) {
+                ret = AVERROR(EIO);
+            }
+        }
+
+        if (ret < 0) {
+            std::array<char, AV_ERROR_MAX_STRING_SIZE> errbuf{};
+            av_make_error_string(errbuf.data(), errbuf.size(), ret);
+            (void)fprintf(stderr, "Failed to write %s: %s\n", path.data(),
+                          errbuf.data());
+            failures++;
+        }
+
+        av_frame_free(&job->frame);
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "options.h"
+#include "thumbnail.h"
+#include "work_queue.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Picks one representative frame per scene while frames stream past the
+// detector, and hands a reference to it to a pool of image encoders. Nothing
+// is encoded on the decode thread and the input is only decoded once.
+class SceneImageWriter {
+  public:
+    // Images are written to "<dir>/<prefix><scene number>.<ext>". Scenes
+    // are at least `min_scene_len` frames long, except the last one.
+    SceneImageWriter(ScenePick pick, ImageFormat format, const char* dir,
+                     const char* prefix, int threads, int min_scene_len);
+    ~SceneImageWriter();
+
+    SceneImageWriter(const SceneImageWriter&) = delete;
+    SceneImageWriter& operator=(const SceneImageWriter&) = delete;
+
+    // Offers a frame as soon as it is decoded, before its cut is decided.
+    // `frame` is only borrowed; a new reference is taken if it is kept.
+    void push(const AVFrame* frame, int64_t frame_idx);
+
+    // The cut decision for a pushed frame, in frame order. `scene_start` is
+    // set for the first frame of every scene after the first one.
+    void decide(int64_t frame_idx, bool scene_start);
+
+    // Submits the image of the last scene and waits for all workers.
+    // Returns the number of images that failed to encode or write.
+    int finish();
+
+  private:
+    struct Job {
+        AVFrame* frame;
+        int64_t scene;
+    };
+
+    struct Candidate {
+        AVFrame* frame;
+        int64_t frame_idx;
+        double sharpness;
+    };
+
+    // Adds a decided frame to the candidates of the current scene, or
+    // frees it.
+    void take(Candidate c);
+    void thin_undecided();
+    void submit_scene();
+    void worker();
+
+    ScenePick pick;
+    ImageFormat format;
+    const char* dir;
+    const char* prefix;
+
+    int64_t scene{0};
+    int64_t scene_start_idx{0};
+    int64_t last_idx{-1};
+
+    // Frames pushed but not decided yet. Cuts can be decided long after
+    // the frame was decoded (learned detector, flash filter), so these are
+    // kept at most `undecided_stride` frames apart. The stride doubles while
+    // more than max_undecided frames wait, up to the minimum scene length
+    // so that no scene is left without a candidate, and halves again once
+    // the decisions catch up. Without a delay every frame is a candidate;
+    // with one, a scene's first candidate may be up to a stride late.
+    static constexpr size_t max_undecided = 16;
+    std::deque<Candidate> undecided;
+    int64_t undecided_stride{1};
+    int64_t max_stride;
+
+    // First/Sharpest keep a single candidate. Middle keeps up to
+    // max_candidates of the decided frames, sampling every `stride`-th one
+    // and halving the sample rate whenever the list fills up, so memory
+    // stays bounded no matter how long the scene is.
+    static constexpr size_t max_candidates = 8;
+    std::vector<Candidate> candidates;
+    int64_t taken{0};
+    int64_t stride{1};
+    double best_sharpness{-1.0};
+
+    // Sharpness of frames without an 8-bit luma plane is measured on a
+    // thumbnail this wide.
+    static constexpr int sharpness_width = 320;
+    Thumbnailer thumbnailer{sharpness_width};
+    Thumbnail thumb;
+
+    WorkQueue<Job> jobs;
+    std::vector<std::thread> workers;
+    std::atomic<int> failures{0};
+    bool finished{false};
+};
@@ -0,0 +1,104 @@
+#include "scene_stats.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+std::array<float, 3> plane_means(const Thumbnail& thumb) {
+    std::array<float, 3> means{0.0F, 128.0F, 128.0F};
+    const auto sum = kernels().sum;
+    for (int p = 0; p < 3; p++) {
+        PlaneView v = thumb.plane(p);
+        if (v.width > 0 && v.height > 0) {
+            means[p] = static_cast<float>(
+                static_cast<double>(sum(v.data, v.stride, v.width, v.height)) /
+                (static_cast<double>(v.width) * v.height));
+        }
+    }
+    return means;
+}
+
+SceneStatsWriter::~SceneStatsWriter() { (void)close(); }
+
+int SceneStatsWriter::push(const FrameScore& score, bool scene_start) {
+    if (closed) {
+        return AVERROR(EINVAL);
+    }
+    if (file == nullptr) {
+        file = fopen(path, "w");
+        if (file == nullptr) {
+            return AVERROR(errno);
+        }
+        (void)fputs("scene,first_frame,frames,start,duration,mean_luma,"
+                    "motion,mean_u,mean_v,max_score\n",
+                    file);
+        stream_start_pts = score.pts;
+        open = SceneStats{.first_frame = score.frame,
+                          .start_pts = score.pts};
+    } else if (scene_start) {
+        const double duration =
+            static_cast<double>(score.pts - open.start_pts) *
+            av_q2d(time_base);
+        int ret = write_scene(duration);
+        if (ret < 0) {
+            return ret;
+        }
+        open = SceneStats{.first_frame = score.frame,
+                          .start_pts = score.pts};
+    } else {
+        open.score_sum += score.sad;
+        open.max_score = std::max(open.max_score, score.sad);
+    }
+
+    open.frames++;
+    open.last_pts = score.pts;
+    for (size_t p = 0; p < score.means.size(); p++) {
+        open.mean_sum[p] += score.means[p];
+    }
+    return 0;
+}
+
+int SceneStatsWriter::write_scene(double duration) {
+    const auto frames = static_cast<double>(open.frames);
+    const double motion =
+        open.frames > 1 ? open.score_sum / (frames - 1.0) : 0.0;
+    const double start =
+        static_cast<double>(open.start_pts - stream_start_pts) *
+        av_q2d(time_base);
+    int len = fprintf(file,
+                      "%lld,%lld,%lld,%.6f,%.6f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                      static_cast<long long>(scenes),
+                      static_cast<long long>(open.first_frame),
+                      static_cast<long long>(open.frames), start, duration,
+                      open.mean_sum[0] / frames, motion,
+                      open.mean_sum[1] / frames, open.mean_sum[2] / frames,
+                      open.max_score);
+    scenes++;
+    return len < 0 ? AVERROR(EIO) : 0;
+}
+
+int SceneStatsWriter::close() {
+    if (closed || file == nullptr) {
+        return 0;
+    }
+    closed = true;
+
+    // the last frame lasts as long as the average one before it
+    double duration = 0.0;
+    if (open.frames > 1) {
+        const auto span = static_cast<double>(open.last_pts - open.start_pts);
+        duration = span * static_cast<double>(open.frames) /
+                   static_cast<double>(open.frames - 1) * av_q2d(time_base);
+    }
+    int ret = write_scene(duration);
+    if (fclose(file) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    file = nullptr;
+    return ret;
+}
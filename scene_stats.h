@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+#include "detect.h"
+#include "thumbnail.h"
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+// Mean Y, U and V of a thumbnail; gray ones have U = V = 128.
+[[nodiscard]] std::array<float, 3> plane_means(const Thumbnail& thumb);
+
+// Running totals of the scene that is still open. Fixed size, however long
+// the scene runs.
+struct SceneStats {
+    int64_t first_frame{0};
+    int64_t frames{0};
+    int64_t start_pts{0};
+    int64_t last_pts{0};
+    std::array<double, 3> mean_sum{};
+    // scores between frames of the scene, not the one that opened it
+    double score_sum{0.0};
+    double max_score{0.0};
+};
+
+// Writes one CSV row per scene as soon as the cut after it is decided, so
+// downstream tools get duration, brightness, motion and color without
+// decoding the scenes again:
+//   scene,first_frame,frames,start,duration,mean_luma,motion,mean_u,
+//   mean_v,max_score
+// Times are seconds from the first frame, motion is the mean frame score
+// inside the scene.
+class SceneStatsWriter {
+  public:
+    SceneStatsWriter(const char* path, AVRational time_base)
+        : path(path), time_base(time_base) {}
+    ~SceneStatsWriter();
+
+    SceneStatsWriter(const SceneStatsWriter&) = delete;
+    SceneStatsWriter& operator=(const SceneStatsWriter&) = delete;
+
+    // Takes every frame in order with the cut decision on it; the file is
+    // created on the first call. Returns 0 or a negative AVERROR.
+    int push(const FrameScore& score, bool scene_start);
+
+    // Writes the last scene and closes the file.
+    int close();
+
+  private:
+    int write_scene(double duration);
+
+    const char* path;
+    AVRational time_base;
+    FILE* file{nullptr};
+    SceneStats open;
+    int64_t scenes{0};
+    int64_t stream_start_pts{0};
+    bool closed{false};
+};
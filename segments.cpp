@@ -0,0 +1,566 @@
+#include "segments.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+
+#include "decode.h"
+#include "util.h"
+#include "work_queue.h"
+
+extern "C" {
+#include <libavformat/avio.h>
+#include <libavutil/mem.h>
+}
+
+namespace {
+
+bool ends_with(std::string_view s, std::string_view suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool is_remote(std::string_view uri) {
+    return uri.find("://") != std::string_view::npos;
+}
+
+bool file_exists(const std::string& path) {
+    struct stat st {};
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+std::string parent_dir(std::string_view path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string_view::npos ? std::string(".")
+                                           : std::string(path.substr(0, slash));
+}
+
+std::string resolve(const std::string& dir, std::string_view uri) {
+    if (!uri.empty() && uri[0] == '/') {
+        return std::string(uri);
+    }
+    std::string out = dir;
+    out += '/';
+    out += uri;
+    return out;
+}
+
+std::optional<std::string> read_text(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return std::nullopt;
+    }
+    std::string text;
+    std::array<char, 4096> buf{};
+    size_t got = 0;
+    while ((got = fread(buf.data(), 1, buf.size(), file)) > 0) {
+        text.append(buf.data(), got);
+    }
+    (void)fclose(file);
+    return text;
+}
+
+// value of `name="..."` inside `tag`, or an empty view
+std::string_view attribute(std::string_view tag, std::string_view name) {
+    size_t pos = 0;
+    while ((pos = tag.find(name, pos)) != std::string_view::npos) {
+        bool starts_word = pos == 0 || tag[pos - 1] == ' ' ||
+                           tag[pos - 1] == '\t' || tag[pos - 1] == '\n' ||
+                           tag[pos - 1] == ',' || tag[pos - 1] == ':';
+        size_t eq = pos + name.size();
+        if (starts_word && eq + 1 < tag.size() && tag[eq] == '=' &&
+            tag[eq + 1] == '"') {
+            size_t end = tag.find('"', eq + 2);
+            if (end == std::string_view::npos) {
+                return {};
+            }
+            return tag.substr(eq + 2, end - eq - 2);
+        }
+        pos = eq;
+    }
+    return {};
+}
+
+std::optional<SegmentList> segments_from_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == nullptr) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> ts;
+    std::vector<std::string> m4s;
+    std::string init;
+    while (dirent* entry = readdir(dir)) {
+        std::string_view name = entry->d_name;
+        if (ends_with(name, ".ts")) {
+            ts.emplace_back(name);
+        } else if (name.find("init") != std::string_view::npos &&
+                   (ends_with(name, ".mp4") || ends_with(name, ".m4s"))) {
+            init = name;
+        } else if (ends_with(name, ".m4s")) {
+            m4s.emplace_back(name);
+        }
+    }
+    closedir(dir);
+
+    const std::string base = path;
+    SegmentList list;
+    auto& names = m4s.empty() ? ts : m4s;
+    if (names.empty() || (!m4s.empty() && init.empty())) {
+        return std::nullopt;
+    }
+    if (!m4s.empty()) {
+        list.init = resolve(base, init);
+    }
+
+    std::sort(names.begin(), names.end(), natural_less);
+    for (const auto& name : names) {
+        list.segments.push_back(resolve(base, name));
+    }
+    return list;
+}
+
+std::optional<SegmentList> segments_from_m3u8(const char* path, int depth) {
+    auto text = read_text(path);
+    if (!text) {
+        return std::nullopt;
+    }
+
+    const std::string base = parent_dir(path);
+    SegmentList list;
+    bool variant_next = false;
+
+    std::string_view rest = *text;
+    while (!rest.empty()) {
+        size_t nl = rest.find('\n');
+        std::string_view line = rest.substr(0, nl);
+        rest = nl == std::string_view::npos ? std::string_view{}
+                                            : rest.substr(nl + 1);
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line[0] == '#') {
+            if (line.starts_with("#EXT-X-STREAM-INF")) {
+                variant_next = true;
+            } else if (line.starts_with("#EXT-X-MAP:")) {
+                std::string_view uri = attribute(line, "URI");
+                if (uri.empty() || is_remote(uri) ||
+                    !attribute(line, "BYTERANGE").empty()) {
+                    return std::nullopt;
+                }
+                list.init = resolve(base, uri);
+            } else if (line.starts_with("#EXT-X-KEY:")) {
+                if (attribute(line, "METHOD") != "NONE") {
+                    return std::nullopt;
+                }
+            } else if (line.starts_with("#EXT-X-BYTERANGE")) {
+                return std::nullopt;
+            }
+            continue;
+        }
+
+        if (is_remote(line)) {
+            return std::nullopt;
+        }
+        std::string uri = resolve(base, line);
+
+        // master playlist: follow the first variant
+        if (variant_next) {
+            if (depth > 0) {
+                return std::nullopt;
+            }
+            return segments_from_m3u8(uri.c_str(), depth + 1);
+        }
+        list.segments.push_back(std::move(uri));
+    }
+
+    if (list.segments.empty()) {
+        return std::nullopt;
+    }
+    return list;
+}
+
+// Expands $RepresentationID$, $Number$ and $Number%0Nd$.
+std::string expand_template(std::string_view tmpl, std::string_view rep_id,
+                            long long number) {
+    std::string out;
+    size_t pos = 0;
+    while (pos < tmpl.size()) {
+        size_t start = tmpl.find('$', pos);
+        if (start == std::string_view::npos) {
+            out.append(tmpl.substr(pos));
+            break;
+        }
+        out.append(tmpl.substr(pos, start - pos));
+        size_t end = tmpl.find('$', start + 1);
+        if (end == std::string_view::npos) {
+            out.append(tmpl.substr(start));
+            break;
+        }
+
+        std::string_view id = tmpl.substr(start + 1, end - start - 1);
+        if (id.empty()) {
+            out += '$';
+        } else if (id == "RepresentationID") {
+            out.append(rep_id);
+        } else if (id.starts_with("Number")) {
+            std::string fmt = "%";
+            std::string_view spec = id.substr(6);
+            if (spec.starts_with('%') && spec.ends_with('d')) {
+                fmt.append(spec.substr(1, spec.size() - 2));
+            }
+            fmt += "lld";
+            std::array<char, 32> buf{};
+            (void)snprintf(buf.data(), buf.size(), fmt.c_str(), number);
+            out.append(buf.data());
+        } else {
+            // $Time$ and $Bandwidth$ based addressing is not supported
+            return {};
+        }
+        pos = end + 1;
+    }
+    return out;
+}
+
+std::optional<SegmentList> segments_from_mpd(const char* path) {
+    auto text = read_text(path);
+    if (!text) {
+        return std::nullopt;
+    }
+    std::string_view mpd = *text;
+    const std::string base = parent_dir(path);
+
+    // first video adaptation set
+    std::string_view set;
+    for (size_t pos = 0;
+         (pos = mpd.find("<AdaptationSet", pos)) != std::string_view::npos;
+         pos++) {
+        size_t end = mpd.find("</AdaptationSet>", pos);
+        std::string_view block = mpd.substr(pos, end - pos);
+        std::string_view head = block.substr(0, block.find('>'));
+        if (attribute(head, "contentType") == "video" ||
+            attribute(head, "mimeType").starts_with("video/") ||
+            attribute(block, "mimeType").starts_with("video/")) {
+            set = block;
+            break;
+        }
+    }
+    if (set.empty()) {
+        return std::nullopt;
+    }
+
+    size_t rep_pos = set.find("<Representation");
+    std::string_view rep =
+        rep_pos == std::string_view::npos ? set : set.substr(rep_pos);
+    std::string_view rep_id =
+        attribute(rep.substr(0, rep.find('>')), "id");
+
+    SegmentList list;
+    auto add_checked = [&](std::string_view uri, std::string& out) {
+        if (uri.empty() || is_remote(uri)) {
+            return false;
+        }
+        out = resolve(base, uri);
+        return true;
+    };
+
+    // a SegmentList or SegmentTemplate on the representation wins over one
+    // on the adaptation set
+    size_t seg_list = rep.find("<SegmentList");
+    if (seg_list == std::string_view::npos) {
+        seg_list = set.find("<SegmentList");
+        rep = set;
+    }
+    if (seg_list != std::string_view::npos) {
+        std::string_view body = rep.substr(seg_list);
+        body = body.substr(0, body.find("</SegmentList>"));
+
+        size_t init_pos = body.find("<Initialization");
+        if (init_pos != std::string_view::npos &&
+            !add_checked(attribute(body.substr(init_pos), "sourceURL"),
+                         list.init)) {
+            return std::nullopt;
+        }
+        for (size_t pos = 0;
+             (pos = body.find("<SegmentURL", pos)) != std::string_view::npos;
+             pos++) {
+            std::string seg;
+            if (!add_checked(attribute(body.substr(pos), "media"), seg)) {
+                return std::nullopt;
+            }
+            list.segments.push_back(std::move(seg));
+        }
+    } else {
+        size_t tmpl_pos = set.find("<SegmentTemplate");
+        if (tmpl_pos == std::string_view::npos) {
+            return std::nullopt;
+        }
+        std::string_view tmpl = set.substr(tmpl_pos);
+        tmpl = tmpl.substr(0, tmpl.find('>'));
+
+        std::string_view start = attribute(tmpl, "startNumber");
+        long long number = start.empty() ? 1 : atoll(std::string(start).c_str());
+
+        std::string init = expand_template(attribute(tmpl, "initialization"),
+                                           rep_id, number);
+        if (!init.empty() && !add_checked(init, list.init)) {
+            return std::nullopt;
+        }
+
+        std::string_view media = attribute(tmpl, "media");
+        // the manifest may only describe durations, so count what is on disk
+        while (true) {
+            std::string uri = expand_template(media, rep_id, number++);
+            std::string seg;
+            if (uri.empty() || !add_checked(uri, seg) || !file_exists(seg)) {
+                break;
+            }
+            list.segments.push_back(std::move(seg));
+        }
+    }
+
+    if (list.segments.empty()) {
+        return std::nullopt;
+    }
+    return list;
+}
+
+// Reads an init segment followed by a media segment as one stream, which is
+// what the mp4 demuxer expects for fMP4.
+struct ConcatReader {
+    std::array<const char*, 2> paths{};
+    size_t next{0};
+    FILE* file{nullptr};
+
+    ConcatReader() = default;
+    ConcatReader(const ConcatReader&) = delete;
+    ConcatReader& operator=(const ConcatReader&) = delete;
+    ~ConcatReader() {
+        if (file != nullptr) {
+            (void)fclose(file);
+        }
+    }
+
+    static int read(void* opaque, uint8_t* buf, int size) {
+        auto* self = static_cast<ConcatReader*>(opaque);
+        while (true) {
+            if (self->file == nullptr) {
+                if (self->next == self->paths.size() ||
+                    self->paths[self->next] == nullptr) {
+                    return AVERROR_EOF;
+                }
+                self->file = fopen(self->paths[self->next++], "rb");
+                if (self->file == nullptr) {
+                    return AVERROR(errno);
+                }
+            }
+
+            size_t got = fread(buf, 1, static_cast<size_t>(size), self->file);
+            if (got > 0) {
+                return static_cast<int>(got);
+            }
+            (void)fclose(self->file);
+            self->file = nullptr;
+        }
+    }
+};
+
+// Scores of one segment. scores[0] belongs to the first frame and only
+// carries its timestamp.
+struct SegmentScores {
+    std::vector<FrameScore> scores;
+    AVFrame* first{nullptr};
+    AVFrame* last{nullptr};
+    AVRational time_base{1, 1};
+    int error{0};
+    std::optional<FrameScorer> scorer;
+
+    SegmentScores() = default;
+    SegmentScores(const SegmentScores&) = delete;
+    SegmentScores& operator=(const SegmentScores&) = delete;
+    ~SegmentScores() {
+        av_frame_free(&first);
+        av_frame_free(&last);
+    }
+
+    void push_frame(const AVFrame* cur, const AVFrame* prev,
+                    int64_t frame_idx) {
+        scores.push_back(FrameScore{
+            .frame = frame_idx,
+            .pts = cur->best_effort_timestamp,
+            .sad = prev != nullptr ? scorer->score(prev, cur) : 0.0,
+        });
+
+        if (first == nullptr) {
+            first = av_frame_clone(cur);
+        }
+        if (last == nullptr) {
+            last = av_frame_alloc();
+        }
+        av_frame_unref(last);
+        (void)av_frame_ref(last, cur);
+    }
+};
+
+int decode_segment(const SegmentList& list, size_t idx, int decoder_threads,
+                   SegmentScores& out) {
+    const char* path = list.segments[idx].c_str();
+
+    ConcatReader reader;
+    AVIOContext* pb = nullptr;
+    if (!list.init.empty()) {
+        reader.paths = {list.init.c_str(), path};
+
+        constexpr int io_size = 64 * 1024;
+        auto* io_buf = static_cast<uint8_t*>(av_malloc(io_size));
+        pb = io_buf != nullptr
+                 ? avio_alloc_context(io_buf, io_size, 0, &reader,
+                                      ConcatReader::read, nullptr, nullptr)
+                 : nullptr;
+        if (pb == nullptr) {
+            av_free(io_buf);
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    auto vdec = DecodeContext::open(path, pb);
+    if (auto* err = std::get_if<DecoderCreationError>(&vdec)) {
+        if (pb != nullptr) {
+            av_freep(&pb->buffer);
+            avio_context_free(&pb);
+        }
+        return err->type == DecoderCreationError::AVError ? err->averror
+                                                          : AVERROR(EINVAL);
+    }
+
+    auto& dc = std::get<DecodeContext>(vdec);
+    dc.decoder->thread_count = decoder_threads;
+    out.time_base = dc.stream->time_base;
+    return run_decoder(dc, out, false);
+}
+
+} // namespace
+
+std::optional<SegmentList> find_segments(const char* url) {
+    std::string_view sv = url;
+    if (is_remote(sv)) {
+        return std::nullopt;
+    }
+
+    struct stat st {};
+    if (stat(url, &st) != 0) {
+        return std::nullopt;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return segments_from_dir(url);
+    }
+    if (ends_with(sv, ".m3u8")) {
+        return segments_from_m3u8(url, 0);
+    }
+    if (ends_with(sv, ".mpd")) {
+        return segments_from_mpd(url);
+    }
+    return std::nullopt;
+}
+
+int64_t run_segments(const SegmentList& list, int threads,
+                     Pipeline& pipeline) {
+    const size_t count = list.segments.size();
+    const auto cores =
+        static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    if (threads <= 0) {
+        threads = cores;
+    }
+    threads = std::min(threads, static_cast<int>(count));
+    // whatever cores are left over go to frame threading inside each decoder
+    const int decoder_threads = std::max(1, cores / threads);
+
+    // at most this many segments are decoded ahead of the stitcher, so one
+    // slow segment cannot let the others pile up
+    ReorderBuffer<std::unique_ptr<SegmentScores>> results(
+        static_cast<size_t>(2 * threads));
+    results.finish(count);
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        size_t idx = 0;
+        while ((idx = next++) < count) {
+            if (!results.wait_for_slot(idx)) {
+                break;
+            }
+            auto seg = std::make_unique<SegmentScores>();
+            seg->scorer.emplace(pipeline.score_config());
+            seg->error = decode_segment(list, idx, decoder_threads, *seg);
+            results.put(idx, std::move(seg));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+
+    // stitch in order while later segments are still decoding
+    int64_t frames = 0;
+    int error = 0;
+    size_t idx = 0;
+    // the last segment with frames, kept for the score across the next
+    // boundary
+    std::unique_ptr<SegmentScores> prev;
+    while (auto popped = results.pop()) {
+        std::unique_ptr<SegmentScores> seg = std::move(*popped);
+        if (seg->error < 0) {
+            print_averror("Failed to decode", list.segments[idx].c_str(),
+                          seg->error);
+            error = seg->error;
+            results.close();
+            break;
+        }
+        idx++;
+        if (seg->scores.empty()) {
+            continue;
+        }
+        if (frames == 0) {
+            pipeline.set_time_base(seg->time_base);
+        }
+
+        for (size_t i = 0; i < seg->scores.size(); i++) {
+            FrameScore score = seg->scores[i];
+            score.frame = frames + static_cast<int64_t>(i);
+            if (i == 0 && prev != nullptr) {
+                // score across the segment boundary
+                score.sad = FrameScorer(pipeline.score_config())
+                                .score(prev->last, seg->first);
+            }
+            pipeline.push_score(score);
+        }
+        frames += static_cast<int64_t>(seg->scores.size());
+
+        // keep only what the next boundary needs
+        av_frame_free(&seg->first);
+        seg->scores = {};
+        seg->scorer.reset();
+        prev = std::move(seg);
+    }
+
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    return error != 0 ? error : frames;
+}
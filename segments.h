@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+// Independently decodable pieces of one rendition, in playback order.
+struct SegmentList {
+    // fMP4 initialization segment, prepended to every media segment; empty
+    // for MPEG-TS
+    std::string init;
+    std::vector<std::string> segments;
+};
+
+// Recognizes local HLS media playlists (.m3u8), DASH manifests with a
+// SegmentList or a $Number$ SegmentTemplate (.mpd), and directories of .ts
+// or .m4s files. Returns std::nullopt for anything else, including remote
+// or encrypted playlists, which are left to the regular demuxer.
+[[nodiscard]] std::optional<SegmentList> find_segments(const char* url);
+
+// Decodes up to `threads` segments at a time (0 = one per core) with their
+// own decoders and scores them, then feeds the scores to `pipeline` in order,
+// including the score across each segment boundary. Only score based
+// consumers see the input, and the pipeline takes the time base of the
+// segments. Returns the number of frames or a negative AVERROR.
+int64_t run_segments(const SegmentList& list, int threads,
+                     Pipeline& pipeline);
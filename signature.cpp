@@ -0,0 +1,155 @@
+#include "signature.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <numbers>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+constexpr uint32_t signature_version = 1;
+// DCT coefficients per axis that go into the hash
+constexpr int hash_size = 8;
+// standard deviation of the averaged grid below which a scene is flat
+constexpr double min_contrast = 3.0;
+// more scenes than any real input has; bounds the allocation of a damaged
+// file
+constexpr uint64_t max_scenes = uint64_t{1} << 24;
+
+// 64-bit perceptual hash of a cols x rows grid.
+uint64_t dct_hash(const std::array<double, TileGrid::cols * TileGrid::rows>&
+                      grid) {
+    constexpr int cols = TileGrid::cols;
+    constexpr int rows = TileGrid::rows;
+    constexpr double pi = std::numbers::pi;
+
+    std::array<double, hash_size * hash_size> coef{};
+    for (int v = 0; v < hash_size; v++) {
+        for (int u = 0; u < hash_size; u++) {
+            // the DC term only says how bright the scene is; the next
+            // horizontal frequency takes its place
+            const int fu = u == 0 && v == 0 ? hash_size : u;
+            double c = 0.0;
+            for (int y = 0; y < rows; y++) {
+                const double cy =
+                    std::cos(pi * ((2 * y) + 1) * v / (2 * rows));
+                for (int x = 0; x < cols; x++) {
+                    const double cx =
+                        std::cos(pi * ((2 * x) + 1) * fu / (2 * cols));
+                    c += grid[(y * cols) + x] * cx * cy;
+                }
+            }
+            coef[(v * hash_size) + u] = c;
+        }
+    }
+
+    auto sorted = coef;
+    std::nth_element(sorted.begin(), sorted.begin() + (sorted.size() / 2),
+                     sorted.end());
+    const double median = sorted[sorted.size() / 2];
+    uint64_t bits = 0;
+    for (size_t i = 0; i < coef.size(); i++) {
+        if (coef[i] > median) {
+            bits |= uint64_t{1} << i;
+        }
+    }
+    return bits;
+}
+
+} // namespace
+
+void SignatureCollector::push(const FrameScore& score, const TileGrid& grid,
+                              bool scene_start) {
+    if (scene_start) {
+        close_scene();
+    }
+    if (frames == 0) {
+        first_frame = score.frame;
+    }
+    frames++;
+    pool.add(grid);
+}
+
+void SignatureCollector::finish() { close_scene(); }
+
+void SignatureCollector::close_scene() {
+    if (frames == 0) {
+        return;
+    }
+    if (pool.frames > 0) {
+        const auto mean = pool.mean();
+        double sum = 0.0;
+        double sum_sq = 0.0;
+        for (double m : mean) {
+            sum += m;
+            sum_sq += m * m;
+        }
+        const auto n = static_cast<double>(mean.size());
+        const double variance = (sum_sq / n) - ((sum / n) * (sum / n));
+        if (variance >= min_contrast * min_contrast) {
+            signatures.push_back(SceneSignature{
+                .bits = dct_hash(mean),
+                .source = 0,
+                .reserved = 0,
+                .first_frame = first_frame,
+                .frames = frames,
+            });
+        }
+    }
+    pool = TilePool{};
+    frames = 0;
+}
+
+int write_signatures(const char* path, const char* source,
+                     const std::vector<SceneSignature>& scenes) {
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+
+    SignatureFileHeader hdr{};
+    memcpy(hdr.magic, signature_file_magic, sizeof(hdr.magic));
+    hdr.version = signature_version;
+    hdr.name_bytes = static_cast<uint32_t>(strlen(source));
+    hdr.scene_count = scenes.size();
+    const size_t scene_bytes = scenes.size() * sizeof(SceneSignature);
+    const bool written =
+        fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+        fwrite(source, 1, hdr.name_bytes, file) == hdr.name_bytes &&
+        fwrite(scenes.data(), 1, scene_bytes, file) == scene_bytes;
+    return fclose(file) == 0 && written ? 0 : AVERROR(EIO);
+}
+
+int read_signatures(const char* path, std::string& source,
+                    std::vector<SceneSignature>& scenes) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+    auto closer = std::unique_ptr<FILE, decltype([](FILE* f) {
+                                      (void)fclose(f);
+                                  })>(file);
+
+    SignatureFileHeader hdr{};
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        memcmp(hdr.magic, signature_file_magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != signature_version || hdr.name_bytes > 4096 ||
+        hdr.scene_count > max_scenes) {
+        return AVERROR_INVALIDDATA;
+    }
+    source.resize(hdr.name_bytes);
+    scenes.resize(hdr.scene_count);
+    const size_t scene_bytes = scenes.size() * sizeof(SceneSignature);
+    if (fread(source.data(), 1, source.size(), file) != source.size() ||
+        fread(scenes.data(), 1, scene_bytes, file) != scene_bytes) {
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
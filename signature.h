@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "detect.h"
+#include "flash.h"
+
+// Per-scene signatures for finding reused footage. A scene's tile grids
+// are averaged over all its frames, and the signature is a 64-bit
+// perceptual hash of that average: the sign of its low-frequency DCT
+// coefficients against their median. Re-encoding, scaling and small
+// trims move a few bits; different footage differs in about half.
+//
+// Signature file (little endian), one per input:
+//   SignatureFileHeader
+//   char source[name_bytes]     the input it was computed from
+//   SceneSignature scenes[scene_count]
+
+inline constexpr char signature_file_magic[8] = {'S', 'D', 'S', 'I',
+                                                 'G', 'S', '0', '1'};
+
+struct SignatureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t name_bytes;
+    uint64_t scene_count;
+};
+static_assert(sizeof(SignatureFileHeader) == 24);
+
+struct SceneSignature {
+    uint64_t bits;
+    // index of the input in a signature index, 0 elsewhere
+    uint32_t source;
+    uint32_t reserved;
+    int64_t first_frame;
+    int64_t frames;
+};
+static_assert(sizeof(SceneSignature) == 32);
+
+[[nodiscard]] inline int hamming_distance(uint64_t a, uint64_t b) {
+    return std::popcount(a ^ b);
+}
+
+// Builds the signatures of a stream's scenes from its frames' tile grids.
+// Scenes that are nearly flat (black, fades, title cards on a plain
+// background) hash to noise and get no signature.
+class SignatureCollector {
+  public:
+    // Takes every frame in order with the cut decision on it. Frames
+    // without a valid grid count towards the scene but not its average.
+    void push(const FrameScore& score, const TileGrid& grid,
+              bool scene_start);
+
+    // Closes the last scene.
+    void finish();
+
+    [[nodiscard]] const std::vector<SceneSignature>& scenes() const {
+        return signatures;
+    }
+
+  private:
+    void close_scene();
+
+    TilePool pool;
+    int64_t first_frame{0};
+    int64_t frames{0};
+    std::vector<SceneSignature> signatures;
+};
+
+// Writes `scenes` with `source` as their input. Returns 0 or a negative
+// AVERROR.
+int write_signatures(const char* path, const char* source,
+                     const std::vector<SceneSignature>& scenes);
+
+// Reads a signature file into `source` and `scenes`. Returns 0 or a
+// negative AVERROR.
+int read_signatures(const char* path, std::string& source,
+                    std::vector<SceneSignature>& scenes);
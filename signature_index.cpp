@@ -0,0 +1,280 @@
+#include "signature_index.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "util.h"
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+constexpr uint32_t index_version = 1;
+constexpr size_t offsets_per_chunk = chunk_values + 1;
+
+uint32_t chunk_of(uint64_t bits, int chunk) {
+    return static_cast<uint32_t>(bits >> (chunk * chunk_bits)) &
+           (chunk_values - 1);
+}
+
+// Calls `visit` for `key` and every value that differs from it in at most
+// `radius` of the bits from `from` up, each once.
+template <typename Visit>
+void visit_within(uint32_t key, int radius, int from, Visit& visit) {
+    visit(key);
+    if (radius == 0) {
+        return;
+    }
+    for (int b = from; b < chunk_bits; b++) {
+        visit_within(key ^ (uint32_t{1} << b), radius - 1, b + 1, visit);
+    }
+}
+
+int write_all(FILE* file, const void* data, size_t size) {
+    return fwrite(data, 1, size, file) == size ? 0 : AVERROR(EIO);
+}
+
+} // namespace
+
+int64_t build_signature_index(const char* list, const char* path) {
+    FILE* paths = fopen(list, "r");
+    if (paths == nullptr) {
+        return AVERROR(errno);
+    }
+
+    std::vector<SceneSignature> scenes;
+    std::string names;
+    uint32_t source_count = 0;
+    std::string source;
+    std::vector<SceneSignature> read;
+    std::array<char, 4096> line{};
+    int ret = 0;
+    while (ret >= 0 && fgets(line.data(), line.size(), paths) != nullptr) {
+        std::string sig_path(line.data());
+        while (!sig_path.empty() &&
+               (sig_path.back() == '\n' || sig_path.back() == '\r')) {
+            sig_path.pop_back();
+        }
+        if (sig_path.empty()) {
+            continue;
+        }
+        ret = read_signatures(sig_path.c_str(), source, read);
+        if (ret < 0) {
+            print_averror("Failed to read", sig_path.c_str(), ret);
+            break;
+        }
+        for (auto& s : read) {
+            s.source = source_count;
+            scenes.push_back(s);
+        }
+        names += source;
+        names += '\0';
+        source_count++;
+    }
+    (void)fclose(paths);
+    if (ret < 0) {
+        return ret;
+    }
+    if (scenes.size() >= UINT32_MAX) {
+        return AVERROR(ERANGE);
+    }
+
+    // counting sort of the scenes by each chunk's value
+    const size_t n = scenes.size();
+    std::vector<uint32_t> offsets(signature_chunks * offsets_per_chunk, 0);
+    std::vector<uint32_t> postings(signature_chunks * n);
+    for (int c = 0; c < signature_chunks; c++) {
+        uint32_t* off = offsets.data() + (c * offsets_per_chunk);
+        for (const auto& s : scenes) {
+            off[chunk_of(s.bits, c) + 1]++;
+        }
+        for (uint32_t v = 0; v < chunk_values; v++) {
+            off[v + 1] += off[v];
+        }
+        std::vector<uint32_t> next(off, off + chunk_values);
+        for (size_t i = 0; i < n; i++) {
+            postings[(c * n) + next[chunk_of(scenes[i].bits, c)]++] =
+                static_cast<uint32_t>(i);
+        }
+    }
+
+    SignatureIndexHeader hdr{};
+    memcpy(hdr.magic, signature_index_magic, sizeof(hdr.magic));
+    hdr.version = index_version;
+    hdr.source_count = source_count;
+    hdr.scene_count = n;
+    hdr.names_offset = sizeof(hdr) + (n * sizeof(SceneSignature)) +
+                       (offsets.size() * sizeof(uint32_t)) +
+                       (postings.size() * sizeof(uint32_t));
+    hdr.names_bytes = names.size();
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return AVERROR(errno);
+    }
+    ret = write_all(file, &hdr, sizeof(hdr));
+    if (ret >= 0) {
+        ret = write_all(file, scenes.data(), n * sizeof(SceneSignature));
+    }
+    if (ret >= 0) {
+        ret = write_all(file, offsets.data(),
+                        offsets.size() * sizeof(uint32_t));
+    }
+    if (ret >= 0) {
+        ret = write_all(file, postings.data(),
+                        postings.size() * sizeof(uint32_t));
+    }
+    if (ret >= 0) {
+        ret = write_all(file, names.data(), names.size());
+    }
+    if (fclose(file) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    return ret < 0 ? ret : static_cast<int64_t>(n);
+}
+
+std::unique_ptr<SignatureIndex> SignatureIndex::open(const char* path) {
+    auto index = std::unique_ptr<SignatureIndex>(new SignatureIndex());
+
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    const bool loaded = index->mapped.load(file);
+    (void)fclose(file);
+    if (!loaded) {
+        return nullptr;
+    }
+    const uint8_t* base = index->mapped.data();
+    const size_t size = index->mapped.size();
+
+    auto& hdr = index->header;
+    if (size < sizeof(hdr)) {
+        return nullptr;
+    }
+    memcpy(&hdr, base, sizeof(hdr));
+    const uint64_t n = hdr.scene_count;
+    if (memcmp(hdr.magic, signature_index_magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != index_version || n >= UINT32_MAX) {
+        return nullptr;
+    }
+    const uint64_t offsets_at = sizeof(hdr) + (n * sizeof(SceneSignature));
+    const uint64_t postings_at =
+        offsets_at + (signature_chunks * offsets_per_chunk * sizeof(uint32_t));
+    if (hdr.names_offset != postings_at + (signature_chunks * n *
+                                           sizeof(uint32_t)) ||
+        hdr.names_offset > size || hdr.names_bytes != size - hdr.names_offset) {
+        return nullptr;
+    }
+    index->scenes = reinterpret_cast<const SceneSignature*>(base + sizeof(hdr));
+    index->offsets = reinterpret_cast<const uint32_t*>(base + offsets_at);
+    index->postings = reinterpret_cast<const uint32_t*>(base + postings_at);
+
+    // the tables are trusted once their ends are; postings are checked as
+    // queries read them, so opening stays independent of the library size
+    for (int c = 0; c < signature_chunks; c++) {
+        const uint32_t* off = index->offsets + (c * offsets_per_chunk);
+        if (off[0] != 0 || off[chunk_values] != n) {
+            return nullptr;
+        }
+    }
+
+    const auto* names = reinterpret_cast<const char*>(base + hdr.names_offset);
+    size_t pos = 0;
+    while (pos < hdr.names_bytes) {
+        index->names.push_back(names + pos);
+        const void* end = memchr(names + pos, '\0', hdr.names_bytes - pos);
+        if (end == nullptr) {
+            return nullptr;
+        }
+        pos = static_cast<const char*>(end) - names + 1;
+    }
+    if (index->names.size() != hdr.source_count) {
+        return nullptr;
+    }
+
+    return index;
+}
+
+std::vector<ReuseMatch> SignatureIndex::find(uint64_t bits, int distance,
+                                             size_t limit) const {
+    distance = std::clamp(distance, 0, max_distance);
+    const int radius = distance / signature_chunks;
+    const uint64_t n = header.scene_count;
+
+    std::vector<ReuseMatch> found;
+    for (int c = 0; c < signature_chunks; c++) {
+        const uint32_t* off = offsets + (c * offsets_per_chunk);
+        const uint32_t* list = postings + (c * n);
+        auto visit = [&](uint32_t value) {
+            const uint32_t end = std::min<uint64_t>(off[value + 1], n);
+            for (uint32_t i = off[value]; i < end; i++) {
+                if (list[i] >= n) {
+                    continue;
+                }
+                const SceneSignature& s = scenes[list[i]];
+                const int d = hamming_distance(bits, s.bits);
+                if (d > distance || s.source >= names.size()) {
+                    continue;
+                }
+                // a scene that an earlier chunk reaches was found there
+                bool seen = false;
+                for (int e = 0; e < c && !seen; e++) {
+                    seen = std::popcount(chunk_of(bits, e) ^
+                                         chunk_of(s.bits, e)) <= radius;
+                }
+                if (!seen) {
+                    found.push_back(ReuseMatch{.scene = &s,
+                                               .source = names[s.source],
+                                               .distance = d});
+                }
+            }
+        };
+        visit_within(chunk_of(bits, c), radius, 0, visit);
+    }
+
+    std::sort(found.begin(), found.end(),
+              [](const ReuseMatch& a, const ReuseMatch& b) {
+                  return a.distance < b.distance;
+              });
+    if (found.size() > limit) {
+        found.resize(limit);
+    }
+    return found;
+}
+
+int print_reuse(const char* path, const std::vector<SceneSignature>& scenes) {
+    auto index = SignatureIndex::open(path);
+    if (index == nullptr) {
+        return AVERROR_INVALIDDATA;
+    }
+
+    size_t reused = 0;
+    for (const auto& s : scenes) {
+        auto matches = index->find(s.bits);
+        if (matches.empty()) {
+            continue;
+        }
+        reused++;
+        for (const auto& m : matches) {
+            printf("Reuse: frames %lld-%lld match %s frames %lld-%lld "
+                   "(distance %d)\n",
+                   static_cast<long long>(s.first_frame),
+                   static_cast<long long>(s.first_frame + s.frames - 1),
+                   m.source, static_cast<long long>(m.scene->first_frame),
+                   static_cast<long long>(m.scene->first_frame +
+                                          m.scene->frames - 1),
+                   m.distance);
+        }
+    }
+    printf("Reuse: %zu of %zu scenes found in %llu indexed scenes\n", reused,
+           scenes.size(),
+           static_cast<unsigned long long>(index->scene_count()));
+    return 0;
+}
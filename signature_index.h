@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "signature.h"
+#include "util.h"
+
+// On-disk index of the scene signatures of a whole library, for finding
+// reused footage without rescanning anything. Multi-index hashing: the 64
+// signature bits are cut into `signature_chunks` chunks, and each chunk has
+// a table from its value to the scenes that carry it. Two signatures within
+// distance d agree to within d / signature_chunks bits on at least one
+// chunk, so a query probes every value that close to its own in each table
+// and checks the full distance of the scenes listed there. The file is
+// mapped, and a query touches a few hundred table entries.
+//
+// Layout (little endian):
+//   SignatureIndexHeader
+//   SceneSignature scenes[scene_count]       `source` numbers the names
+//   uint32_t offsets[chunks][chunk_values + 1]
+//   uint32_t postings[chunks][scene_count]   scenes with value v in chunk c
+//                                            at [offsets[c][v],
+//                                            offsets[c][v + 1])
+//   source names at names_offset, NUL terminated, back to back
+
+inline constexpr char signature_index_magic[8] = {'S', 'D', 'S', 'I',
+                                                  'G', 'I', 'X', '1'};
+inline constexpr int signature_chunks = 4;
+inline constexpr int chunk_bits = 64 / signature_chunks;
+inline constexpr uint32_t chunk_values = uint32_t{1} << chunk_bits;
+
+struct SignatureIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t source_count;
+    uint64_t scene_count;
+    uint64_t names_offset;
+    uint64_t names_bytes;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(SignatureIndexHeader) == 64);
+
+// Builds an index at `path` from the signature files listed in `list`, one
+// path per line. Returns the number of scenes indexed or a negative
+// AVERROR.
+int64_t build_signature_index(const char* list, const char* path);
+
+// Prints the scenes of `scenes` found in the index at `path`. Returns 0 or
+// a negative AVERROR if the index cannot be read.
+int print_reuse(const char* path, const std::vector<SceneSignature>& scenes);
+
+struct ReuseMatch {
+    const SceneSignature* scene;
+    // name of the input the scene was found in
+    const char* source;
+    int distance;
+};
+
+class SignatureIndex {
+  public:
+    // bits in which a scene and its reuse may differ; queries probe
+    // (16 choose <= 2) values per chunk for it
+    static constexpr int default_distance = 8;
+    // beyond this the probes per chunk grow into the thousands
+    static constexpr int max_distance = 4 * signature_chunks - 1;
+
+    // Returns nullptr if `path` is not a readable signature index.
+    [[nodiscard]] static std::unique_ptr<SignatureIndex>
+    open(const char* path);
+
+    SignatureIndex(const SignatureIndex&) = delete;
+    SignatureIndex& operator=(const SignatureIndex&) = delete;
+
+    [[nodiscard]] uint64_t scene_count() const { return header.scene_count; }
+
+    // Indexed scenes within `distance` bits of `bits`, closest first, at
+    // most `limit` of them.
+    [[nodiscard]] std::vector<ReuseMatch>
+    find(uint64_t bits, int distance = default_distance,
+         size_t limit = 8) const;
+
+  private:
+    SignatureIndex() = default;
+
+    MappedFile mapped;
+    SignatureIndexHeader header{};
+    const SceneSignature* scenes{nullptr};
+    const uint32_t* offsets{nullptr};
+    const uint32_t* postings{nullptr};
+    std::vector<const char*> names;
+};
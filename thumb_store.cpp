@@ -0,0 +1,419 @@
+#include "thumb_store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+namespace {
+
+constexpr uint32_t store_version = 1;
+constexpr uint64_t chunk_alignment = 4096;
+
+// Residuals are Rice coded in groups of 64. Every group starts with a 4-bit
+// code: the Rice parameter k (0..7), or group_zero when all residuals are 0.
+constexpr size_t group_size = 64;
+constexpr uint32_t group_zero = 15;
+// Quotients of at least escape_q are written as escape_q ones followed by
+// the raw 8-bit residual.
+constexpr uint32_t escape_q = 15;
+
+class BitWriter {
+  public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(uint32_t value, int bits) {
+        acc = (acc << bits) | value;
+        fill += bits;
+        while (fill >= 8) {
+            fill -= 8;
+            out.push_back(static_cast<uint8_t>(acc >> fill));
+        }
+    }
+
+    void flush() {
+        if (fill > 0) {
+            out.push_back(static_cast<uint8_t>(acc << (8 - fill)));
+            fill = 0;
+        }
+    }
+
+  private:
+    std::vector<uint8_t>& out;
+    uint64_t acc{0};
+    int fill{0};
+};
+
+class BitReader {
+  public:
+    BitReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    uint32_t get(int bits) {
+        while (fill < bits) {
+            acc = (acc << 8) | (pos < size ? data[pos] : 0);
+            pos++;
+            fill += 8;
+        }
+        fill -= bits;
+        return static_cast<uint32_t>(acc >> fill) & ((1U << bits) - 1);
+    }
+
+    [[nodiscard]] bool overrun() const { return pos > size; }
+
+  private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos{0};
+    uint64_t acc{0};
+    int fill{0};
+};
+
+uint8_t zigzag(uint8_t cur, uint8_t pred) {
+    auto r = static_cast<int8_t>(static_cast<uint8_t>(cur - pred));
+    return static_cast<uint8_t>((r << 1) ^ (r >> 7));
+}
+
+uint8_t unzigzag(uint8_t z, uint8_t pred) {
+    auto r = static_cast<uint8_t>((z >> 1) ^ -(z & 1));
+    return static_cast<uint8_t>(pred + r);
+}
+
+uint32_t rice_cost(const uint8_t* v, size_t n, uint32_t k) {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t q = v[i] >> k;
+        bits += q < escape_q ? q + 1 + k : escape_q + 8;
+    }
+    return bits;
+}
+
+void encode_residuals(const uint8_t* v, size_t n, BitWriter& bw) {
+    for (size_t g = 0; g < n; g += group_size) {
+        const size_t len = std::min(group_size, n - g);
+        const uint8_t* grp = v + g;
+
+        if (std::all_of(grp, grp + len, [](uint8_t x) { return x == 0; })) {
+            bw.put(group_zero, 4);
+            continue;
+        }
+
+        uint32_t best_k = 0;
+        uint32_t best_cost = rice_cost(grp, len, 0);
+        for (uint32_t k = 1; k < 8; k++) {
+            uint32_t cost = rice_cost(grp, len, k);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_k = k;
+            }
+        }
+
+        bw.put(best_k, 4);
+        for (size_t i = 0; i < len; i++) {
+            uint32_t q = grp[i] >> best_k;
+            if (q < escape_q) {
+                // q ones and a terminating zero
+                bw.put(((1U << q) - 1) << 1, static_cast<int>(q) + 1);
+                if (best_k > 0) {
+                    bw.put(grp[i] & ((1U << best_k) - 1),
+                           static_cast<int>(best_k));
+                }
+            } else {
+                bw.put((1U << escape_q) - 1, escape_q);
+                bw.put(grp[i], 8);
+            }
+        }
+    }
+}
+
+void decode_residuals(uint8_t* v, size_t n, BitReader& br) {
+    for (size_t g = 0; g < n; g += group_size) {
+        const size_t len = std::min(group_size, n - g);
+        uint32_t k = br.get(4);
+
+        if (k == group_zero) {
+            memset(v + g, 0, len);
+            continue;
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            uint32_t q = 0;
+            while (q < escape_q && br.get(1) == 1) {
+                q++;
+            }
+            if (q == escape_q) {
+                v[g + i] = static_cast<uint8_t>(br.get(8));
+            } else {
+                uint32_t low = k > 0 ? br.get(static_cast<int>(k)) : 0;
+                v[g + i] = static_cast<uint8_t>((q << k) | low);
+            }
+        }
+    }
+}
+
+// Residuals of one plane predicted from its left/upper neighbour.
+void intra_residuals(PlaneView p, uint8_t* out) {
+    for (int y = 0; y < p.height; y++) {
+        const uint8_t* row = p.data + (y * p.stride);
+        for (int x = 0; x < p.width; x++) {
+            uint8_t pred = x > 0   ? row[x - 1]
+                           : y > 0 ? row[x - p.stride]
+                                   : 128;
+            *out++ = zigzag(row[x], pred);
+        }
+    }
+}
+
+void intra_reconstruct(uint8_t* dst, int width, int height,
+                       const uint8_t* res) {
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = dst + (static_cast<ptrdiff_t>(y) * width);
+        for (int x = 0; x < width; x++) {
+            uint8_t pred = x > 0   ? row[x - 1]
+                           : y > 0 ? row[x - width]
+                                   : 128;
+            row[x] = unzigzag(*res++, pred);
+        }
+    }
+}
+
+int write_all(FILE* file, const void* data, size_t size) {
+    return fwrite(data, 1, size, file) == size ? 0 : AVERROR(EIO);
+}
+
+} // namespace
+
+ThumbStoreWriter::~ThumbStoreWriter() { (void)close(); }
+
+int ThumbStoreWriter::append(const Thumbnail& thumb, int64_t pts) {
+    if (closed) {
+        return AVERROR(EINVAL);
+    }
+    if (file == nullptr) {
+        file = fopen(path, "wb");
+        if (file == nullptr) {
+            return AVERROR(errno);
+        }
+
+        header.version = store_version;
+        header.chunk_frames = chunk_frames;
+        header.width = static_cast<uint16_t>(thumb.width);
+        header.height = static_cast<uint16_t>(thumb.height);
+        header.time_base_num = time_base.num;
+        header.time_base_den = time_base.den;
+
+        // placeholder without the magic, so a store cut short by a crash
+        // is not mistaken for a complete one; rewritten by close()
+        int ret = write_all(file, &header, sizeof(header));
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (thumb.width != header.width || thumb.height != header.height) {
+        return AVERROR(EINVAL);
+    }
+
+    pending.insert(pending.end(), thumb.data.begin(), thumb.data.end());
+    pending_pts.push_back(pts);
+
+    if (pending_pts.size() == chunk_frames) {
+        return flush_chunk();
+    }
+    return 0;
+}
+
+int ThumbStoreWriter::flush_chunk() {
+    if (pending_pts.empty()) {
+        return 0;
+    }
+
+    const size_t frame_bytes = Thumbnail::bytes(header.width, header.height);
+    const size_t frames = pending_pts.size();
+
+    std::vector<uint8_t> residuals(frame_bytes);
+    std::vector<uint8_t> coded;
+    coded.reserve(frames * frame_bytes / 4);
+    BitWriter bw(coded);
+
+    Thumbnail view;
+    for (size_t f = 0; f < frames; f++) {
+        const uint8_t* cur = pending.data() + (f * frame_bytes);
+
+        if (f == 0) {
+            view.width = header.width;
+            view.height = header.height;
+            view.data.assign(cur, cur + frame_bytes);
+            uint8_t* out = residuals.data();
+            for (int p = 0; p < 3; p++) {
+                PlaneView pv = view.plane(p);
+                intra_residuals(pv, out);
+                out += static_cast<size_t>(pv.width) * pv.height;
+            }
+        } else {
+            const uint8_t* prev = cur - frame_bytes;
+            for (size_t i = 0; i < frame_bytes; i++) {
+                residuals[i] = zigzag(cur[i], prev[i]);
+            }
+        }
+
+        encode_residuals(residuals.data(), frame_bytes, bw);
+    }
+    bw.flush();
+
+    // pad to the chunk alignment
+    auto offset = static_cast<uint64_t>(ftello(file));
+    uint64_t aligned = (offset + chunk_alignment - 1) & ~(chunk_alignment - 1);
+    static constexpr uint8_t zeros[chunk_alignment] = {};
+    int ret = write_all(file, zeros, aligned - offset);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = write_all(file, pending_pts.data(), frames * sizeof(int64_t));
+    if (ret < 0) {
+        return ret;
+    }
+    ret = write_all(file, coded.data(), coded.size());
+    if (ret < 0) {
+        return ret;
+    }
+
+    index.push_back(ThumbChunkEntry{
+        .offset = aligned,
+        .size = static_cast<uint32_t>((frames * sizeof(int64_t)) +
+                                      coded.size()),
+        .frames = static_cast<uint32_t>(frames),
+        .first_frame = frames_written,
+    });
+    frames_written += static_cast<int64_t>(frames);
+
+    pending.clear();
+    pending_pts.clear();
+    return 0;
+}
+
+int ThumbStoreWriter::close() {
+    if (file == nullptr) {
+        return 0;
+    }
+
+    int ret = flush_chunk();
+    if (ret >= 0) {
+        memcpy(header.magic, thumb_store_magic, sizeof(header.magic));
+        header.chunk_count = static_cast<uint32_t>(index.size());
+        header.frame_count = frames_written;
+        header.index_offset = static_cast<uint64_t>(ftello(file));
+        ret = write_all(file, index.data(),
+                        index.size() * sizeof(ThumbChunkEntry));
+    }
+    if (ret >= 0) {
+        ret = fseeko(file, 0, SEEK_SET) == 0
+                  ? write_all(file, &header, sizeof(header))
+                  : AVERROR(EIO);
+    }
+
+    if (fclose(file) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    file = nullptr;
+    closed = true;
+    return ret;
+}
+
+std::unique_ptr<ThumbStoreReader> ThumbStoreReader::open(const char* path) {
+    // Every input is probed here before it is decoded, so nothing past the
+    // header is read until it proves to be a store, and pipes or devices
+    // are not read at all.
+    struct stat st {};
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    auto closer = std::unique_ptr<FILE, decltype([](FILE* f) {
+                                      (void)fclose(f);
+                                  })>(file);
+
+    ThumbStoreHeader hdr{};
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        memcmp(hdr.magic, thumb_store_magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != store_version || hdr.width < 2 || hdr.height < 2) {
+        return nullptr;
+    }
+
+    auto reader = std::unique_ptr<ThumbStoreReader>(new ThumbStoreReader());
+    reader->header = hdr;
+
+    if (!reader->mapped.load(file)) {
+        return nullptr;
+    }
+    const uint8_t* base = reader->mapped.data();
+    const size_t size = reader->mapped.size();
+
+    const uint64_t index_bytes =
+        static_cast<uint64_t>(hdr.chunk_count) * sizeof(ThumbChunkEntry);
+    if (hdr.index_offset > size || index_bytes > size - hdr.index_offset) {
+        return nullptr;
+    }
+    reader->index.resize(hdr.chunk_count);
+    memcpy(reader->index.data(), base + hdr.index_offset, index_bytes);
+
+    for (const auto& entry : reader->index) {
+        if (entry.offset > size || entry.size > size - entry.offset ||
+            entry.frames * sizeof(int64_t) > entry.size) {
+            return nullptr;
+        }
+    }
+
+    return reader;
+}
+
+bool ThumbStoreReader::read_chunk(size_t i, std::vector<uint8_t>& frames,
+                                  std::vector<int64_t>& pts) const {
+    const auto& entry = index[i];
+    const size_t frame_bytes = Thumbnail::bytes(header.width, header.height);
+    const uint8_t* data = mapped.data() + entry.offset;
+    const size_t pts_bytes = entry.frames * sizeof(int64_t);
+
+    pts.resize(entry.frames);
+    memcpy(pts.data(), data, pts_bytes);
+
+    frames.resize(entry.frames * frame_bytes);
+    std::vector<uint8_t> residuals(frame_bytes);
+    BitReader br(data + pts_bytes, entry.size - pts_bytes);
+
+    for (size_t f = 0; f < entry.frames; f++) {
+        uint8_t* cur = frames.data() + (f * frame_bytes);
+        decode_residuals(residuals.data(), frame_bytes, br);
+
+        if (f == 0) {
+            const uint8_t* res = residuals.data();
+            int w = header.width;
+            int h = header.height;
+            for (int p = 0; p < 3; p++) {
+                intra_reconstruct(cur, w, h, res);
+                size_t plane_bytes = static_cast<size_t>(w) * h;
+                cur += plane_bytes;
+                res += plane_bytes;
+                if (p == 0) {
+                    w /= 2;
+                    h /= 2;
+                }
+            }
+        } else {
+            const uint8_t* prev = cur - frame_bytes;
+            for (size_t j = 0; j < frame_bytes; j++) {
+                cur[j] = unzigzag(residuals[j], prev[j]);
+            }
+        }
+    }
+
+    return !br.overrun();
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "thumbnail.h"
+#include "util.h"
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+// On-disk store of per-frame thumbnails, so new detectors and parameter
+// sweeps can run without decoding the source again.
+//
+// Layout (little endian):
+//   ThumbStoreHeader
+//   chunks, each starting on a 4 KiB boundary:
+//     int64_t pts[frames]
+//     Rice coded residuals of `frames` thumbnails
+//   ThumbChunkEntry index[chunk_count] at header.index_offset
+//
+// Every chunk decodes on its own: its first thumbnail is predicted from the
+// left/upper neighbour, the others from the previous thumbnail. Chunks are
+// aligned so a reader can map the file and touch only the pages it needs.
+
+inline constexpr char thumb_store_magic[8] = {'S', 'D', 'T', 'H',
+                                              'U', 'M', 'B', '1'};
+
+struct ThumbStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_frames;
+    uint16_t width;
+    uint16_t height;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint32_t chunk_count;
+    int64_t frame_count;
+    uint64_t index_offset;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(ThumbStoreHeader) == 64);
+
+struct ThumbChunkEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t frames;
+    int64_t first_frame;
+};
+static_assert(sizeof(ThumbChunkEntry) == 24);
+
+class ThumbStoreWriter {
+  public:
+    ThumbStoreWriter(const char* path, AVRational time_base,
+                     uint32_t chunk_frames = 256)
+        : path(path), time_base(time_base), chunk_frames(chunk_frames) {}
+    ~ThumbStoreWriter();
+
+    ThumbStoreWriter(const ThumbStoreWriter&) = delete;
+    ThumbStoreWriter& operator=(const ThumbStoreWriter&) = delete;
+
+    // The file is created on the first call, once the thumbnail size is
+    // known. All thumbnails must have that size. Returns 0 or a negative
+    // AVERROR.
+    int append(const Thumbnail& thumb, int64_t pts);
+
+    // Flushes the last chunk and writes the index.
+    int close();
+
+  private:
+    int flush_chunk();
+
+    const char* path;
+    AVRational time_base;
+    uint32_t chunk_frames;
+
+    FILE* file{nullptr};
+    ThumbStoreHeader header{};
+    std::vector<ThumbChunkEntry> index;
+
+    // thumbnails of the chunk being built, back to back
+    std::vector<uint8_t> pending;
+    std::vector<int64_t> pending_pts;
+    int64_t frames_written{0};
+    bool closed{false};
+};
+
+class ThumbStoreReader {
+  public:
+    // Returns nullptr if `path` is not a readable thumbnail store.
+    [[nodiscard]] static std::unique_ptr<ThumbStoreReader>
+    open(const char* path);
+
+    ThumbStoreReader(const ThumbStoreReader&) = delete;
+    ThumbStoreReader& operator=(const ThumbStoreReader&) = delete;
+
+    [[nodiscard]] int width() const { return header.width; }
+    [[nodiscard]] int height() const { return header.height; }
+    [[nodiscard]] int64_t frame_count() const { return header.frame_count; }
+    [[nodiscard]] AVRational time_base() const {
+        return AVRational{header.time_base_num, header.time_base_den};
+    }
+    [[nodiscard]] size_t chunk_count() const { return index.size(); }
+    [[nodiscard]] const ThumbChunkEntry& chunk(size_t i) const {
+        return index[i];
+    }
+
+    // Decodes chunk `i` into `frames` (thumbnails back to back, each
+    // Thumbnail::bytes(width(), height()) long) and its timestamps.
+    bool read_chunk(size_t i, std::vector<uint8_t>& frames,
+                    std::vector<int64_t>& pts) const;
+
+  private:
+    ThumbStoreReader() = default;
+
+    MappedFile mapped;
+    ThumbStoreHeader header{};
+    std::vector<ThumbChunkEntry> index;
+};
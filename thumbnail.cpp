@@ -0,0 +1,169 @@
+#include "thumbnail.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "kernels.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+void box_downscale(PlaneView src, uint8_t* dst, int dst_width,
+                   int dst_height) {
+    // Column ranges are the same for every output row. Each range covers at
+    // least one source pixel so upscaling degrades to nearest neighbour.
+    std::vector<int> x_start(dst_width + 1);
+    for (int x = 0; x <= dst_width; x++) {
+        x_start[x] = static_cast<int>(static_cast<int64_t>(x) * src.width /
+                                      dst_width);
+    }
+
+    std::vector<uint32_t> col_sum(src.width);
+    const auto sum_rows = kernels().sum_rows;
+
+    for (int y = 0; y < dst_height; y++) {
+        int y0 = static_cast<int>(static_cast<int64_t>(y) * src.height /
+                                  dst_height);
+        int y1 = static_cast<int>(static_cast<int64_t>(y + 1) * src.height /
+                                  dst_height);
+        y1 = std::max(y1, y0 + 1);
+
+        sum_rows(src.data + (y0 * src.stride), src.stride, y1 - y0, src.width,
+                 col_sum.data());
+
+        const auto rows = static_cast<uint32_t>(y1 - y0);
+        for (int x = 0; x < dst_width; x++) {
+            int x0 = x_start[x];
+            int x1 = std::max(x_start[x + 1], x0 + 1);
+            uint32_t sum = 0;
+            for (int sx = x0; sx < x1; sx++) {
+                sum += col_sum[sx];
+            }
+            uint32_t area = rows * static_cast<uint32_t>(x1 - x0);
+            dst[x] = static_cast<uint8_t>((sum + (area / 2)) / area);
+        }
+        dst += dst_width;
+    }
+}
+
+bool is_native_format(int format) {
+    const auto* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    if (desc == nullptr ||
+        (desc->flags & (AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PAL |
+                        AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL |
+                        AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BAYER)) != 0) {
+        return false;
+    }
+
+    const int planes = desc->nb_components <= 2 ? 1 : 3;
+    for (int i = 0; i < planes; i++) {
+        const auto& comp = desc->comp[i];
+        if (comp.depth != 8 || comp.step != 1 || comp.plane != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Thumbnailer::split_chroma(const AVFrame* frame, Thumbnail& out) {
+    const int cw = AV_CEIL_RSHIFT(frame->width, 1);
+    const int ch = AV_CEIL_RSHIFT(frame->height, 1);
+    const auto plane_bytes = static_cast<size_t>(cw) * ch;
+    chroma_u.resize(plane_bytes);
+    chroma_v.resize(plane_bytes);
+
+    // NV21 stores V first
+    uint8_t* first = chroma_u.data();
+    uint8_t* second = chroma_v.data();
+    if (frame->format == AV_PIX_FMT_NV21) {
+        std::swap(first, second);
+    }
+    const auto deinterleave = kernels().deinterleave;
+    for (int y = 0; y < ch; y++) {
+        deinterleave(frame->data[1] + (y * frame->linesize[1]),
+                     first + (static_cast<size_t>(y) * cw),
+                     second + (static_cast<size_t>(y) * cw), cw);
+    }
+
+    box_downscale(PlaneView{.data = chroma_u.data(),
+                            .stride = cw,
+                            .width = cw,
+                            .height = ch},
+                  out.plane_data(1), thumb_width / 2, thumb_height / 2);
+    box_downscale(PlaneView{.data = chroma_v.data(),
+                            .stride = cw,
+                            .width = cw,
+                            .height = ch},
+                  out.plane_data(2), thumb_width / 2, thumb_height / 2);
+}
+
+Thumbnailer::~Thumbnailer() { sws_freeContext(sws); }
+
+bool Thumbnailer::convert(const AVFrame* frame, Thumbnail& out) {
+    // area averaging straight to the thumbnail size; converting at full
+    // resolution first would cost far more than the downscale itself
+    sws = sws_getCachedContext(
+        sws, frame->width, frame->height,
+        static_cast<AVPixelFormat>(frame->format), thumb_width, thumb_height,
+        AV_PIX_FMT_YUV420P, SWS_AREA, nullptr, nullptr, nullptr);
+    if (sws == nullptr) {
+        return false;
+    }
+
+    uint8_t* const dst[4] = {out.plane_data(0), out.plane_data(1),
+                             out.plane_data(2), nullptr};
+    const int dst_stride[4] = {thumb_width, thumb_width / 2, thumb_width / 2,
+                               0};
+    return sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst,
+                     dst_stride) > 0;
+}
+
+bool Thumbnailer::make(const AVFrame* frame, Thumbnail& out) {
+    if (thumb_width == 0) {
+        thumb_width = std::max(target_width, 2);
+        auto h = static_cast<int64_t>(thumb_width) * frame->height /
+                 std::max(frame->width, 1);
+        thumb_height = std::max(static_cast<int>(h) & ~1, 2);
+    }
+    out.resize(thumb_width, thumb_height);
+
+    const bool semi_planar =
+        frame->format == AV_PIX_FMT_NV12 || frame->format == AV_PIX_FMT_NV21;
+    if (!semi_planar && !is_native_format(frame->format)) {
+        return convert(frame, out);
+    }
+    const auto* desc =
+        av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    const bool gray = desc->nb_components <= 2;
+
+    box_downscale(PlaneView{.data = frame->data[0],
+                            .stride = frame->linesize[0],
+                            .width = frame->width,
+                            .height = frame->height},
+                  out.plane_data(0), thumb_width, thumb_height);
+
+    if (semi_planar) {
+        split_chroma(frame, out);
+        return true;
+    }
+
+    for (int i = 1; i < 3; i++) {
+        if (gray) {
+            memset(out.plane_data(i), 128,
+                   static_cast<size_t>(thumb_width / 2) * (thumb_height / 2));
+            continue;
+        }
+        box_downscale(
+            PlaneView{.data = frame->data[i],
+                      .stride = frame->linesize[i],
+                      .width = AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w),
+                      .height =
+                          AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h)},
+            out.plane_data(i), thumb_width / 2, thumb_height / 2);
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+struct SwsContext;
+
+// Thumbnail width when neither --thumb-width nor a machine profile sets one.
+inline constexpr int default_thumb_width = 64;
+
+// Non-owning view of one 8-bit image plane.
+struct PlaneView {
+    const uint8_t* data{nullptr};
+    ptrdiff_t stride{0};
+    int width{0};
+    int height{0};
+};
+
+// Downscaled 4:2:0 copy of a frame. The planes are stored back to back
+// without padding: width x height luma, then two (width/2) x (height/2)
+// chroma planes.
+struct Thumbnail {
+    int width{0};
+    int height{0};
+    std::vector<uint8_t> data;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        data.resize(bytes(w, h));
+    }
+
+    [[nodiscard]] static size_t bytes(int w, int h) {
+        auto luma = static_cast<size_t>(w) * static_cast<size_t>(h);
+        return luma + (luma / 2);
+    }
+
+    [[nodiscard]] uint8_t* plane_data(int plane) {
+        return data.data() + plane_offset(plane);
+    }
+
+    [[nodiscard]] PlaneView plane(int plane) const {
+        int w = plane == 0 ? width : width / 2;
+        int h = plane == 0 ? height : height / 2;
+        return PlaneView{.data = data.data() + plane_offset(plane),
+                         .stride = w,
+                         .width = w,
+                         .height = h};
+    }
+
+  private:
+    [[nodiscard]] size_t plane_offset(int plane) const {
+        auto luma = static_cast<size_t>(width) * static_cast<size_t>(height);
+        return plane == 0 ? 0 : luma + ((plane - 1) * (luma / 4));
+    }
+};
+
+// 8-bit planar YUV or gray with one component per plane, which is what the
+// analysis kernels read directly.
+[[nodiscard]] bool is_native_format(int format);
+
+// Area-averaging resize of an 8-bit plane into a tightly packed buffer.
+void box_downscale(PlaneView src, uint8_t* dst, int dst_width,
+                   int dst_height);
+
+// Turns decoded frames into thumbnails of a fixed size. The size is chosen
+// from the first frame (`width` wide, aspect ratio kept) and stays the same
+// for the whole stream, even if the source resolution changes.
+//
+// Planar 8-bit YUV, NV12/NV21 and gray are downscaled by the kernels. Other
+// pixel formats go through swscale, which converts and scales to the
+// thumbnail size in one pass.
+class Thumbnailer {
+  public:
+    explicit Thumbnailer(int width) : target_width(width & ~1) {}
+    ~Thumbnailer();
+
+    Thumbnailer(const Thumbnailer&) = delete;
+    Thumbnailer& operator=(const Thumbnailer&) = delete;
+
+    // Returns false if swscale cannot convert the frame's pixel format.
+    bool make(const AVFrame* frame, Thumbnail& out);
+
+  private:
+    void split_chroma(const AVFrame* frame, Thumbnail& out);
+    bool convert(const AVFrame* frame, Thumbnail& out);
+
+    int target_width;
+    int thumb_width{0};
+    int thumb_height{0};
+    // NV12 chroma split into planes
+    std::vector<uint8_t> chroma_u;
+    std::vector<uint8_t> chroma_v;
+    // rebuilt only when the source format or size changes
+    SwsContext* sws{nullptr};
+};
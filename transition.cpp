@@ -0,0 +1,96 @@
+#include "transition.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+// frames scoring at least this fraction of the threshold can be part of a
+// transition
+constexpr double low_fraction = 0.3;
+// shortest run taken as a transition
+constexpr int64_t min_frames = 3;
+// a run ends on a frame scoring under this fraction of the low threshold;
+// frames between that and the low threshold are noise inside the run
+constexpr double settled_fraction = 0.5;
+// noisy frames a run survives
+constexpr int max_gap = 2;
+// tile means are smoother than pixels, so the shot-change check on the
+// grids uses a lower bar than the pixel threshold
+constexpr double grid_change_fraction = 0.5;
+// slack for a middle tile to count as between the start and end tiles
+constexpr int between_tolerance = 8;
+// share of middle tiles that must be between them
+constexpr double between_share = 0.8;
+
+} // namespace
+
+TransitionDetector::TransitionDetector(double threshold, int max_frames)
+    : threshold(threshold), low(threshold * low_fraction),
+      settled(low * settled_fraction), max_frames(max_frames),
+      // the frame before a run, the run and the frame after it
+      ring(static_cast<size_t>(max_frames) + 2) {}
+
+bool TransitionDetector::push(const FrameScore& score, const TileGrid& grid) {
+    const int64_t pos = pushed++;
+    ring[pos % ring.size()] = grid;
+
+    const bool active =
+        grid.valid && score.sad >= low && score.sad < threshold;
+    if (run_start < 0) {
+        if (active && pos > 0) {
+            run_start = pos;
+            accumulated = score.sad;
+            gap = 0;
+        }
+        return false;
+    }
+
+    if (pos - run_start > max_frames || !grid.valid ||
+        score.sad >= threshold) {
+        // motion, no pixels, or a hard cut the threshold detector takes
+        run_start = -1;
+        return false;
+    }
+    if (active) {
+        accumulated += score.sad;
+        gap = 0;
+        return false;
+    }
+
+    if (score.sad >= settled) {
+        // noise inside the run
+        if (++gap > max_gap) {
+            run_start = -1;
+        }
+        return false;
+    }
+
+    // the picture settled: the run is over
+    const bool found = pos - run_start >= min_frames &&
+                       accumulated >= threshold && confirm(pos);
+    run_start = -1;
+    return found;
+}
+
+bool TransitionDetector::confirm(int64_t end) const {
+    const TileGrid& before = grid_at(run_start - 1);
+    const TileGrid& after = grid_at(end);
+    const TileGrid& middle = grid_at((run_start + end) / 2);
+    if (!before.valid || !middle.valid ||
+        before.distance(after) < threshold * grid_change_fraction) {
+        return false;
+    }
+
+    size_t between = 0;
+    for (size_t i = 0; i < middle.mean.size(); i++) {
+        const int lo = std::min(before.mean[i], after.mean[i]);
+        const int hi = std::max(before.mean[i], after.mean[i]);
+        if (middle.mean[i] >= lo - between_tolerance &&
+            middle.mean[i] <= hi + between_tolerance) {
+            between++;
+        }
+    }
+    return static_cast<double>(between) >=
+           between_share * static_cast<double>(middle.mean.size());
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "detect.h"
+#include "flash.h"
+
+// Twin-comparison detector for dissolves, fades and wipes. Their frame
+// scores stay under the cut threshold but above a low one for several
+// frames in a row; summed they reach the threshold. A run like that is a
+// transition when
+//   - the frames before and after it show different shots, and
+//   - the middle frame lies between them tile by tile (a blend, or part of
+//     either), which camera pans and zooms do not.
+// Runs longer than `max_frames` are motion, not transitions. Memory is a
+// ring of max_frames + 2 tile grids.
+class TransitionDetector {
+  public:
+    TransitionDetector(double threshold, int max_frames);
+
+    // Returns true if `score.frame` is the first frame after a transition.
+    // Frames without a valid grid end any run without a transition.
+    bool push(const FrameScore& score, const TileGrid& grid);
+
+  private:
+    [[nodiscard]] bool confirm(int64_t end) const;
+    [[nodiscard]] const TileGrid& grid_at(int64_t pos) const {
+        return ring[pos % ring.size()];
+    }
+
+    double threshold;
+    double low;
+    double settled;
+    int max_frames;
+    std::vector<TileGrid> ring;
+    int64_t pushed{0};
+    // position of the first frame of the current run, -1 outside a run
+    int64_t run_start{-1};
+    double accumulated{0.0};
+    // noisy frames since the last active one
+    int gap{0};
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+extern "C" {
+#include <libavutil/error.h>
+}
+
+#define AlwaysInline __attribute__((always_inline)) inline
+
+AlwaysInline void w_stdout(std::string_view sv) {
+    write(STDOUT_FILENO, sv.data(), sv.size());
+}
+AlwaysInline void w_stderr(std::string_view sv) {
+    write(STDERR_FILENO, sv.data(), sv.size());
+}
+
+template <typename T, auto Alloc, auto Free> auto make_managed() {
+    return std::unique_ptr<T, decltype([](T* ptr) { Free(&ptr); })>(Alloc());
+}
+
+// "<what> <path>: <averror as text>" on stderr
+inline void print_averror(const char* what, const char* path, int averror) {
+    std::array<char, AV_ERROR_MAX_STRING_SIZE> errbuf{};
+    av_make_error_string(errbuf.data(), errbuf.size(), averror);
+    (void)fprintf(stderr, "%s %s: %s\n", what, path, errbuf.data());
+}
+
+// Compares embedded numbers by value so "seg10.ts" sorts after "seg9.ts".
+inline bool natural_less(const std::string& a, const std::string& b) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit(a[i]) != 0 && isdigit(b[j]) != 0) {
+            size_t ie = i;
+            size_t je = j;
+            while (ie < a.size() && isdigit(a[ie]) != 0) {
+                ie++;
+            }
+            while (je < b.size() && isdigit(b[je]) != 0) {
+                je++;
+            }
+            std::string_view na(a.data() + i, ie - i);
+            std::string_view nb(b.data() + j, je - j);
+            while (na.size() > 1 && na[0] == '0') {
+                na.remove_prefix(1);
+            }
+            while (nb.size() > 1 && nb[0] == '0') {
+                nb.remove_prefix(1);
+            }
+            if (na.size() != nb.size()) {
+                return na.size() < nb.size();
+            }
+            if (na != nb) {
+                return na < nb;
+            }
+            i = ie;
+            j = je;
+        } else {
+            if (a[i] != b[j]) {
+                return a[i] < b[j];
+            }
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+template <class> inline constexpr bool always_false_v = false;
+
+template <class result_t = std::chrono::milliseconds,
+          class clock_t = std::chrono::steady_clock,
+          class duration_t = std::chrono::milliseconds>
+auto since(std::chrono::time_point<clock_t, duration_t> const& start) {
+    return std::chrono::duration_cast<result_t>(clock_t::now() - start);
+}
+
+inline auto now() { return std::chrono::steady_clock::now(); }
+
+// A whole file in memory, for the binary readers: mapped where the OS
+// allows it, read into a buffer otherwise (Windows, pipes).
+class MappedFile {
+  public:
+    MappedFile() = default;
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped) {
+            munmap(const_cast<uint8_t*>(base), bytes);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Everything in `file` from its start, whatever was read from it
+    // already. Returns false if it could not be read.
+    [[nodiscard]] bool load(FILE* file) {
+#ifndef _WIN32
+        struct stat st {};
+        if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0) {
+            void* map = mmap(nullptr, static_cast<size_t>(st.st_size),
+                             PROT_READ, MAP_PRIVATE, fileno(file), 0);
+            if (map != MAP_FAILED) {
+                base = static_cast<const uint8_t*>(map);
+                bytes = static_cast<size_t>(st.st_size);
+                mapped = true;
+                return true;
+            }
+        }
+#endif
+
+        // a pipe cannot seek back, but nothing was read from it either
+        if (ftello(file) > 0 && fseeko(file, 0, SEEK_SET) != 0) {
+            return false;
+        }
+        std::array<uint8_t, 4096> buf{};
+        size_t got = 0;
+        while ((got = fread(buf.data(), 1, buf.size(), file)) > 0) {
+            fallback.insert(fallback.end(), buf.begin(), buf.begin() + got);
+        }
+        base = fallback.data();
+        bytes = fallback.size();
+        return ferror(file) == 0;
+    }
+
+    [[nodiscard]] const uint8_t* data() const { return base; }
+    [[nodiscard]] size_t size() const { return bytes; }
+
+  private:
+    const uint8_t* base{nullptr};
+    size_t bytes{0};
+    bool mapped{false};
+    std::vector<uint8_t> fallback;
+};
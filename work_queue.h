@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Bounded multi-producer/multi-consumer queue. push() blocks while the queue
+// is full so a slow consumer applies backpressure to the producer instead of
+// letting memory grow without limit.
+template <typename T> class WorkQueue {
+  public:
+    explicit WorkQueue(size_t capacity) : capacity(capacity) {}
+
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    void push(T item) {
+        std::unique_lock lock(mtx);
+        not_full.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    // Returns std::nullopt once the queue is closed and drained.
+    std::optional<T> pop() {
+        std::unique_lock lock(mtx);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return item;
+    }
+
+    // Wakes all consumers; pending items are still delivered.
+    void close() {
+        {
+            std::lock_guard lock(mtx);
+            closed = true;
+        }
+        not_empty.notify_all();
+    }
+
+  private:
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed{false};
+};
+
+// Collects results that finish out of order and hands them back in sequence
+// order. Producers call wait_for_slot() before starting item `seq`, which
+// keeps at most `window` items buffered ahead of the consumer.
+template <typename T> class ReorderBuffer {
+  public:
+    explicit ReorderBuffer(size_t window) : window(window) {}
+
+    ReorderBuffer(const ReorderBuffer&) = delete;
+    ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+    // Returns false if the buffer was closed while waiting.
+    bool wait_for_slot(uint64_t seq) {
+        std::unique_lock lock(mtx);
+        slot_free.wait(lock, [&] { return seq < next + window || closed; });
+        return !closed;
+    }
+
+    void put(uint64_t seq, T item) {
+        {
+            std::lock_guard lock(mtx);
+            pending.emplace_back(seq, std::move(item));
+        }
+        ready.notify_all();
+    }
+
+    // Next item in sequence order; std::nullopt once `end` (see finish())
+    // is reached or the buffer is closed.
+    std::optional<T> pop() {
+        std::unique_lock lock(mtx);
+        auto it = pending.end();
+        ready.wait(lock, [&] {
+            it = std::find_if(pending.begin(), pending.end(),
+                              [&](const auto& p) { return p.first == next; });
+            return it != pending.end() || next >= end || closed;
+        });
+        if (it == pending.end()) {
+            return std::nullopt;
+        }
+        T item = std::move(it->second);
+        pending.erase(it);
+        next++;
+        lock.unlock();
+        slot_free.notify_all();
+        return item;
+    }
+
+    // No items past `total` will be produced.
+    void finish(uint64_t total) {
+        {
+            std::lock_guard lock(mtx);
+            end = total;
+        }
+        ready.notify_all();
+    }
+
+    // Wakes everyone up for shutdown. Items still buffered are left to the
+    // caller's destructor.
+    void close() {
+        {
+            std::lock_guard lock(mtx);
+            closed = true;
+        }
+        ready.notify_all();
+        slot_free.notify_all();
+    }
+
+  private:
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::condition_variable slot_free;
+    std::deque<std::pair<uint64_t, T>> pending;
+    size_t window;
+    uint64_t next{0};
+    uint64_t end{UINT64_MAX};
+    bool closed{false};
+};